@@ -0,0 +1,392 @@
+#include "Benchmark.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include "CommandLine.h"
+#include "CpuImageProcessing.h"
+#include "OpenCLImageProcessing.h"
+#include "OpenCVImageProcessing.h"
+
+void printBenchmarkUsage() {
+    std::cout << "Usage: opencl_aufgabe --benchmark [options]" << std::endl;
+    std::cout << "  --backends cpu,opencl,opencv   Backends to measure" << std::endl;
+    std::cout << "  --ops hsv,blur,gaussian        Operations to measure, hsv-blur as one fused pipeline," << std::endl;
+    std::cout << "                                 hsv-batch and blur-batch on OpenCL" << std::endl;
+    std::cout << "  --batch-size 32                Images per batch of the batch operations" << std::endl;
+    std::cout << "  --radii 10                     Blur radii, sigmas of gaussian" << std::endl;
+    std::cout << "  --images a.jpg,b.jpg           Image files" << std::endl;
+    std::cout << "  --sizes 640x480,1920x1080      Synthetic 3-channel images" << std::endl;
+    std::cout << "  --device gpu                   OpenCL device: gpu, cpu, index or name" << std::endl;
+    std::cout << "  --clear-kernel-cache           Start OpenCL without cached binaries" << std::endl;
+    std::cout << "  --generic-kernels              Generic blur code for every radius" << std::endl;
+    std::cout << "  --hsv-fixed-point              Integer HSV conversion without divisions" << std::endl;
+    std::cout << "  --warmup 3                     Unmeasured runs before measuring" << std::endl;
+    std::cout << "  --iterations 20                Measured runs" << std::endl;
+    std::cout << "  --json benchmark.json          JSON report" << std::endl;
+    std::cout << "  --csv benchmark.csv            CSV report" << std::endl;
+}
+
+bool parseBenchmarkOptions(int argc, char** argv, BenchmarkOptions& options) {
+    for (int i = 0; i < argc; i++) {
+        std::string flag = argv[i];
+
+        // Flags without a value
+        if (flag == "--clear-kernel-cache") {
+            options.clearKernelCache = true;
+            continue;
+        }
+        if (flag == "--generic-kernels") {
+            options.specializedKernels = false;
+            continue;
+        }
+        if (flag == "--hsv-fixed-point") {
+            options.fixedPointHsv = true;
+            continue;
+        }
+
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << flag << std::endl;
+            printBenchmarkUsage();
+            return false;
+        }
+        std::string value = argv[++i];
+
+        try {
+            if (flag == "--backends") {
+                options.backends = splitList(value);
+            }
+            else if (flag == "--ops") {
+                options.operations = splitList(value);
+            }
+            else if (flag == "--radii") {
+                options.radii.clear();
+                for (const std::string& radius : splitList(value))
+                    options.radii.push_back(std::stoi(radius));
+            }
+            else if (flag == "--images") {
+                options.images = splitList(value);
+            }
+            else if (flag == "--sizes") {
+                for (const std::string& size : splitList(value)) {
+                    size_t separator = size.find('x');
+                    if (separator == std::string::npos)
+                        throw std::invalid_argument(size);
+                    options.sizes.push_back(cv::Size(std::stoi(size.substr(0, separator)), std::stoi(size.substr(separator + 1))));
+                }
+            }
+            else if (flag == "--device") {
+                options.device = value;
+            }
+            else if (flag == "--batch-size") {
+                options.batchSize = std::stoi(value);
+            }
+            else if (flag == "--warmup") {
+                options.warmup = std::stoi(value);
+            }
+            else if (flag == "--iterations") {
+                options.iterations = std::stoi(value);
+            }
+            else if (flag == "--json") {
+                options.jsonFile = value;
+            }
+            else if (flag == "--csv") {
+                options.csvFile = value;
+            }
+            else {
+                std::cerr << "Unknown option " << flag << std::endl;
+                printBenchmarkUsage();
+                return false;
+            }
+        }
+        catch (const std::exception&) {
+            std::cerr << "Invalid value for " << flag << ": " << value << std::endl;
+            printBenchmarkUsage();
+            return false;
+        }
+    }
+
+    if (options.iterations < 1 || options.warmup < 0) {
+        std::cerr << "At least one iteration is needed and warmup cannot be negative" << std::endl;
+        return false;
+    }
+    if (options.batchSize < 1) {
+        std::cerr << "A batch needs at least one image" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static std::unique_ptr<ImageProcessorInterface> createBackend(const std::string& name, const BenchmarkOptions& options) {
+    if (name == "cpu") {
+        auto cpu = std::make_unique<CpuImageProcessing>();
+        cpu->setSpecializedBlur(options.specializedKernels);
+        if (options.fixedPointHsv)
+            cpu->setHsvMode(CpuImageProcessing::HsvMode::FixedPoint);
+        return cpu;
+    }
+    if (name == "opencl") {
+        auto opencl = options.device.empty() ? std::make_unique<OpenCLImageProcessing>()
+            : std::make_unique<OpenCLImageProcessing>(OpenCLImageProcessing::DeviceSelection::parse(options.device));
+        opencl->setSpecializedKernels(options.specializedKernels);
+        if (options.fixedPointHsv)
+            opencl->setHsvMode(OpenCLImageProcessing::HsvMode::FixedPoint);
+        return opencl;
+    }
+    if (name == "opencv")
+        return std::make_unique<OpenCVImageProcessing>();
+    return nullptr;
+}
+
+// Min, median, p95, max, mean and standard deviation of the measured runs
+static void computeStatistics(std::vector<double> times, BenchmarkResult& result) {
+    std::sort(times.begin(), times.end());
+    auto percentile = [&times](double p) {
+        // Nearest rank
+        size_t rank = static_cast<size_t>(std::ceil(p * times.size()));
+        return times[std::max<size_t>(rank, 1) - 1];
+    };
+
+    double sum = 0.0;
+    for (double time : times)
+        sum += time;
+    double mean = sum / times.size();
+
+    double squares = 0.0;
+    for (double time : times)
+        squares += (time - mean) * (time - mean);
+
+    result.iterations = static_cast<int>(times.size());
+    result.min = times.front();
+    result.median = percentile(0.5);
+    result.p95 = percentile(0.95);
+    result.max = times.back();
+    result.mean = mean;
+    result.stddev = times.size() > 1 ? std::sqrt(squares / (times.size() - 1)) : 0.0;
+    result.megapixelsPerSecond = static_cast<double>(result.width) * result.height / 1e6 / result.median;
+}
+
+std::vector<BenchmarkResult> runBenchmark(const BenchmarkOptions& options) {
+    // Decode or generate every input once, outside of any measurement
+    std::vector<std::pair<std::string, cv::Mat>> inputs;
+    for (const std::string& file : options.images) {
+        cv::Mat image = cv::imread(file, cv::IMREAD_UNCHANGED);
+        if (image.empty()) {
+            std::cerr << "Could not read " << file << ", skipping it" << std::endl;
+            continue;
+        }
+        inputs.emplace_back(file, image);
+    }
+
+    std::mt19937 generator(42);
+    std::uniform_int_distribution<int> distribution(0, 255);
+    for (const cv::Size& size : options.sizes) {
+        cv::Mat image(size.height, size.width, CV_8UC3);
+        for (int i = 0; i < image.rows; i++) {
+            uchar* row = image.ptr<uchar>(i);
+            for (int j = 0; j < image.cols * 3; j++)
+                row[j] = static_cast<uchar>(distribution(generator));
+        }
+        inputs.emplace_back("synthetic " + std::to_string(size.width) + "x" + std::to_string(size.height), image);
+    }
+
+    std::vector<BenchmarkStartup> startups;
+    std::vector<BenchmarkResult> results;
+
+    if (options.clearKernelCache)
+        OpenCLProgramCache().clear();
+
+    for (const std::string& backendName : options.backends) {
+        // Startup is measured with the instance that is benchmarked and a second one
+        auto startFirst = std::chrono::steady_clock::now();
+        std::unique_ptr<ImageProcessorInterface> backend = createBackend(backendName, options);
+        auto endFirst = std::chrono::steady_clock::now();
+        if (!backend) {
+            std::cerr << "Unknown backend " << backendName << ", skipping it" << std::endl;
+            continue;
+        }
+
+        auto startSecond = std::chrono::steady_clock::now();
+        std::unique_ptr<ImageProcessorInterface> second = createBackend(backendName, options);
+        auto endSecond = std::chrono::steady_clock::now();
+
+        BenchmarkStartup startup;
+        startup.backend = backendName;
+        startup.firstSeconds = std::chrono::duration<double>(endFirst - startFirst).count();
+        startup.secondSeconds = std::chrono::duration<double>(endSecond - startSecond).count();
+        auto* firstOpenCL = dynamic_cast<OpenCLImageProcessing*>(backend.get());
+        auto* secondOpenCL = dynamic_cast<OpenCLImageProcessing*>(second.get());
+        startup.firstFromCache = firstOpenCL != nullptr && firstOpenCL->isProgramFromCache();
+        startup.secondFromCache = secondOpenCL != nullptr && secondOpenCL->isProgramFromCache();
+        startups.push_back(startup);
+        second.reset();
+
+        std::cout << backendName << " startup: first " << startup.firstSeconds << " s";
+        if (firstOpenCL != nullptr)
+            std::cout << (startup.firstFromCache ? " (cached binary)" : " (built from source)");
+        std::cout << ", second " << startup.secondSeconds << " s";
+        if (secondOpenCL != nullptr)
+            std::cout << (startup.secondFromCache ? " (cached binary)" : " (built from source)");
+        std::cout << std::endl;
+
+        for (const auto& input : inputs) {
+            const cv::Mat& image = input.second;
+            cv::Mat output(image.size(), image.type());
+
+            for (const std::string& operation : options.operations) {
+                // HSV has no radius, it is measured once. The Gaussian takes the radii as sigma
+                const bool blur = operation == "blur" || operation == "blur-batch" || operation == "gaussian"
+                    || operation == "hsv-blur";
+                const bool batch = operation == "hsv-batch" || operation == "blur-batch";
+                std::vector<int> radii = blur ? options.radii : std::vector<int>{ 0 };
+                if (operation != "hsv" && !blur && !batch) {
+                    std::cerr << "Unknown operation " << operation << ", skipping it" << std::endl;
+                    continue;
+                }
+                if (batch && firstOpenCL == nullptr) {
+                    std::cerr << operation << " is only available with OpenCL, skipping it for " << backendName << std::endl;
+                    continue;
+                }
+
+                // A batch holds copies of the input. Its time is divided by the batch size, so
+                // the results stay per image like those of the single-image operations
+                std::vector<cv::Mat> batchInputs;
+                std::vector<cv::Mat> batchOutputs;
+                if (batch) {
+                    for (int i = 0; i < options.batchSize; i++)
+                        batchInputs.push_back(image.clone());
+                }
+                const double perRun = batch ? options.batchSize : 1;
+
+                for (int radius : radii) {
+                    ImagePipeline hsvBlur;
+                    hsvBlur.rgbToHsv().boxBlur(radius);
+
+                    auto run = [&]() {
+                        if (operation == "hsv")
+                            backend->rgbToHsv(image, output);
+                        else if (operation == "blur")
+                            backend->boxBlur(image, output, radius);
+                        else if (operation == "gaussian")
+                            backend->gaussianBlur(image, output, radius);
+                        else if (operation == "hsv-blur")
+                            backend->runPipeline(hsvBlur, image, output);
+                        else if (operation == "hsv-batch")
+                            firstOpenCL->rgbToHsvBatch(batchInputs, batchOutputs);
+                        else
+                            firstOpenCL->boxBlurBatch(batchInputs, batchOutputs, radius);
+                    };
+
+                    for (int i = 0; i < options.warmup; i++)
+                        run();
+
+                    std::vector<double> times;
+                    for (int i = 0; i < options.iterations; i++) {
+                        auto start = std::chrono::steady_clock::now();
+                        run();
+                        auto end = std::chrono::steady_clock::now();
+                        times.push_back(std::chrono::duration<double>(end - start).count() / perRun);
+                    }
+
+                    BenchmarkResult result;
+                    result.backend = backendName;
+                    result.operation = operation;
+                    result.input = input.first;
+                    result.width = image.cols;
+                    result.height = image.rows;
+                    result.radius = radius;
+                    computeStatistics(times, result);
+                    results.push_back(result);
+
+                    std::cout << backendName << " " << operation << " " << input.first;
+                    if (blur)
+                        std::cout << " r=" << radius;
+                    if (operation == "hsv-blur")
+                        std::cout << " " << hsvBlur.describe();
+                    if (batch)
+                        std::cout << " x" << options.batchSize;
+                    std::cout << ": median " << result.median << " s, p95 " << result.p95 << " s, "
+                        << result.megapixelsPerSecond << " MP/s" << std::endl;
+                }
+            }
+        }
+    }
+
+    if (!options.jsonFile.empty())
+        writeBenchmarkJson(options.jsonFile, options, startups, results);
+    if (!options.csvFile.empty())
+        writeBenchmarkCsv(options.csvFile, results);
+    return results;
+}
+
+// Backslashes of Windows paths and quotes have to be escaped in JSON strings
+static std::string jsonString(const std::string& text) {
+    std::string escaped = "\"";
+    for (char c : text) {
+        if (c == '\\' || c == '"')
+            escaped += '\\';
+        escaped += c;
+    }
+    return escaped + "\"";
+}
+
+void writeBenchmarkJson(const std::string& fileName, const BenchmarkOptions& options, 
+    const std::vector<BenchmarkStartup>& startups, const std::vector<BenchmarkResult>& results) {
+    std::ofstream file(fileName);
+    file.precision(9);
+
+    file << "{\n";
+    file << "  \"warmup\": " << options.warmup << ",\n";
+    file << "  \"iterations\": " << options.iterations << ",\n";
+    file << "  \"batchSize\": " << options.batchSize << ",\n";
+    file << "  \"specializedKernels\": " << (options.specializedKernels ? "true" : "false") << ",\n";
+    file << "  \"fixedPointHsv\": " << (options.fixedPointHsv ? "true" : "false") << ",\n";
+    file << "  \"startup\": [\n";
+    for (size_t i = 0; i < startups.size(); i++) {
+        const BenchmarkStartup& startup = startups[i];
+        file << "    {\"backend\": " << jsonString(startup.backend)
+            << ", \"first_seconds\": " << startup.firstSeconds
+            << ", \"first_from_cache\": " << (startup.firstFromCache ? "true" : "false")
+            << ", \"second_seconds\": " << startup.secondSeconds
+            << ", \"second_from_cache\": " << (startup.secondFromCache ? "true" : "false") << "}"
+            << (i + 1 < startups.size() ? ",\n" : "\n");
+    }
+    file << "  ],\n";
+    file << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchmarkResult& result = results[i];
+        file << "    {\"backend\": " << jsonString(result.backend)
+            << ", \"operation\": " << jsonString(result.operation)
+            << ", \"input\": " << jsonString(result.input)
+            << ", \"width\": " << result.width
+            << ", \"height\": " << result.height
+            << ", \"radius\": " << result.radius
+            << ", \"iterations\": " << result.iterations
+            << ", \"min\": " << result.min
+            << ", \"median\": " << result.median
+            << ", \"p95\": " << result.p95
+            << ", \"max\": " << result.max
+            << ", \"mean\": " << result.mean
+            << ", \"stddev\": " << result.stddev
+            << ", \"megapixels_per_second\": " << result.megapixelsPerSecond << "}"
+            << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    file << "  ]\n";
+    file << "}\n";
+}
+
+void writeBenchmarkCsv(const std::string& fileName, const std::vector<BenchmarkResult>& results) {
+    std::ofstream file(fileName);
+    file.precision(9);
+
+    file << "backend,operation,input,width,height,radius,iterations,min,median,p95,max,mean,stddev,megapixels_per_second\n";
+    for (const BenchmarkResult& result : results) {
+        file << result.backend << "," << result.operation << ",\"" << result.input << "\","
+            << result.width << "," << result.height << "," << result.radius << "," << result.iterations << ","
+            << result.min << "," << result.median << "," << result.p95 << "," << result.max << ","
+            << result.mean << "," << result.stddev << "," << result.megapixelsPerSecond << "\n";
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// Settings of a non-interactive benchmark run, filled from the command line
+struct BenchmarkOptions {
+    std::vector<std::string> backends{ "cpu", "opencl", "opencv" };
+    std::vector<std::string> operations{ "hsv", "blur" };
+    std::vector<int> radii{ 10 };
+
+    // Image files are decoded once before measuring. Synthetic sizes are filled with
+    // reproducible noise. Without either the default pictures are used
+    std::vector<std::string> images;
+    std::vector<cv::Size> sizes;
+
+    // OpenCL device as understood by OpenCLImageProcessing::DeviceSelection::parse, empty
+    // leaves the choice to the environment
+    std::string device;
+
+    // Images per launch of hsv-batch and blur-batch, which only OpenCL offers
+    int batchSize = 32;
+
+    int warmup = 3;
+    int iterations = 20;
+
+    // Removes the cached OpenCL program binaries first, so the first startup is a cold build
+    bool clearKernelCache = false;
+
+    // Blur instantiations per radius and channel count on CPU and OpenCL, off measures the
+    // generic code
+    bool specializedKernels = true;
+
+    // Integer HSV conversion with reciprocal tables on CPU and OpenCL instead of the float one
+    bool fixedPointHsv = false;
+
+    // Result files, an empty name skips that file
+    std::string jsonFile = "benchmark.json";
+    std::string csvFile = "benchmark.csv";
+};
+
+// One backend, operation, input and radius. Times are in seconds
+struct BenchmarkResult {
+    std::string backend;
+    std::string operation;
+    std::string input;
+    int width;
+    int height;
+    int radius;
+    int iterations;
+    double min;
+    double median;
+    double p95;
+    double max;
+    double mean;
+    double stddev;
+    double megapixelsPerSecond;
+};
+
+// Construction time of a backend: the first instance of a run and a second one right after,
+// which finds everything the first one cached. Only OpenCL reports where its program came from
+struct BenchmarkStartup {
+    std::string backend;
+    double firstSeconds;
+    bool firstFromCache;
+    double secondSeconds;
+    bool secondFromCache;
+};
+
+// Parses the flags after --benchmark. Prints the usage and returns false on invalid input
+bool parseBenchmarkOptions(int argc, char** argv, BenchmarkOptions& options);
+void printBenchmarkUsage();
+
+// Measures every combination of the options, writes the JSON and CSV reports and returns
+// the results. Inputs are decoded and outputs allocated before measuring, so only the
+// operation itself is timed
+std::vector<BenchmarkResult> runBenchmark(const BenchmarkOptions& options);
+
+void writeBenchmarkJson(const std::string& fileName, const BenchmarkOptions& options, 
+    const std::vector<BenchmarkStartup>& startups, const std::vector<BenchmarkResult>& results);
+void writeBenchmarkCsv(const std::string& fileName, const std::vector<BenchmarkResult>& results);
+
+#endif // BENCHMARK_H
@@ -0,0 +1,116 @@
+#include "BoxBlurSpecialized.h"
+#include <utility>
+#include <vector>
+
+// Horizontal window sums of one row, clamped to the first and last pixel like the generic code.
+// The channels of a pixel are summed side by side, and only the pixels near the borders need
+// the clamped indices
+template<int Radius, int Channels>
+static void horizontalRowSum(const uchar* row, int width, int* rowSum) {
+    int sum[Channels];
+    const int inside = std::min(Radius, width - 1);
+
+    for (int channels = 0; channels < Channels; ++channels) {
+        int first = row[channels];
+        int last = row[(width - 1) * Channels + channels];
+        int windowSum = (Radius + 1) * first;
+        for (int i = 1; i <= inside; ++i) {
+            windowSum += row[i * Channels + channels];
+        }
+        sum[channels] = windowSum + (Radius - inside) * last;
+    }
+
+    auto slide = [&](int posx, int enter, int leave) {
+        for (int channels = 0; channels < Channels; ++channels) {
+            rowSum[posx * Channels + channels] = sum[channels];
+            sum[channels] += row[enter * Channels + channels] - row[leave * Channels + channels];
+        }
+    };
+
+    // Between interiorBegin and interiorEnd the entering and leaving pixels are inside the row
+    const int interiorBegin = std::min(Radius, width);
+    const int interiorEnd = std::max(width - Radius - 1, interiorBegin);
+
+    int posx = 0;
+    for (; posx < interiorBegin; ++posx) {
+        slide(posx, std::min(posx + Radius + 1, width - 1), std::max(posx - Radius, 0));
+    }
+    for (; posx < interiorEnd; ++posx) {
+        slide(posx, posx + Radius + 1, posx - Radius);
+    }
+    for (; posx < width; ++posx) {
+        slide(posx, std::min(posx + Radius + 1, width - 1), std::max(posx - Radius, 0));
+    }
+}
+
+template<int Radius, int Channels>
+static void boxBlurSlidingWindow(const cv::Mat& inputImage, cv::Mat& outputImage, int rowBegin, int rowEnd) {
+    constexpr int divider = (2 * Radius + 1) * (2 * Radius + 1);
+    const int width = inputImage.cols;
+    const int height = inputImage.rows;
+    const int rowLength = width * Channels;
+
+    // 255 * (2r+1)^2 fits into 32 bits for every radius of the table
+    std::vector<int> rowSum(rowLength);
+    std::vector<int> columnSum(rowLength, 0);
+
+    auto addRow = [&](int y, int weight) {
+        horizontalRowSum<Radius, Channels>(inputImage.ptr<uchar>(y), width, rowSum.data());
+        for (int k = 0; k < rowLength; ++k) {
+            columnSum[k] += weight * rowSum[k];
+        }
+    };
+
+    // Initial window around the first row of the band, rows outside the image repeat the border row
+    int windowBegin = rowBegin - Radius;
+    int windowEnd = rowBegin + Radius;
+    if (windowBegin < 0) {
+        addRow(0, -windowBegin);
+    }
+    if (windowEnd > height - 1) {
+        addRow(height - 1, windowEnd - (height - 1));
+    }
+    for (int j = std::max(windowBegin, 0); j <= std::min(windowEnd, height - 1); ++j) {
+        addRow(j, 1);
+    }
+
+    for (int posy = rowBegin; posy < rowEnd; ++posy) {
+        uchar* outputRow = outputImage.ptr<uchar>(posy);
+        for (int k = 0; k < rowLength; ++k) {
+            outputRow[k] = static_cast<uchar>(columnSum[k] / divider);
+        }
+
+        if (posy == rowEnd - 1)
+            break;
+
+        int enter = std::min(posy + Radius + 1, height - 1);
+        int leave = std::max(posy - Radius, 0);
+        if (enter != leave) {
+            addRow(enter, 1);
+            addRow(leave, -1);
+        }
+    }
+}
+
+// Dispatch table: one instantiation per common radius and channel count
+template<int Channels, int... Radii>
+static SpecializedBoxBlur findRadius(int radius, std::integer_sequence<int, Radii...>) {
+    SpecializedBoxBlur found = nullptr;
+    ((radius == Radii ? (found = &boxBlurSlidingWindow<Radii, Channels>, true) : false) || ...);
+    return found;
+}
+
+SpecializedBoxBlur findSpecializedBoxBlur(int radius, int channels) {
+    using CommonRadii = std::integer_sequence<int, 1, 2, 3, 4, 5, 7, 10, 15>;
+
+    switch (channels) {
+        case 1:
+            return findRadius<1>(radius, CommonRadii());
+        case 3:
+            return findRadius<3>(radius, CommonRadii());
+        case 4:
+            return findRadius<4>(radius, CommonRadii());
+        default:
+            return nullptr;
+    }
+}
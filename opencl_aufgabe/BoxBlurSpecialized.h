@@ -0,0 +1,16 @@
+#ifndef BOX_BLUR_SPECIALIZED_H
+#define BOX_BLUR_SPECIALIZED_H
+
+#include <opencv2/opencv.hpp>
+
+// Sliding-window box blur of the rows [rowBegin, rowEnd) with the radius and channel count
+// fixed at compile time. The window sums fit into 32 bits and the division by the window
+// area is a division by a constant, so the compiler turns it into a multiplication and
+// vectorizes the row loops. Results are identical to CpuImageProcessing::boxBlurSlidingWindow
+using SpecializedBoxBlur = void (*)(const cv::Mat& input, cv::Mat& output, int rowBegin, int rowEnd);
+
+// Instantiation for the radius and channel count, nullptr if the combination is not one of
+// the common ones in the dispatch table and the generic code has to be used
+SpecializedBoxBlur findSpecializedBoxBlur(int radius, int channels);
+
+#endif // BOX_BLUR_SPECIALIZED_H
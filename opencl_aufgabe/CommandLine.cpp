@@ -0,0 +1,13 @@
+#include "CommandLine.h"
+#include <sstream>
+
+std::vector<std::string> splitList(const std::string& list) {
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty())
+            items.push_back(item);
+    }
+    return items;
+}
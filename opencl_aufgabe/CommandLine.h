@@ -0,0 +1,11 @@
+#ifndef COMMAND_LINE_H
+#define COMMAND_LINE_H
+
+#include <string>
+#include <vector>
+
+// Splits "a,b,c" into its items, empty items are dropped. Used by the option parsers of the
+// headless modes
+std::vector<std::string> splitList(const std::string& list);
+
+#endif // COMMAND_LINE_H
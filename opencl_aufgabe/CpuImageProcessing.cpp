@@ -1,10 +1,75 @@
 #include "CpuImageProcessing.h"
 #include "OpenCVImageProcessing.h"
-
-CpuImageProcessing::CpuImageProcessing() {}
+#include "HostImagePool.h"
+#include "Trace.h"
+#include <cstring>
+#include <thread>
+
+CpuImageProcessing::CpuImageProcessing(unsigned int numThreads) 
+    : blurMode(BlurMode::SlidingWindow), specializedBlur(true), simdLevel(detectSimdLevel()), hsvMode(HsvMode::Float), gaussianPasses(GAUSSIAN_MIN_PASSES), 
+    integralWidth(0), integralHeight(0), integralDepth(0), integralType(0) {
+    setThreadCount(numThreads);
+}
 
 CpuImageProcessing::~CpuImageProcessing() {}
 
+void CpuImageProcessing::setThreadCount(unsigned int numThreads) {
+    // 0 selects one thread per hardware core
+    if (numThreads == 0)
+        numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+
+    if (threadPool && threadPool->size() == numThreads)
+        return;
+
+    threadPool.reset(new ThreadPool(numThreads));
+}
+
+unsigned int CpuImageProcessing::getThreadCount() const {
+    return threadPool->size();
+}
+
+void CpuImageProcessing::setSimdLevel(SimdLevel level) {
+    simdLevel = std::min(level, detectSimdLevel());
+}
+
+SimdLevel CpuImageProcessing::getSimdLevel() const {
+    return simdLevel;
+}
+
+void CpuImageProcessing::setHsvMode(HsvMode mode) {
+    hsvMode = mode;
+}
+
+CpuImageProcessing::HsvMode CpuImageProcessing::getHsvMode() const {
+    return hsvMode;
+}
+
+void CpuImageProcessing::forEachRowBand(int rows, int halo, const std::function<void(int, int)>& body) {
+    // Several bands per thread so that the work-stealing can balance uneven bands. Bands
+    // are kept well above the halo height because every band re-reads its halo rows
+    const int bandsPerThread = 4;
+    int bandHeight = (rows + threadPool->size() * bandsPerThread - 1) / (threadPool->size() * bandsPerThread);
+    bandHeight = std::max(bandHeight, std::max(16, 2 * halo));
+
+    threadPool->parallelFor(0, rows, bandHeight, body);
+}
+
+void CpuImageProcessing::setBlurMode(BlurMode mode) {
+    blurMode = mode;
+}
+
+CpuImageProcessing::BlurMode CpuImageProcessing::getBlurMode() const {
+    return blurMode;
+}
+
+void CpuImageProcessing::setSpecializedBlur(bool enabled) {
+    specializedBlur = enabled;
+}
+
+bool CpuImageProcessing::getSpecializedBlur() const {
+    return specializedBlur;
+}
+
 CpuImageProcessing::HSV CpuImageProcessing::rgbToHsvCPU(float r, float g, float b) {
     // Normalized to the range [0, 1]
     float red = r / 255.0f;
@@ -42,61 +107,237 @@ CpuImageProcessing::HSV CpuImageProcessing::rgbToHsvCPU(float r, float g, float
 }
 
 void CpuImageProcessing::rgbToHsv(const cv::Mat& input, cv::Mat& output) {
-    std::vector<std::vector<RGB>> rgbImage(input.rows, std::vector<RGB>(input.cols));
-    std::vector<std::vector<HSV>> hsvImage;
-
-    // Convert OpenCV Mat to RGB vector of vectors
-    for (int i = 0; i < input.rows; ++i) {
-        for (int j = 0; j < input.cols; ++j) {
-            cv::Vec3b pixel = input.at<cv::Vec3b>(i, j);
-            rgbImage[i][j] = 
-            { static_cast<float>(pixel[0]), 
-                static_cast<float>(pixel[1]), 
-                static_cast<float>(pixel[2]) 
-            };
-        }
+    // Make sure that RGB image is not empty
+    assert(!input.empty());
+
+    output.create(input.size(), input.type());
+
+    // Every band of rows is converted independently
+    forEachRowBand(input.rows, 0, [&](int rowBegin, int rowEnd) {
+        rgbToHsvRows(input, output, rowBegin, rowEnd);
+    });
+}
+
+void CpuImageProcessing::rgbToHsvRows(const cv::Mat& input, cv::Mat& output, int rowBegin, int rowEnd) {
+    for (int i = rowBegin; i < rowEnd; ++i) {
+        rgbToHsvRow(input.ptr<uchar>(i), output.ptr<uchar>(i), input.cols, input.channels());
     }
+}
 
-    // Make sure that RGB image is not empty
-    assert(!rgbImage.empty());
+void CpuImageProcessing::rgbToHsvRow(const uchar* inputRow, uchar* outputRow, int width, int depth) {
+    // The integer conversion has no divisions left, the scalar loop handles every row
+    if (hsvMode == HsvMode::FixedPoint) {
+        rgbToHsvRowFixedPoint(inputRow, outputRow, width, depth);
+        return;
+    }
 
-    // Set the size of HSV image to have the same size as the RGB image
-    hsvImage.resize(rgbImage.size(), std::vector<HSV>(rgbImage[0].size()));
-    
-    // Conversion to HSV on each pixel
-    for (size_t i = 0; i < rgbImage.size(); ++i) {
-        for (size_t j = 0; j < rgbImage[i].size(); ++j) {
-            hsvImage[i][j] = rgbToHsvCPU(
-                rgbImage[i][j].r, 
-                rgbImage[i][j].g, 
-                rgbImage[i][j].b
-            );
-        }
-    }
-
-    // Mapping HSV to Output Matrix
-    for (size_t i = 0; i < hsvImage.size(); ++i) {
-        for (size_t j = 0; j < hsvImage[i].size(); ++j) {
-            HSV hsvPixel = hsvImage[i][j];
-            cv::Vec3b& hsvMatPixel = output.at<cv::Vec3b>(i, j);
-            
-            // Converting HSV to OpenCV Format
-            hsvMatPixel = { 
-                static_cast<uchar>(hsvPixel.h / 2.0f), 
-                static_cast<uchar>(hsvPixel.s * 255.0f), 
-                static_cast<uchar>(hsvPixel.v * 255.0f) 
-            };
+    // Single pass from the interleaved input bytes to the HSV bytes. The vector code
+    // handles 3-channel rows up to the last partial vector, the scalar loop the rest
+    int j = 0;
+    if (depth == 3) {
+        switch (simdLevel) {
+            case SimdLevel::AVX2:
+                j = rgbToHsvRowAVX2(inputRow, outputRow, width);
+                break;
+            case SimdLevel::SSE41:
+                j = rgbToHsvRowSSE41(inputRow, outputRow, width);
+                break;
+            default:
+                break;
+        }
+    }
+
+    // Conversion to HSV on each remaining pixel
+    for (; j < width; ++j) {
+        const uchar* pixel = inputRow + j * depth;
+        HSV hsvPixel = rgbToHsvCPU(
+            static_cast<float>(pixel[0]),
+            static_cast<float>(pixel[1]),
+            static_cast<float>(pixel[2])
+        );
+
+        // Converting HSV to OpenCV Format, further channels (alpha) are passed through
+        uchar* hsvMatPixel = outputRow + j * depth;
+        hsvMatPixel[0] = static_cast<uchar>(hsvPixel.h / 2.0f);
+        hsvMatPixel[1] = static_cast<uchar>(hsvPixel.s * 255.0f);
+        hsvMatPixel[2] = static_cast<uchar>(hsvPixel.v * 255.0f);
+        for (int channels = 3; channels < depth; ++channels) {
+            hsvMatPixel[channels] = pixel[channels];
         }
     }
 }
 
 void CpuImageProcessing::boxBlur(const cv::Mat& inputImage, cv::Mat& outputImage, int kernelSize) {
+    outputImage.create(inputImage.size(), inputImage.type());
+
+    // Common radii and channel counts have an instantiation with both fixed at compile time
+    SpecializedBoxBlur specialized = nullptr;
+    if (specializedBlur && blurMode == BlurMode::SlidingWindow)
+        specialized = findSpecializedBoxBlur(kernelSize, inputImage.channels());
+
+    // Every band reads kernelSize halo rows above and below itself straight from the
+    // shared input, so the bands can be blurred independently
+    forEachRowBand(inputImage.rows, kernelSize, [&](int rowBegin, int rowEnd) {
+        switch (blurMode) {
+            case BlurMode::Naive:
+                boxBlurNaive(inputImage, outputImage, kernelSize, rowBegin, rowEnd);
+                break;
+            case BlurMode::SlidingWindow:
+                if (specialized)
+                    specialized(inputImage, outputImage, rowBegin, rowEnd);
+                else
+                    boxBlurSlidingWindow(inputImage, outputImage, kernelSize, rowBegin, rowEnd);
+                break;
+        }
+    });
+}
+
+void CpuImageProcessing::setGaussianPasses(int passes) {
+    gaussianPasses = std::max(GAUSSIAN_MIN_PASSES, std::min(passes, GAUSSIAN_MAX_PASSES));
+}
+
+int CpuImageProcessing::getGaussianPasses() const {
+    return gaussianPasses;
+}
+
+void CpuImageProcessing::gaussianBlur(const cv::Mat& inputImage, cv::Mat& output, double sigma) {
+    std::vector<int> radii = gaussianBoxRadii(sigma, gaussianPasses);
+
+    // The passes cannot read and write the same memory, blurring in place needs a copy
+    const cv::Mat input = inputImage.data == output.data ? inputImage.clone() : inputImage;
+
+    output.create(input.size(), input.type());
+    if (radii.empty()) {
+        // Too small a sigma for the box passes, the sampled kernel is short there
+        const std::vector<float> weights = gaussianKernelWeights(sigma);
+        forEachRowBand(input.rows, static_cast<int>(weights.size()) / 2, [&](int rowBegin, int rowEnd) {
+            gaussianKernelRows(input, output, weights, rowBegin, rowEnd);
+        });
+        return;
+    }
+
+    // The passes alternate between the two images, the first one is chosen so that the last
+    // pass writes into the output. Both keep their memory, so repeated calls do not allocate
+    gaussianScratch.create(input.size(), input.type());
+    cv::Mat* targets[2] = { &output, &gaussianScratch };
+    const cv::Mat* source = &input;
+    const int passes = static_cast<int>(radii.size());
+
+    for (int i = 0; i < passes; ++i) {
+        cv::Mat* target = targets[(passes - 1 - i) % 2];
+        boxBlur(*source, *target, radii[i]);
+        source = target;
+    }
+}
+
+void CpuImageProcessing::applyPointOperations(const PointOperations& operations, const uchar* input, uchar* output,
+    int width, int depth, uchar* scratch) {
+    // The first operation reads the input, every further one the result of the one before
+    for (size_t i = 0; i < operations.size(); ++i) {
+        const uchar* source = input;
+        if (i > 0) {
+            std::memcpy(scratch, output, static_cast<size_t>(width) * depth);
+            source = scratch;
+        }
+
+        switch (operations[i].type) {
+            case ImagePipeline::OpType::RgbToHsv:
+                rgbToHsvRow(source, output, width, depth);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+void CpuImageProcessing::runPipeline(const ImagePipeline& pipeline, const cv::Mat& inputImage, cv::Mat& output) {
+    // A pass is one sweep over the image: an optional box blur with the point operations
+    // fused into the rows it reads and writes. A Gaussian stage becomes several passes, the
+    // first one reads through the point operations before it and the last one writes
+    // through those after it
+    struct Pass {
+        PointOperations before;
+        int kernelSize;
+        PointOperations after;
+    };
+
+    std::vector<Pass> passes;
+    for (const ImagePipeline::Stage& stage : pipeline.stages()) {
+        std::vector<int> radii;
+        if (stage.hasStencil && stage.stencil.type == ImagePipeline::OpType::BoxBlur)
+            radii.push_back(stage.stencil.kernelSize);
+        else if (stage.hasStencil)
+            radii = gaussianBoxRadii(stage.stencil.sigma, gaussianPasses);
+
+        // The sampled kernel of a small sigma is no box pass, such pipelines run one operation
+        // at a time
+        if (stage.hasStencil && radii.empty()) {
+            pipeline.runUnfused(*this, inputImage, output);
+            return;
+        }
+
+        if (radii.empty()) {
+            // Only point operations, -1 marks the pass without blur
+            Pass pass{ stage.before, -1, {} };
+            pass.before.insert(pass.before.end(), stage.after.begin(), stage.after.end());
+            passes.push_back(pass);
+            continue;
+        }
+        for (size_t i = 0; i < radii.size(); ++i) {
+            passes.push_back({ i == 0 ? stage.before : PointOperations(), radii[i],
+                i + 1 == radii.size() ? stage.after : PointOperations() });
+        }
+    }
+
+    const cv::Mat input = inputImage.data == output.data ? inputImage.clone() : inputImage;
+    output.create(input.size(), input.type());
+    if (passes.empty()) {
+        input.copyTo(output);
+        return;
+    }
+
+    // The passes alternate between the output and a scratch image kept between calls, the
+    // first one chosen so that the last pass writes into the output
+    pipelineScratch.create(input.size(), input.type());
+    cv::Mat* targets[2] = { &output, &pipelineScratch };
+    const cv::Mat* source = &input;
+    const int count = static_cast<int>(passes.size());
+
+    for (int i = 0; i < count; ++i) {
+        const Pass& pass = passes[i];
+        cv::Mat* target = targets[(count - 1 - i) % 2];
+
+        if (pass.kernelSize < 0) {
+            // Point operations only, through one line buffer per band
+            forEachRowBand(input.rows, 0, [&](int rowBegin, int rowEnd) {
+                std::vector<uchar> lineScratch(static_cast<size_t>(input.cols) * input.channels());
+                for (int y = rowBegin; y < rowEnd; ++y) {
+                    applyPointOperations(pass.before, source->ptr<uchar>(y), target->ptr<uchar>(y), 
+                        input.cols, input.channels(), lineScratch.data());
+                }
+            });
+        }
+        else if (pass.before.empty() && pass.after.empty()) {
+            // Nothing to fuse, the plain blur can use its specialized instantiations
+            boxBlur(*source, *target, pass.kernelSize);
+        }
+        else {
+            forEachRowBand(input.rows, pass.kernelSize, [&](int rowBegin, int rowEnd) {
+                boxBlurSlidingWindow(*source, *target, pass.kernelSize, rowBegin, rowEnd, pass.before, pass.after);
+            });
+        }
+        source = target;
+    }
+}
+
+void CpuImageProcessing::boxBlurNaive(const cv::Mat& inputImage, cv::Mat& outputImage, int kernelSize, 
+    int rowBegin, int rowEnd) {
     const int depth = inputImage.channels();
     int divider = ((2 * kernelSize + 1) * (2 * kernelSize + 1));
 
     for (int channels = 0; channels < depth; ++channels) { // Iterate over channels
         for (int posx = 0; posx < inputImage.cols; ++posx) {
-            for (int posy = 0; posy < inputImage.rows; ++posy) {
+            for (int posy = rowBegin; posy < rowEnd; ++posy) {
                 float sum = 0.0f;
 
                 for (int i = -kernelSize; i <= kernelSize; ++i) {
@@ -117,6 +358,225 @@ void CpuImageProcessing::boxBlur(const cv::Mat& inputImage, cv::Mat& outputImage
     }
 }
 
+void CpuImageProcessing::horizontalRowSum(const uchar* row, int width, int depth, int kernelSize, int* rowSum) {
+    for (int channels = 0; channels < depth; ++channels) {
+        // Initial window around x = 0. Indices left of the border are clamped to the
+        // first pixel and indices right of the border to the last pixel
+        int first = row[channels];
+        int last = row[(width - 1) * depth + channels];
+        int sum = (kernelSize + 1) * first;
+        int inside = std::min(kernelSize, width - 1);
+
+        for (int i = 1; i <= inside; ++i) {
+            sum += row[i * depth + channels];
+        }
+        sum += (kernelSize - inside) * last;
+
+        // Slide the window: add the pixel entering on the right, remove the one leaving on the left
+        for (int posx = 0; posx < width; ++posx) {
+            rowSum[posx * depth + channels] = sum;
+
+            int enter = std::min(posx + kernelSize + 1, width - 1);
+            int leave = std::max(posx - kernelSize, 0);
+            sum += row[enter * depth + channels] - row[leave * depth + channels];
+        }
+    }
+}
+
+void CpuImageProcessing::boxBlurSlidingWindow(const cv::Mat& inputImage, cv::Mat& outputImage, int kernelSize,
+    int rowBegin, int rowEnd, const PointOperations& before, const PointOperations& after) {
+    const int depth = inputImage.channels();
+    const int width = inputImage.cols;
+    const int height = inputImage.rows;
+    const int rowLength = width * depth;
+    const int64_t divider = static_cast<int64_t>(2 * kernelSize + 1) * (2 * kernelSize + 1);
+
+    // Horizontal sums of one row and the running vertical sum of the horizontal sums
+    std::vector<int> rowSum(rowLength);
+    std::vector<int64_t> columnSum(rowLength, 0);
+
+    // Fused point operations work on line buffers instead of whole images. Every input row
+    // enters and leaves the window once, a ring of 2 * kernelSize + 2 converted rows holds
+    // all rows of the window, so each row is converted only once
+    const int ringRows = before.empty() ? 0 : 2 * kernelSize + 2;
+    std::vector<uchar> ring(static_cast<size_t>(ringRows) * rowLength);
+    std::vector<int> ringRow(ringRows, -1);
+    std::vector<uchar> lineScratch(before.empty() && after.empty() ? 0 : rowLength);
+    std::vector<uchar> lineOut(after.empty() ? 0 : rowLength);
+
+    auto sourceRow = [&](int y) {
+        if (before.empty())
+            return inputImage.ptr<uchar>(y);
+
+        uchar* converted = &ring[static_cast<size_t>(y % ringRows) * rowLength];
+        if (ringRow[y % ringRows] != y) {
+            applyPointOperations(before, inputImage.ptr<uchar>(y), converted, width, depth, lineScratch.data());
+            ringRow[y % ringRows] = y;
+        }
+        return static_cast<const uchar*>(converted);
+    };
+
+    auto addRow = [&](int y, int64_t weight) {
+        horizontalRowSum(sourceRow(y), width, depth, kernelSize, rowSum.data());
+        for (int k = 0; k < rowLength; ++k) {
+            columnSum[k] += weight * rowSum[k];
+        }
+    };
+
+    // Initial window around the first row of the band with the same clamp-to-edge rule
+    // as in the horizontal pass: rows above the image repeat the first row, rows below the last
+    int windowBegin = rowBegin - kernelSize;
+    int windowEnd = rowBegin + kernelSize;
+    if (windowBegin < 0) {
+        addRow(0, -windowBegin);
+    }
+    if (windowEnd > height - 1) {
+        addRow(height - 1, windowEnd - (height - 1));
+    }
+    for (int j = std::max(windowBegin, 0); j <= std::min(windowEnd, height - 1); ++j) {
+        addRow(j, 1);
+    }
+
+    for (int posy = rowBegin; posy < rowEnd; ++posy) {
+        uchar* outputRow = after.empty() ? outputImage.ptr<uchar>(posy) : lineOut.data();
+        for (int k = 0; k < rowLength; ++k) {
+            outputRow[k] = static_cast<uchar>(columnSum[k] / divider);
+        }
+        if (!after.empty())
+            applyPointOperations(after, lineOut.data(), outputImage.ptr<uchar>(posy), width, depth, lineScratch.data());
+
+        if (posy == rowEnd - 1)
+            break;
+
+        // Slide the window down: add the row entering at the bottom, remove the one leaving at the top
+        int enter = std::min(posy + kernelSize + 1, height - 1);
+        int leave = std::max(posy - kernelSize, 0);
+        if (enter != leave) {
+            addRow(enter, 1);
+            addRow(leave, -1);
+        }
+    }
+}
+
+void CpuImageProcessing::buildIntegralImage(const cv::Mat& input) {
+    integralWidth = input.cols;
+    integralHeight = input.rows;
+    integralDepth = input.channels();
+    integralType = input.type();
+
+    const int stride = (integralWidth + 1) * integralDepth;
+    integralImage.assign(static_cast<size_t>(integralHeight + 1) * stride, 0);
+
+    // Each entry is the row prefix plus the entry above. The table is allowed to wrap
+    // around 2^32: four-lookup differences stay exact in unsigned arithmetic as long as
+    // the queried rectangle itself sums to less than 2^32 (about 16.8 million pixels)
+    for (int y = 0; y < integralHeight; ++y) {
+        const uchar* row = input.ptr<uchar>(y);
+        const uint32_t* above = &integralImage[static_cast<size_t>(y) * stride];
+        uint32_t* current = &integralImage[static_cast<size_t>(y + 1) * stride];
+
+        for (int channels = 0; channels < integralDepth; ++channels) {
+            uint32_t rowPrefix = 0;
+            for (int x = 0; x < integralWidth; ++x) {
+                rowPrefix += row[x * integralDepth + channels];
+                int index = (x + 1) * integralDepth + channels;
+                current[index] = above[index] + rowPrefix;
+            }
+        }
+    }
+}
+
+uint32_t CpuImageProcessing::integralSum(int x0, int y0, int x1, int y1, int channel) const {
+    // Sum over the inclusive rectangle [x0, x1] x [y0, y1]
+    const size_t stride = static_cast<size_t>(integralWidth + 1) * integralDepth;
+    const uint32_t* top = &integralImage[y0 * stride];
+    const uint32_t* bottom = &integralImage[(y1 + 1) * stride];
+    const int left = x0 * integralDepth + channel;
+    const int right = (x1 + 1) * integralDepth + channel;
+
+    return bottom[right] - top[right] - bottom[left] + top[left];
+}
+
+cv::Scalar CpuImageProcessing::rectangleSum(const cv::Rect& rect) const {
+    // Clip the rectangle to the image
+    int x0 = std::max(rect.x, 0);
+    int y0 = std::max(rect.y, 0);
+    int x1 = std::min(rect.x + rect.width, integralWidth) - 1;
+    int y1 = std::min(rect.y + rect.height, integralHeight) - 1;
+
+    cv::Scalar sum;
+    if (x0 > x1 || y0 > y1)
+        return sum;
+
+    for (int channels = 0; channels < std::min(integralDepth, 4); ++channels) {
+        sum[channels] = integralSum(x0, y0, x1, y1, channels);
+    }
+    return sum;
+}
+
+void CpuImageProcessing::boxBlurIntegral(cv::Mat& outputImage, int kernelSize) {
+    boxBlurIntegral(outputImage, kernelSize, kernelSize);
+}
+
+void CpuImageProcessing::boxBlurIntegral(cv::Mat& outputImage, int radiusX, int radiusY) {
+    assert(!integralImage.empty());
+
+    outputImage.create(integralHeight, integralWidth, integralType);
+
+    forEachRowBand(integralHeight, 0, [&](int rowBegin, int rowEnd) {
+        boxBlurIntegralRows(outputImage, radiusX, radiusY, rowBegin, rowEnd);
+    });
+}
+
+void CpuImageProcessing::boxBlurIntegralRows(cv::Mat& outputImage, int radiusX, int radiusY, int rowBegin, int rowEnd) {
+    const int width = integralWidth;
+    const int height = integralHeight;
+    const int depth = integralDepth;
+    const int64_t divider = static_cast<int64_t>(2 * radiusX + 1) * (2 * radiusY + 1);
+
+    // A clamped window splits into up to three segments per axis: the first pixel repeated,
+    // the part inside the image and the last pixel repeated. Interior pixels only have the
+    // middle segment, so they cost four lookups per channel
+    struct Segment {
+        int from, to, weight;
+    };
+
+    for (int posy = rowBegin; posy < rowEnd; ++posy) {
+        Segment rowsY[3] = {
+            { 0, 0, std::max(radiusY - posy, 0) },
+            { std::max(posy - radiusY, 0), std::min(posy + radiusY, height - 1), 1 },
+            { height - 1, height - 1, std::max(posy + radiusY - (height - 1), 0) }
+        };
+
+        uchar* outputRow = outputImage.ptr<uchar>(posy);
+
+        for (int posx = 0; posx < width; ++posx) {
+            Segment columnsX[3] = {
+                { 0, 0, std::max(radiusX - posx, 0) },
+                { std::max(posx - radiusX, 0), std::min(posx + radiusX, width - 1), 1 },
+                { width - 1, width - 1, std::max(posx + radiusX - (width - 1), 0) }
+            };
+
+            for (int channels = 0; channels < depth; ++channels) {
+                int64_t sum = 0;
+
+                for (const Segment& sy : rowsY) {
+                    if (sy.weight == 0)
+                        continue;
+                    for (const Segment& sx : columnsX) {
+                        if (sx.weight == 0)
+                            continue;
+                        sum += static_cast<int64_t>(sy.weight) * sx.weight
+                            * integralSum(sx.from, sy.from, sx.to, sy.to, channels);
+                    }
+                }
+
+                outputRow[posx * depth + channels] = static_cast<uchar>(sum / divider);
+            }
+        }
+    }
+}
+
 void CpuImageProcessing::runtime(std::vector<std::string>& files, std::string& path, int num_runs) {
     //Vector to store durations
     std::vector<std::chrono::duration<double>> durationsHSV;
@@ -125,8 +585,8 @@ void CpuImageProcessing::runtime(std::vector<std::string>& files, std::string& p
     for (int i = 0; i < files.size(); i++) {
         for (int n = 0; n < num_runs; ++n) {
             cv::Mat inputImage = cv::imread(path + files.at(i));
-            cv::Mat hsvImage = cv::Mat::zeros(inputImage.size(), inputImage.type());
-            cv::Mat blurredImage = cv::Mat::zeros(inputImage.size(), inputImage.type());
+            cv::Mat hsvImage = HostImagePool::instance().image(inputImage.size(), inputImage.type());
+            cv::Mat blurredImage = HostImagePool::instance().image(inputImage.size(), inputImage.type());
 
             // Record the starting time
             auto start = std::chrono::high_resolution_clock::now();
@@ -186,6 +646,74 @@ void CpuImageProcessing::runtime(std::vector<std::string>& files, std::string& p
         durationsBlur.clear();
         myfile.close();
     }
+
+    // Intermediates of later runs come from the blocks the first run released
+    HostImagePool::instance().printStatistics(std::cout);
+}
+
+void CpuImageProcessing::scalingEvaluation(std::vector<std::string>& files, std::string& path, int num_runs) {
+    const unsigned int previousThreadCount = getThreadCount();
+    const unsigned int maxThreads = std::max(std::thread::hardware_concurrency(), 1u);
+
+    // Thread counts to measure: powers of two up to the number of hardware threads
+    std::vector<unsigned int> threadCounts;
+    for (unsigned int t = 1; t < maxThreads; t *= 2) {
+        threadCounts.push_back(t);
+    }
+    threadCounts.push_back(maxThreads);
+
+    // Prepare to write the scaling into .txt file
+    std::ofstream myfile;
+    myfile.open("scalingEvaluation.txt", std::fstream::app);
+
+    for (int i = 0; i < files.size(); i++) {
+        cv::Mat inputImage = cv::imread(path + files.at(i));
+        cv::Mat hsvImage(inputImage.size(), inputImage.type());
+        cv::Mat blurredImage(inputImage.size(), inputImage.type());
+
+        double baselineHSV = 0.0;
+        double baselineBlur = 0.0;
+
+        for (unsigned int threads : threadCounts) {
+            setThreadCount(threads);
+
+            std::chrono::duration<double> totalHSV = std::chrono::duration<double>::zero();
+            std::chrono::duration<double> totalBlur = std::chrono::duration<double>::zero();
+
+            for (int n = 0; n < num_runs; ++n) {
+                auto start = std::chrono::high_resolution_clock::now();
+                rgbToHsv(inputImage, hsvImage);
+                auto end = std::chrono::high_resolution_clock::now();
+                totalHSV += end - start;
+
+                start = std::chrono::high_resolution_clock::now();
+                boxBlur(inputImage, blurredImage, 10);
+                end = std::chrono::high_resolution_clock::now();
+                totalBlur += end - start;
+            }
+
+            double averageHSV = totalHSV.count() / num_runs;
+            double averageBlur = totalBlur.count() / num_runs;
+
+            // The single-threaded run is the reference for the speedup
+            if (threads == 1) {
+                baselineHSV = averageHSV;
+                baselineBlur = averageBlur;
+            }
+
+            std::string notifyScaling = "CPU Scaling, Picture " + std::to_string(i + 1) 
+                + ", Threads " + std::to_string(threads) 
+                + ": HSV " + std::to_string(averageHSV) + " seconds (speedup " + std::to_string(baselineHSV / averageHSV) + ")"
+                + ", Blur " + std::to_string(averageBlur) + " seconds (speedup " + std::to_string(baselineBlur / averageBlur) + ")\n";
+
+            // Output the scaling
+            std::cout << notifyScaling;
+            myfile << notifyScaling;
+        }
+    }
+
+    myfile.close();
+    setThreadCount(previousThreadCount);
 }
 
 void CpuImageProcessing::execute(std::vector<std::string>& files, std::string& path) {
@@ -194,56 +722,76 @@ void CpuImageProcessing::execute(std::vector<std::string>& files, std::string& p
 
     // Process all of the images that are included in the files parameter
     for (int i = 0; i < files.size(); i++) {
+        TraceSpan imageSpan(files.at(i), "image");
+
         // Variables for original, hsv, and blurred image
-        cv::Mat inputImage = cv::imread(path + files.at(i));
-        cv::Mat hsvImage = cv::Mat::zeros(inputImage.size(), inputImage.type());
-        cv::Mat blurImage = cv::Mat::zeros(inputImage.size(), inputImage.type());
-        cv::Mat blurHSVImage = cv::Mat::zeros(inputImage.size(), inputImage.type());
+        cv::Mat inputImage;
+        {
+            TraceSpan span("imread", "decode");
+            inputImage = cv::imread(path + files.at(i));
+        }
+        cv::Mat hsvImage = HostImagePool::instance().image(inputImage.size(), inputImage.type());
+        cv::Mat blurImage = HostImagePool::instance().image(inputImage.size(), inputImage.type());
+        cv::Mat blurHSVImage = HostImagePool::instance().image(inputImage.size(), inputImage.type());
         
-        // Convert RGB image to HSV image
-        rgbToHsv(inputImage, hsvImage);
-
-        // Blur Original Image
         int kernelSize = 10;
-        boxBlur(inputImage, blurImage, kernelSize);
+        {
+            TraceSpan span("compute", "compute");
+
+            // Convert RGB image to HSV image
+            rgbToHsv(inputImage, hsvImage);
 
-        // Blur HSV Image
-        boxBlur(hsvImage, blurHSVImage, kernelSize);
+            // Blur Original Image
+            boxBlur(inputImage, blurImage, kernelSize);
+
+            // Blur HSV Image
+            boxBlur(hsvImage, blurHSVImage, kernelSize);
+        }
         std::cout << "Finished processing image " << i + 1 << " with CPU." << std::endl;
         
         // Display the results
-        cv::imshow("Original Image", inputImage);
-        cv::imshow("HSV Image", hsvImage);
-        cv::imshow("Blurred Original Image", blurImage);
-        cv::imshow("Blurred HSV Image ", blurHSVImage);
-        cv::waitKey(0);
-        cv::destroyAllWindows();
+        {
+            TraceSpan span("display results", "display");
+            cv::imshow("Original Image", inputImage);
+            cv::imshow("HSV Image", hsvImage);
+            cv::imshow("Blurred Original Image", blurImage);
+            cv::imshow("Blurred HSV Image ", blurHSVImage);
+            cv::waitKey(0);
+            cv::destroyAllWindows();
+        }
 
         // Compare the custom result with the already existing operation from OpenCV
         // Variables for hsv and blur image with OpenCV
-        cv::Mat hsvImageOpenCV = cv::Mat::zeros(inputImage.size(), inputImage.type());
-        cv::Mat blurImageOpenCV = cv::Mat::zeros(inputImage.size(), inputImage.type());
-        cv::Mat blurHSVImageOpenCV = cv::Mat::zeros(inputImage.size(), inputImage.type());
+        cv::Mat hsvImageOpenCV = HostImagePool::instance().image(inputImage.size(), inputImage.type());
+        cv::Mat blurImageOpenCV = HostImagePool::instance().image(inputImage.size(), inputImage.type());
+        cv::Mat blurHSVImageOpenCV = HostImagePool::instance().image(inputImage.size(), inputImage.type());
         
         // HSV and Blur with OpenCV
-        ocvip.rgbToHsv(inputImage, hsvImageOpenCV);
-        ocvip.boxBlur(inputImage, blurImageOpenCV, kernelSize);
-        ocvip.boxBlur(hsvImageOpenCV, blurHSVImageOpenCV, kernelSize);
+        {
+            TraceSpan span("OpenCV reference", "compute");
+            ocvip.rgbToHsv(inputImage, hsvImageOpenCV);
+            ocvip.boxBlur(inputImage, blurImageOpenCV, kernelSize);
+            ocvip.boxBlur(hsvImageOpenCV, blurHSVImageOpenCV, kernelSize);
+        }
 
         // Compare the results
-        cv::Mat diff_hsv_image = hsvImage - hsvImageOpenCV;
-        cv::Mat diff_blur_image = blurImage - blurImageOpenCV;
-        cv::Mat diff_hsv_blur_image = blurHSVImage - blurHSVImageOpenCV;
-        cv::imshow("Diff HSV Image", diff_hsv_image);
-        cv::imshow("Diff Blur Image", diff_blur_image);
-        cv::imshow("Diff HSV Blur Image", diff_hsv_blur_image);
-        cv::waitKey(0);
-        cv::destroyAllWindows();
+        {
+            TraceSpan span("display differences", "display");
+            cv::Mat diff_hsv_image = hsvImage - hsvImageOpenCV;
+            cv::Mat diff_blur_image = blurImage - blurImageOpenCV;
+            cv::Mat diff_hsv_blur_image = blurHSVImage - blurHSVImageOpenCV;
+            cv::imshow("Diff HSV Image", diff_hsv_image);
+            cv::imshow("Diff Blur Image", diff_blur_image);
+            cv::imshow("Diff HSV Blur Image", diff_hsv_blur_image);
+            cv::waitKey(0);
+            cv::destroyAllWindows();
+        }
 
         // Specify the folder path to save the images
         std::string folderPath = "Results CPU\\";
 
         // Create .jpg file from the result
+        TraceSpan span("imwrite", "encode");
         std::string numberingFile = std::to_string(i + 1);
         std::string hsvImageFile = folderPath + numberingFile + ".hsvImage.jpg";
         std::string blurredImageFile = folderPath + numberingFile + ".blurredImage.jpg";
@@ -1,11 +1,19 @@
 #ifndef CPU_IMAGE_PROCESSING_H
 #define CPU_IMAGE_PROCESSING_H
 
+#include <functional>
+#include <memory>
 #include "ImageProcessorInterface.h"
+#include "BoxBlurSpecialized.h"
+#include "GaussianBoxes.h"
+#include "HsvFixedPoint.h"
+#include "HsvSimd.h"
+#include "ThreadPool.h"
 
 class CpuImageProcessing : public ImageProcessorInterface {
 public:
-    CpuImageProcessing();
+    // numThreads = 0 uses one thread per hardware core
+    explicit CpuImageProcessing(unsigned int numThreads = 0);
     virtual ~CpuImageProcessing();
 
     struct RGB {
@@ -16,13 +24,98 @@ public:
         float h, s, v;
     };
 
+    // Naive walks the full (2r+1)^2 window per pixel, SlidingWindow uses
+    // separable running sums so the cost does not depend on the kernel size
+    enum class BlurMode {
+        Naive,
+        SlidingWindow
+    };
+
+    void setBlurMode(BlurMode mode);
+    BlurMode getBlurMode() const;
+
+    // SlidingWindow uses an instantiation with the radius and channel count fixed at compile
+    // time for the common radii. Other radii, or disabling it, run the generic code
+    void setSpecializedBlur(bool enabled);
+    bool getSpecializedBlur() const;
+
+    // Images are split into bands of rows that run on a persistent work-stealing pool
+    void setThreadCount(unsigned int numThreads);
+    unsigned int getThreadCount() const;
+
+    // The HSV conversion uses the fastest instruction set the CPU supports. A lower level
+    // can be forced, requests above what the CPU supports are clamped
+    void setSimdLevel(SimdLevel level);
+    SimdLevel getSimdLevel() const;
+
+    // Float follows the float formula and truncates like the original code. FixedPoint uses
+    // integer reciprocal tables without any division and rounds like OpenCV's 8-bit conversion
+    enum class HsvMode {
+        Float,
+        FixedPoint
+    };
+
+    void setHsvMode(HsvMode mode);
+    HsvMode getHsvMode() const;
+
     virtual void execute(std::vector<std::string>& files, std::string& path) override;
     virtual void rgbToHsv(const cv::Mat& input, cv::Mat& output) override;
     virtual void boxBlur(const cv::Mat& input, cv::Mat& output, int kernelSize) override;
+
+    // Gaussian approximated by 3 to 5 box blurs, so the cost does not depend on sigma. The
+    // passes alternate between the output and a scratch image that is kept between calls.
+    // Sigmas too small for the boxes use the sampled kernel of gaussianKernelWeights
+    virtual void gaussianBlur(const cv::Mat& input, cv::Mat& output, double sigma) override;
+    void setGaussianPasses(int passes);
+    int getGaussianPasses() const;
+
+    // Every stage of the plan is one pass over the image: point operations are applied to
+    // line buffers of the rows the blur reads or writes. Fused passes use the sliding window
+    virtual void runPipeline(const ImagePipeline& pipeline, const cv::Mat& input, cv::Mat& output) override;
+
     virtual void runtime(std::vector<std::string>& files, std::string& path, int num_runs) override;
 
+    // Builds the 32-bit summed-area table of the input once, afterwards any box radius
+    // or rectangle can be answered with four lookups per pixel and channel
+    void buildIntegralImage(const cv::Mat& input);
+    void boxBlurIntegral(cv::Mat& output, int kernelSize);
+    void boxBlurIntegral(cv::Mat& output, int radiusX, int radiusY);
+    cv::Scalar rectangleSum(const cv::Rect& rect) const;
+
+    // Measures HSV and blur for increasing thread counts and reports the speedup against one thread
+    void scalingEvaluation(std::vector<std::string>& files, std::string& path, int num_runs);
+
 private:
+    BlurMode blurMode;
+    bool specializedBlur;
+    std::unique_ptr<ThreadPool> threadPool;
+    SimdLevel simdLevel;
+    HsvMode hsvMode;
+    int gaussianPasses;
+    cv::Mat gaussianScratch;
+    cv::Mat pipelineScratch;
+
+    // Summed-area table with a leading zero row and column: (rows + 1) x (cols + 1) x depth
+    std::vector<uint32_t> integralImage;
+    int integralWidth;
+    int integralHeight;
+    int integralDepth;
+    int integralType;
+
     HSV rgbToHsvCPU(float r, float g, float b);
+    void forEachRowBand(int rows, int halo, const std::function<void(int, int)>& body);
+    using PointOperations = std::vector<ImagePipeline::Operation>;
+
+    void rgbToHsvRows(const cv::Mat& input, cv::Mat& output, int rowBegin, int rowEnd);
+    void rgbToHsvRow(const uchar* inputRow, uchar* outputRow, int width, int depth);
+    void applyPointOperations(const PointOperations& operations, const uchar* input, uchar* output,
+        int width, int depth, uchar* scratch);
+    void boxBlurNaive(const cv::Mat& input, cv::Mat& output, int kernelSize, int rowBegin, int rowEnd);
+    void boxBlurSlidingWindow(const cv::Mat& input, cv::Mat& output, int kernelSize, int rowBegin, int rowEnd,
+        const PointOperations& before = PointOperations(), const PointOperations& after = PointOperations());
+    void horizontalRowSum(const uchar* row, int width, int depth, int kernelSize, int* rowSum);
+    uint32_t integralSum(int x0, int y0, int x1, int y1, int channel) const;
+    void boxBlurIntegralRows(cv::Mat& output, int radiusX, int radiusY, int rowBegin, int rowEnd);
 };
 
 #endif // CPU_IMAGE_PROCESSING_H
@@ -0,0 +1,438 @@
+#include "DirectoryBatch.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <thread>
+#include "CommandLine.h"
+#include "CpuImageProcessing.h"
+#include "HostImagePool.h"
+#include "OpenCLImageProcessing.h"
+#include "OpenCVImageProcessing.h"
+#include "Trace.h"
+
+namespace fs = std::filesystem;
+
+void printDirectoryBatchUsage() {
+    std::cout << "Usage: opencl_aufgabe --batch <input directory> <output directory> [options]" << std::endl;
+    std::cout << "  --backend opencl               cpu, opencl or opencv" << std::endl;
+    std::cout << "  --device gpu                   OpenCL device: gpu, cpu, index or name" << std::endl;
+    std::cout << "  --ops hsv,blur,blurhsv         Results to write per image" << std::endl;
+    std::cout << "  --radius 10                    Blur radius" << std::endl;
+    std::cout << "  --workers 0                    Decode and encode threads, 0 for one per hardware thread" << std::endl;
+    std::cout << "  --memory-mb 512                Budget for images in flight" << std::endl;
+    std::cout << "  --decodes 2                    Images decoded at the same time" << std::endl;
+    std::cout << "  --restart                      Process everything again instead of resuming" << std::endl;
+}
+
+bool parseDirectoryBatchOptions(int argc, char** argv, DirectoryBatchOptions& options) {
+    if (argc < 2) {
+        printDirectoryBatchUsage();
+        return false;
+    }
+    options.inputDirectory = argv[0];
+    options.outputDirectory = argv[1];
+
+    for (int i = 2; i < argc; i++) {
+        std::string flag = argv[i];
+
+        // Flags without a value
+        if (flag == "--restart") {
+            options.restart = true;
+            continue;
+        }
+
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << flag << std::endl;
+            printDirectoryBatchUsage();
+            return false;
+        }
+        std::string value = argv[++i];
+
+        try {
+            if (flag == "--backend") {
+                options.backend = value;
+            }
+            else if (flag == "--device") {
+                options.device = value;
+            }
+            else if (flag == "--ops") {
+                options.operations = splitList(value);
+            }
+            else if (flag == "--radius") {
+                options.kernelSize = std::stoi(value);
+            }
+            else if (flag == "--workers") {
+                options.workers = static_cast<unsigned int>(std::stoul(value));
+            }
+            else if (flag == "--memory-mb") {
+                options.memoryBudgetBytes = static_cast<size_t>(std::stoull(value)) << 20;
+            }
+            else if (flag == "--decodes") {
+                options.maxDecodes = static_cast<unsigned int>(std::stoul(value));
+            }
+            else {
+                std::cerr << "Unknown option " << flag << std::endl;
+                printDirectoryBatchUsage();
+                return false;
+            }
+        }
+        catch (const std::exception&) {
+            std::cerr << "Invalid value for " << flag << ": " << value << std::endl;
+            printDirectoryBatchUsage();
+            return false;
+        }
+    }
+
+    for (const std::string& operation : options.operations) {
+        if (operation != "hsv" && operation != "blur" && operation != "blurhsv") {
+            std::cerr << "Unknown operation " << operation << std::endl;
+            return false;
+        }
+    }
+    if (options.operations.empty() || options.kernelSize < 1 || options.memoryBudgetBytes == 0 || options.maxDecodes == 0) {
+        std::cerr << "At least one operation, a positive radius, a memory budget and one decode are needed" << std::endl;
+        return false;
+    }
+    if (options.backend != "cpu" && options.backend != "opencl" && options.backend != "opencv") {
+        std::cerr << "Unknown backend " << options.backend << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Bytes of images in flight. A worker waits until its image fits into the budget, unless
+// nothing else is in flight, so an image larger than the budget cannot block the run. With
+// a size of 1 per image it limits the number of decodes as well
+class MemoryBudget {
+public:
+    explicit MemoryBudget(size_t limit) : limit(limit), used(0) {}
+
+    void acquire(size_t bytes) {
+        std::unique_lock<std::mutex> lock(mutex);
+        released.wait(lock, [&]() { return used == 0 || used + bytes <= limit; });
+        used += bytes;
+    }
+
+    void release(size_t bytes) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            used -= bytes;
+        }
+        released.notify_all();
+    }
+
+    // Holds the bytes until it goes out of scope, also when processing throws
+    struct Reservation {
+        Reservation(MemoryBudget& budget, size_t bytes) : budget(budget), bytes(bytes) { budget.acquire(bytes); }
+        ~Reservation() { budget.release(bytes); }
+
+        MemoryBudget& budget;
+        size_t bytes;
+    };
+
+private:
+    size_t limit;
+    size_t used;
+    std::mutex mutex;
+    std::condition_variable released;
+};
+
+// Extensions cv::imread decodes in every OpenCV build
+static bool isImageFile(const fs::path& file) {
+    std::string extension = file.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(),
+        [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return extension == ".jpg" || extension == ".jpeg" || extension == ".png" || extension == ".bmp"
+        || extension == ".tif" || extension == ".tiff";
+}
+
+// Big-endian and little-endian integers of an image header
+static size_t readBigEndian(const unsigned char* bytes, int count) {
+    size_t value = 0;
+    for (int i = 0; i < count; i++)
+        value = (value << 8) | bytes[i];
+    return value;
+}
+
+static size_t readLittleEndian(const unsigned char* bytes, int count) {
+    size_t value = 0;
+    for (int i = count - 1; i >= 0; i--)
+        value = (value << 8) | bytes[i];
+    return value;
+}
+
+// Width and height from the header of a PNG, JPEG or BMP file, without decoding it. Returns
+// false for other formats and for headers that cannot be read
+static bool readImageSize(const fs::path& file, size_t& width, size_t& height) {
+    std::ifstream stream(file, std::ios::binary);
+    unsigned char header[26] = {};
+    if (!stream.read(reinterpret_cast<char*>(header), sizeof(header)))
+        return false;
+
+    // PNG: the IHDR chunk follows the signature
+    if (header[0] == 0x89 && header[1] == 'P' && header[2] == 'N' && header[3] == 'G') {
+        width = readBigEndian(header + 16, 4);
+        height = readBigEndian(header + 20, 4);
+        return true;
+    }
+
+    // BMP: the info header follows the file header, a negative height stores the rows top-down.
+    // The old core header has 16-bit sizes
+    if (header[0] == 'B' && header[1] == 'M') {
+        if (readLittleEndian(header + 14, 4) == 12) {
+            width = readLittleEndian(header + 18, 2);
+            height = readLittleEndian(header + 20, 2);
+            return true;
+        }
+        width = readLittleEndian(header + 18, 4);
+        height = static_cast<size_t>(std::abs(static_cast<int32_t>(readLittleEndian(header + 22, 4))));
+        return true;
+    }
+
+    // JPEG: the size is in the start of frame segment, every other segment is skipped by its length
+    if (header[0] != 0xFF || header[1] != 0xD8)
+        return false;
+    stream.seekg(2);
+    unsigned char segment[7];
+    while (stream.read(reinterpret_cast<char*>(segment), 4)) {
+        if (segment[0] != 0xFF)
+            return false;
+        const unsigned char marker = segment[1];
+        const size_t length = readBigEndian(segment + 2, 2);
+        const bool startOfFrame = marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+        if (startOfFrame) {
+            if (!stream.read(reinterpret_cast<char*>(segment), 5))
+                return false;
+            height = readBigEndian(segment + 1, 2);
+            width = readBigEndian(segment + 3, 2);
+            return true;
+        }
+        if (length < 2)
+            return false;
+        stream.seekg(static_cast<std::streamoff>(length - 2), std::ios::cur);
+    }
+    return false;
+}
+
+static std::unique_ptr<ImageProcessorInterface> createBackend(const DirectoryBatchOptions& options) {
+    if (options.backend == "cpu")
+        return std::make_unique<CpuImageProcessing>();
+    if (options.backend == "opencl") {
+        return options.device.empty() ? std::make_unique<OpenCLImageProcessing>()
+            : std::make_unique<OpenCLImageProcessing>(OpenCLImageProcessing::DeviceSelection::parse(options.device));
+    }
+    return std::make_unique<OpenCVImageProcessing>();
+}
+
+// Suffix of the result file, the same names the demo uses
+static std::string resultSuffix(const std::string& operation) {
+    if (operation == "hsv")
+        return ".hsvImage";
+    if (operation == "blur")
+        return ".blurredImage";
+    return ".blurredHSVImage";
+}
+
+DirectoryBatchSummary runDirectoryBatch(const DirectoryBatchOptions& options) {
+    DirectoryBatchSummary summary;
+    const fs::path inputRoot(options.inputDirectory);
+    const fs::path outputRoot(options.outputDirectory);
+
+    std::error_code error;
+    if (!fs::is_directory(inputRoot, error)) {
+        std::cerr << options.inputDirectory << " is not a directory" << std::endl;
+        summary.failed = 1;
+        return summary;
+    }
+    fs::create_directories(outputRoot, error);
+    const fs::path outputCanonical = fs::weakly_canonical(outputRoot, error);
+
+    // Inputs finished by an earlier run, relative to the input directory
+    const fs::path progressPath = outputRoot / options.progressFile;
+    std::set<std::string> finished;
+    if (!options.restart) {
+        std::ifstream progress(progressPath);
+        std::string line;
+        while (std::getline(progress, line)) {
+            if (!line.empty())
+                finished.insert(line);
+        }
+    }
+
+    // The walk is sorted, so runs over the same tree process it in the same order. The
+    // output directory is left out in case it lies inside the input directory
+    std::vector<std::string> jobs;
+    for (fs::recursive_directory_iterator it(inputRoot, error), end; it != end; it.increment(error)) {
+        if (it->is_directory(error) && fs::weakly_canonical(it->path(), error) == outputCanonical) {
+            it.disable_recursion_pending();
+            continue;
+        }
+        if (!it->is_regular_file(error) || !isImageFile(it->path()))
+            continue;
+
+        std::string relative = fs::relative(it->path(), inputRoot, error).generic_string();
+        if (finished.count(relative))
+            summary.skipped++;
+        else
+            jobs.push_back(relative);
+    }
+    std::sort(jobs.begin(), jobs.end());
+
+    std::cout << "Batch: " << jobs.size() << " images to process, " << summary.skipped
+        << " already finished" << std::endl;
+
+    std::ofstream progress(progressPath, options.restart ? std::ios::trunc : std::ios::app);
+    std::unique_ptr<ImageProcessorInterface> backend = createBackend(options);
+
+    // HSV fused into the blur, planned once for all images
+    ImagePipeline blurHsvPipeline;
+    blurHsvPipeline.rgbToHsv().boxBlur(options.kernelSize);
+
+    unsigned int numWorkers = options.workers;
+    if (numWorkers == 0)
+        numWorkers = std::max(1u, std::thread::hardware_concurrency());
+
+    // Results in flight stay within the budget, so the pool never needs to keep more than that
+    const size_t previousPoolCap = HostImagePool::instance().getMemoryCap();
+    HostImagePool::instance().setMemoryCap(options.memoryBudgetBytes);
+
+    MemoryBudget budget(options.memoryBudgetBytes);
+    MemoryBudget decodes(options.maxDecodes);
+    std::atomic<size_t> nextJob(0);
+    std::mutex backendMutex;
+    std::mutex reportMutex;
+    double megapixels = 0;
+    int processed = 0;
+    int failed = 0;
+
+    auto worker = [&](unsigned int index) {
+        Trace::setThreadName("Batch worker " + std::to_string(index + 1));
+        while (true) {
+            size_t job = nextJob++;
+            if (job >= jobs.size())
+                return;
+
+            const fs::path inputPath = inputRoot / fs::path(jobs[job]);
+            const fs::path outputFolder = (outputRoot / fs::path(jobs[job])).parent_path();
+            bool success = false;
+
+            try {
+                // The input and every result are held until the results are encoded. imread
+                // decodes to 8-bit BGR, so the header gives their size before anything is decoded.
+                // Without a readable header the whole budget is reserved and the image runs alone
+                size_t width = 0;
+                size_t height = 0;
+                size_t bytes = options.memoryBudgetBytes;
+                if (readImageSize(inputPath, width, height))
+                    bytes = width * height * 3 * (options.operations.size() + 1);
+                MemoryBudget::Reservation reservation(budget, bytes);
+
+                cv::Mat inputImage;
+                {
+                    MemoryBudget::Reservation decode(decodes, 1);
+                    TraceSpan span("imread " + jobs[job], "decode");
+                    inputImage = cv::imread(inputPath.string());
+                }
+                if (!inputImage.empty()) {
+                    // Results come from the host image pool, so their memory is recycled once encoded
+                    std::vector<cv::Mat> results(options.operations.size());
+                    for (cv::Mat& result : results)
+                        result = HostImagePool::instance().image(inputImage.size(), inputImage.type());
+                    {
+                        // Backends are not thread-safe, they parallelize each image themselves
+                        std::lock_guard<std::mutex> lock(backendMutex);
+                        TraceSpan span("compute " + jobs[job], "compute");
+                        cv::Mat hsvImage;
+                        const bool keepHsv = std::find(options.operations.begin(), options.operations.end(), "hsv") 
+                            != options.operations.end();
+                        for (size_t i = 0; i < options.operations.size(); i++) {
+                            const std::string& operation = options.operations[i];
+                            if (operation == "blur") {
+                                backend->boxBlur(inputImage, results[i], options.kernelSize);
+                                continue;
+                            }
+
+                            // Without the HSV result the blurred HSV image is one fused pass
+                            if (operation == "blurhsv" && !keepHsv) {
+                                backend->runPipeline(blurHsvPipeline, inputImage, results[i]);
+                                continue;
+                            }
+                            if (hsvImage.empty())
+                                backend->rgbToHsv(inputImage, hsvImage);
+                            if (operation == "hsv")
+                                results[i] = hsvImage;
+                            else
+                                backend->boxBlur(hsvImage, results[i], options.kernelSize);
+                        }
+                    }
+
+                    std::error_code folderError;
+                    fs::create_directories(outputFolder, folderError);
+                    success = true;
+                    TraceSpan span("imwrite " + jobs[job], "encode");
+                    for (size_t i = 0; i < options.operations.size(); i++) {
+                        const fs::path resultPath = outputFolder / (inputPath.stem().string()
+                            + resultSuffix(options.operations[i]) + inputPath.extension().string());
+                        success = cv::imwrite(resultPath.string(), results[i]) && success;
+                    }
+
+                    std::lock_guard<std::mutex> lock(reportMutex);
+                    if (success)
+                        megapixels += inputImage.total() / 1e6;
+                }
+            }
+            catch (const std::exception& exception) {
+                std::lock_guard<std::mutex> lock(reportMutex);
+                std::cerr << jobs[job] << ": " << exception.what() << std::endl;
+            }
+
+            // An image counts as finished once all its results are on disk, an interrupted
+            // run repeats the images that were in flight
+            std::lock_guard<std::mutex> lock(reportMutex);
+            if (success) {
+                processed++;
+                progress << jobs[job] << std::endl;
+                std::cout << "[" << processed + failed << "/" << jobs.size() << "] " << jobs[job] << std::endl;
+            }
+            else {
+                failed++;
+                std::cerr << "Could not process " << jobs[job] << std::endl;
+            }
+        }
+    };
+
+    // Record the starting time
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for (unsigned int i = 0; i < numWorkers; i++)
+        threads.emplace_back(worker, i);
+    for (std::thread& thread : threads)
+        thread.join();
+
+    auto end = std::chrono::steady_clock::now();
+
+    summary.processed = processed;
+    summary.failed = failed;
+    summary.megapixels = megapixels;
+    summary.seconds = std::chrono::duration<double>(end - start).count();
+
+    double imagesPerSecond = summary.seconds > 0 ? summary.processed / summary.seconds : 0;
+    double megapixelsPerSecond = summary.seconds > 0 ? summary.megapixels / summary.seconds : 0;
+    std::cout << "Batch finished: " << summary.processed << " processed, " << summary.skipped << " skipped, "
+        << summary.failed << " failed in " << summary.seconds << " s with " << numWorkers << " workers, "
+        << imagesPerSecond << " images/s, " << megapixelsPerSecond << " MP/s" << std::endl;
+    HostImagePool::instance().printStatistics(std::cout);
+    HostImagePool::instance().setMemoryCap(previousPoolCap);
+    return summary;
+}
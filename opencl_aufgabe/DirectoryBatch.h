@@ -0,0 +1,57 @@
+#ifndef DIRECTORY_BATCH_H
+#define DIRECTORY_BATCH_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Settings of a headless run over a directory tree, filled from the command line
+struct DirectoryBatchOptions {
+    std::string inputDirectory;
+    std::string outputDirectory;
+    std::string backend = "opencl";
+
+    // OpenCL device as understood by OpenCLImageProcessing::DeviceSelection::parse
+    std::string device;
+
+    // hsv, blur and blurhsv (the blur of the HSV image), written next to each other like
+    // the results of the demo
+    std::vector<std::string> operations{ "hsv", "blur", "blurhsv" };
+    int kernelSize = 10;
+
+    // Threads that decode and encode. 0 uses one per hardware thread
+    unsigned int workers = 0;
+
+    // Upper bound for decoded inputs and their results that are in flight at the same time.
+    // A single image larger than the budget is still processed, alone
+    size_t memoryBudgetBytes = static_cast<size_t>(512) << 20;
+
+    // Images decoded at the same time. The backend takes one image at a time, so a few decodes
+    // ahead of it keep it busy while the other workers encode
+    unsigned int maxDecodes = 2;
+
+    // Finished inputs are listed in this file inside the output directory, a later run with
+    // the same output directory skips them. restart ignores and replaces the list
+    std::string progressFile = "batch_progress.txt";
+    bool restart = false;
+};
+
+// Counts and throughput of a run. Skipped inputs were finished by an earlier run
+struct DirectoryBatchSummary {
+    int processed = 0;
+    int skipped = 0;
+    int failed = 0;
+    double megapixels = 0;
+    double seconds = 0;
+};
+
+// Parses the flags after --batch. Prints the usage and returns false on invalid input
+bool parseDirectoryBatchOptions(int argc, char** argv, DirectoryBatchOptions& options);
+void printDirectoryBatchUsage();
+
+// Processes every image below the input directory and writes the results into the same
+// relative directories below the output directory. Workers decode and encode in parallel,
+// the backend processes one image at a time and parallelizes internally
+DirectoryBatchSummary runDirectoryBatch(const DirectoryBatchOptions& options);
+
+#endif // DIRECTORY_BATCH_H
@@ -0,0 +1,78 @@
+#include "GaussianBoxes.h"
+#include <algorithm>
+#include <cmath>
+
+std::vector<int> gaussianBoxRadii(double sigma, int passes) {
+    passes = std::max(GAUSSIAN_MIN_PASSES, std::min(passes, GAUSSIAN_MAX_PASSES));
+
+    // A box of width w has the variance (w^2 - 1) / 12, n of them add up to sigma^2 for the
+    // ideal width sqrt(12 sigma^2 / n + 1)
+    const double variance = sigma * sigma;
+    const double idealWidth = std::sqrt(12.0 * variance / passes + 1.0);
+    int lower = static_cast<int>(std::floor(idealWidth));
+    if (lower % 2 == 0)
+        --lower;
+    if (lower < 3)
+        return {};
+    const int upper = lower + 2;
+
+    // Number of passes with the lower width, the rest uses the upper one
+    const double idealLower = (12.0 * variance - passes * lower * lower - 4.0 * passes * lower - 3.0 * passes)
+        / (-4.0 * lower - 4.0);
+    const int lowerPasses = std::max(0, std::min(static_cast<int>(std::lround(idealLower)), passes));
+
+    std::vector<int> radii;
+    for (int i = 0; i < passes; ++i) {
+        int width = i < lowerPasses ? lower : upper;
+        radii.push_back((width - 1) / 2);
+    }
+    return radii;
+}
+
+std::vector<float> gaussianKernelWeights(double sigma) {
+    if (sigma <= 0.0)
+        return { 1.0f };
+
+    // cv::getGaussianKernel for 8-bit images with the size cvRound(6 sigma + 1) | 1
+    const int radius = (cvRound(sigma * 6.0 + 1.0) | 1) / 2;
+    std::vector<double> exact(2 * radius + 1);
+    double sum = 0.0;
+    for (int i = -radius; i <= radius; ++i) {
+        exact[i + radius] = std::exp(-0.5 * i * i / (sigma * sigma));
+        sum += exact[i + radius];
+    }
+
+    std::vector<float> weights(exact.size());
+    for (size_t i = 0; i < exact.size(); ++i)
+        weights[i] = static_cast<float>(exact[i] / sum);
+    return weights;
+}
+
+void gaussianKernelRows(const cv::Mat& input, cv::Mat& output, const std::vector<float>& weights, int rowBegin,
+    int rowEnd) {
+    const int radius = static_cast<int>(weights.size()) / 2;
+    const int depth = input.channels();
+    const int width = input.cols;
+    const int height = input.rows;
+    std::vector<float> columnSums(static_cast<size_t>(width) * depth);
+
+    for (int y = rowBegin; y < rowEnd; ++y) {
+        std::fill(columnSums.begin(), columnSums.end(), 0.0f);
+        for (int j = -radius; j <= radius; ++j) {
+            const uchar* row = input.ptr<uchar>(std::max(0, std::min(y + j, height - 1)));
+            const float weight = weights[j + radius];
+            for (size_t i = 0; i < columnSums.size(); ++i)
+                columnSums[i] += weight * row[i];
+        }
+
+        uchar* outputRow = output.ptr<uchar>(y);
+        for (int x = 0; x < width; ++x) {
+            for (int channels = 0; channels < depth; ++channels) {
+                float sum = 0.0f;
+                for (int i = -radius; i <= radius; ++i)
+                    sum += weights[i + radius] * columnSums[std::max(0, std::min(x + i, width - 1)) * depth + channels];
+                outputRow[x * depth + channels] = cv::saturate_cast<uchar>(sum);
+            }
+        }
+    }
+}
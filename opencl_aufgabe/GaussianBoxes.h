@@ -0,0 +1,29 @@
+#ifndef GAUSSIAN_BOXES_H
+#define GAUSSIAN_BOXES_H
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// Fewest and most box passes a Gaussian approximation may use. Three passes are already
+// within a few percent of the Gaussian, five come closer at two more passes of cost
+const int GAUSSIAN_MIN_PASSES = 3;
+const int GAUSSIAN_MAX_PASSES = 5;
+
+// Radii of the box passes whose repeated application has the variance of a Gaussian with this
+// sigma. The box widths are the two odd integers around the ideal width, the smaller one used
+// for the first passes so that the variances add up to sigma^2 as closely as possible.
+// Returns no radii when some pass would get radius 0: three passes of radius 1 already have
+// sigma sqrt(2), below that the boxes cannot reach the variance and the sampled kernel is used
+std::vector<int> gaussianBoxRadii(double sigma, int passes);
+
+// Normalized weights of the sampled Gaussian that stands in for the box passes at small sigma.
+// The radius follows from sigma like in cv::GaussianBlur with a kernel size of 0
+std::vector<float> gaussianKernelWeights(double sigma);
+
+// Blurs the output rows [rowBegin, rowEnd) with the separable sampled kernel, the border
+// replicated like in the box blur. Every row sums its column window first and then its row
+// window, so bands of rows can run in parallel. Input and output must not share memory
+void gaussianKernelRows(const cv::Mat& input, cv::Mat& output, const std::vector<float>& weights, int rowBegin,
+    int rowEnd);
+
+#endif // GAUSSIAN_BOXES_H
@@ -0,0 +1,161 @@
+#include "HostImagePool.h"
+#include <algorithm>
+
+HostImagePool::HostImagePool() : stats{ 0, 0, 0, 0, 0, 0, 0 }, useCounter(0), memoryCap(HOST_IMAGE_POOL_DEFAULT_CAP) {}
+
+HostImagePool::~HostImagePool() {
+    for (Block& block : blocks)
+        cv::fastFree(block.data);
+}
+
+HostImagePool& HostImagePool::instance() {
+    static HostImagePool pool;
+    return pool;
+}
+
+cv::Mat HostImagePool::image(cv::Size size, int type) {
+    cv::Mat image;
+    image.allocator = this;
+    image.create(size, type);
+    return image;
+}
+
+cv::Mat HostImagePool::image(int rows, int cols, int type) {
+    return image(cv::Size(cols, rows), type);
+}
+
+void HostImagePool::setMemoryCap(size_t bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    memoryCap = bytes;
+    evictFor(0);
+}
+
+size_t HostImagePool::getMemoryCap() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return memoryCap;
+}
+
+uchar* HostImagePool::acquire(size_t size) const {
+    // Reuse a free block with exactly the same size
+    for (Block& block : blocks) {
+        if (!block.inUse && block.size == size) {
+            block.inUse = true;
+            block.lastUse = ++useCounter;
+            ++stats.hits;
+            stats.bytesInUse += size;
+            stats.peakBytesInUse = std::max(stats.peakBytesInUse, stats.bytesInUse);
+            return block.data;
+        }
+    }
+
+    // Make room for the new block, then allocate it
+    ++stats.misses;
+    evictFor(size);
+
+    blocks.push_back({ static_cast<uchar*>(cv::fastMalloc(size)), size, true, ++useCounter });
+    stats.bytesHeld += size;
+    stats.peakBytesHeld = std::max(stats.peakBytesHeld, stats.bytesHeld);
+    stats.bytesInUse += size;
+    stats.peakBytesInUse = std::max(stats.peakBytesInUse, stats.bytesInUse);
+    return blocks.back().data;
+}
+
+void HostImagePool::release(uchar* data) const {
+    for (Block& block : blocks) {
+        if (block.data == data) {
+            block.inUse = false;
+            block.lastUse = ++useCounter;
+            stats.bytesInUse -= block.size;
+            break;
+        }
+    }
+    evictFor(0);
+}
+
+void HostImagePool::evictFor(size_t size) const {
+    // Only free blocks can be evicted. Blocks still in use may keep the pool above the cap
+    while (stats.bytesHeld + size > memoryCap) {
+        auto victim = blocks.end();
+        for (auto it = blocks.begin(); it != blocks.end(); ++it) {
+            if (!it->inUse && (victim == blocks.end() || it->lastUse < victim->lastUse))
+                victim = it;
+        }
+        if (victim == blocks.end())
+            break;
+
+        cv::fastFree(victim->data);
+        stats.bytesHeld -= victim->size;
+        ++stats.evictions;
+        blocks.erase(victim);
+    }
+}
+
+void HostImagePool::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = blocks.begin(); it != blocks.end();) {
+        if (it->inUse) {
+            ++it;
+            continue;
+        }
+        cv::fastFree(it->data);
+        stats.bytesHeld -= it->size;
+        it = blocks.erase(it);
+    }
+}
+
+HostImagePool::Statistics HostImagePool::statistics() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return stats;
+}
+
+void HostImagePool::printStatistics(std::ostream& out) const {
+    Statistics current = statistics();
+    out << "Host image pool: " << current.hits << " hits, " << current.misses << " misses, "
+        << current.evictions << " evictions, " << current.bytesInUse << " bytes in use (peak "
+        << current.peakBytesInUse << "), " << current.bytesHeld << " bytes held (peak " 
+        << current.peakBytesHeld << ")" << std::endl;
+}
+
+cv::UMatData* HostImagePool::allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+    cv::AccessFlag, cv::UMatUsageFlags) const {
+    // Dense steps from the last dimension outwards, like OpenCV's own allocator. Steps given
+    // together with user data are kept
+    size_t total = CV_ELEM_SIZE(type);
+    for (int i = dims - 1; i >= 0; i--) {
+        if (step) {
+            if (data && step[i] != CV_AUTOSTEP)
+                total = step[i];
+            else
+                step[i] = total;
+        }
+        total *= sizes[i];
+    }
+
+    cv::UMatData* u = new cv::UMatData(this);
+    u->size = total;
+    if (data) {
+        u->data = u->origdata = static_cast<uchar*>(data);
+        u->flags |= cv::UMatData::USER_ALLOCATED;
+        return u;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    u->data = u->origdata = acquire(total);
+    return u;
+}
+
+bool HostImagePool::allocate(cv::UMatData* data, cv::AccessFlag, cv::UMatUsageFlags) const {
+    // Host memory only, there is nothing to allocate on a device
+    return data != nullptr;
+}
+
+void HostImagePool::deallocate(cv::UMatData* data) const {
+    if (data == nullptr)
+        return;
+
+    if (!(data->flags & cv::UMatData::USER_ALLOCATED)) {
+        std::lock_guard<std::mutex> lock(mutex);
+        release(data->origdata);
+    }
+    delete data;
+}
@@ -0,0 +1,77 @@
+#ifndef HOST_IMAGE_POOL_H
+#define HOST_IMAGE_POOL_H
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+// Memory the pool keeps unless setMemoryCap says otherwise, enough for the working set of the
+// runtime evaluation on the largest default picture
+const size_t HOST_IMAGE_POOL_DEFAULT_CAP = static_cast<size_t>(512) << 20;
+
+// Host counterpart of OpenCLBufferPool: a cv::MatAllocator that keeps the memory of released
+// images and hands it out again for the next image with the same number of bytes. The memory
+// is aligned like cv::fastMalloc and not initialized, the kernels overwrite it anyway. Free
+// blocks are evicted least recently used first when the pool would exceed its memory cap.
+// Images must not outlive the pool, the process-wide instance lives until the program ends
+class HostImagePool : public cv::MatAllocator {
+public:
+    struct Statistics {
+        size_t hits;
+        size_t misses;
+        size_t evictions;
+        size_t bytesInUse;
+        size_t peakBytesInUse;
+        size_t bytesHeld;
+        size_t peakBytesHeld;
+    };
+
+    HostImagePool();
+    virtual ~HostImagePool();
+
+    static HostImagePool& instance();
+
+    // Mat of this size and type backed by the pool. Its content is undefined
+    cv::Mat image(cv::Size size, int type);
+    cv::Mat image(int rows, int cols, int type);
+
+    // Defaults to HOST_IMAGE_POOL_DEFAULT_CAP. Lowering the cap evicts free blocks right away
+    void setMemoryCap(size_t bytes);
+    size_t getMemoryCap() const;
+
+    // Frees every block that is not in use
+    void clear();
+
+    Statistics statistics() const;
+
+    // Peak memory and the memory held right now. After the first run of a loop the pool
+    // serves every image from free blocks, so the held memory is the steady state
+    void printStatistics(std::ostream& out) const;
+
+    virtual cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+        cv::AccessFlag flags, cv::UMatUsageFlags usageFlags) const override;
+    virtual bool allocate(cv::UMatData* data, cv::AccessFlag accessFlags, cv::UMatUsageFlags usageFlags) const override;
+    virtual void deallocate(cv::UMatData* data) const override;
+
+private:
+    struct Block {
+        uchar* data;
+        size_t size;
+        bool inUse;
+        uint64_t lastUse;
+    };
+
+    // MatAllocator's interface is const, the bookkeeping changes behind it
+    mutable std::mutex mutex;
+    mutable std::vector<Block> blocks;
+    mutable Statistics stats;
+    mutable uint64_t useCounter;
+    size_t memoryCap;
+
+    uchar* acquire(size_t size) const;
+    void release(uchar* data) const;
+    void evictFor(size_t size) const;
+};
+
+#endif // HOST_IMAGE_POOL_H
@@ -0,0 +1,60 @@
+#include "HsvFixedPoint.h"
+
+static HsvFixedPointTables buildTables() {
+    HsvFixedPointTables tables;
+    tables.saturation[0] = 0;
+    tables.hue[0] = 0;
+
+    // Rounded to the nearest fixed-point value, hue maps 60 degrees per delta to 30 half degrees
+    for (int i = 1; i < 256; ++i) {
+        tables.saturation[i] = cvRound((255 << HSV_FIXED_POINT_SHIFT) / static_cast<double>(i));
+        tables.hue[i] = cvRound((180 << HSV_FIXED_POINT_SHIFT) / (6.0 * i));
+    }
+    return tables;
+}
+
+const HsvFixedPointTables& hsvFixedPointTables() {
+    // Built once on first use, the initialization of a local static is thread-safe
+    static const HsvFixedPointTables tables = buildTables();
+    return tables;
+}
+
+void rgbToHsvRowFixedPoint(const uchar* input, uchar* output, int width, int depth) {
+    const HsvFixedPointTables& tables = hsvFixedPointTables();
+    const int rounding = 1 << (HSV_FIXED_POINT_SHIFT - 1);
+
+    for (int j = 0; j < width; ++j) {
+        const uchar* pixel = input + j * depth;
+        int r = pixel[0];
+        int g = pixel[1];
+        int b = pixel[2];
+
+        int maxVal = std::max(r, std::max(g, b));
+        int minVal = std::min(r, std::min(g, b));
+        int delta = maxVal - minVal;
+
+        // Hue difference of the maximum channel, offset by 2 or 4 sixths of the circle as
+        // multiples of delta, so that a single multiplication scales it to half degrees
+        int h;
+        if (maxVal == r)
+            h = g - b;
+        else if (maxVal == g)
+            h = b - r + 2 * delta;
+        else
+            h = r - g + 4 * delta;
+
+        h = (h * tables.hue[delta] + rounding) >> HSV_FIXED_POINT_SHIFT;
+        if (h < 0)
+            h += 180;
+
+        int s = (delta * tables.saturation[maxVal] + rounding) >> HSV_FIXED_POINT_SHIFT;
+
+        uchar* hsvPixel = output + j * depth;
+        hsvPixel[0] = static_cast<uchar>(h);
+        hsvPixel[1] = static_cast<uchar>(s);
+        hsvPixel[2] = static_cast<uchar>(maxVal);
+        for (int channels = 3; channels < depth; ++channels) {
+            hsvPixel[channels] = pixel[channels];
+        }
+    }
+}
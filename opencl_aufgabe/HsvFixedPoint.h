@@ -0,0 +1,24 @@
+#ifndef HSV_FIXED_POINT_H
+#define HSV_FIXED_POINT_H
+
+#include <opencv2/opencv.hpp>
+
+// Bits after the binary point of the reciprocal tables, the same as in OpenCV's 8-bit RGB2HSV
+const int HSV_FIXED_POINT_SHIFT = 12;
+
+// Reciprocals in 20.12 fixed point, indexed by a byte. saturation[v] = 255 / v scales delta
+// to the saturation byte and hue[delta] = 30 / delta scales the hue difference to half
+// degrees. Index 0 holds 0, so grey pixels get hue and saturation 0 without a branch
+struct HsvFixedPointTables {
+    int saturation[256];
+    int hue[256];
+};
+
+const HsvFixedPointTables& hsvFixedPointTables();
+
+// Convert one row of pixels to HSV bytes with integer arithmetic only: two table lookups and
+// two multiplications instead of the float divisions. Hue and saturation are rounded like
+// OpenCV, further channels (alpha) are passed through
+void rgbToHsvRowFixedPoint(const uchar* input, uchar* output, int width, int depth);
+
+#endif // HSV_FIXED_POINT_H
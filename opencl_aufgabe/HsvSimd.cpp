@@ -0,0 +1,210 @@
+#include "HsvSimd.h"
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define HSV_SIMD_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// GCC and Clang need the instruction set enabled per function, MSVC always accepts the intrinsics
+#if defined(__GNUC__) || defined(__clang__)
+#define HSV_TARGET(isa) __attribute__((target(isa)))
+#else
+#define HSV_TARGET(isa)
+#endif
+
+SimdLevel detectSimdLevel() {
+#ifdef HSV_SIMD_X86
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    const int maxLeaf = info[0];
+
+    __cpuid(info, 1);
+    const bool sse41 = (info[2] & (1 << 19)) != 0;
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx = (info[2] & (1 << 28)) != 0;
+
+    // AVX registers are only usable if the operating system saves them on context switches
+    bool avx2 = false;
+    if (maxLeaf >= 7 && avx && osxsave && (_xgetbv(0) & 0x6) == 0x6) {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+    }
+#else
+    __builtin_cpu_init();
+    const bool sse41 = __builtin_cpu_supports("sse4.1");
+    const bool avx2 = __builtin_cpu_supports("avx2");
+#endif
+    if (avx2)
+        return SimdLevel::AVX2;
+    if (sse41)
+        return SimdLevel::SSE41;
+#endif
+    return SimdLevel::Scalar;
+}
+
+const char* simdLevelName(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::AVX2:
+            return "AVX2";
+        case SimdLevel::SSE41:
+            return "SSE4.1";
+        default:
+            return "Scalar";
+    }
+}
+
+#ifdef HSV_SIMD_X86
+
+// Same operations in the same order as rgbToHsvCPU. Divisions stay divisions instead of
+// reciprocal multiplications and no FMA is enabled, so every lane rounds like the scalar code
+static inline HSV_TARGET("sse4.1") __m128i hsvSSE41(__m128 r, __m128 g, __m128 b) {
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 scale = _mm_set1_ps(255.0f);
+
+    // Normalized to the range [0, 1]
+    __m128 red = _mm_div_ps(r, scale);
+    __m128 green = _mm_div_ps(g, scale);
+    __m128 blue = _mm_div_ps(b, scale);
+
+    __m128 maxVal = _mm_max_ps(red, _mm_max_ps(green, blue));
+    __m128 minVal = _mm_min_ps(red, _mm_min_ps(green, blue));
+    __m128 delta = _mm_sub_ps(maxVal, minVal);
+
+    // All three hue candidates, the branches of the scalar code become blends
+    __m128 sixty = _mm_set1_ps(60.0f);
+    __m128 hueRed = _mm_mul_ps(sixty, _mm_div_ps(_mm_sub_ps(green, blue), delta));
+    __m128 hueGreen = _mm_add_ps(_mm_mul_ps(sixty, _mm_div_ps(_mm_sub_ps(blue, red), delta)), _mm_set1_ps(120.0f));
+    __m128 hueBlue = _mm_add_ps(_mm_mul_ps(sixty, _mm_div_ps(_mm_sub_ps(red, green), delta)), _mm_set1_ps(240.0f));
+
+    __m128 h = hueBlue;
+    h = _mm_blendv_ps(h, hueGreen, _mm_cmpeq_ps(maxVal, green));
+    h = _mm_blendv_ps(h, hueRed, _mm_cmpeq_ps(maxVal, red));
+    h = _mm_andnot_ps(_mm_cmpeq_ps(delta, zero), h);
+    h = _mm_add_ps(h, _mm_and_ps(_mm_cmplt_ps(h, zero), _mm_set1_ps(360.0f)));
+
+    __m128 s = _mm_andnot_ps(_mm_cmpeq_ps(maxVal, zero), _mm_div_ps(delta, maxVal));
+
+    // Converting HSV to OpenCV Format, truncating like static_cast<uchar>
+    __m128i hue = _mm_cvttps_epi32(_mm_mul_ps(h, _mm_set1_ps(0.5f)));
+    __m128i saturation = _mm_cvttps_epi32(_mm_mul_ps(s, scale));
+    __m128i value = _mm_cvttps_epi32(_mm_mul_ps(maxVal, scale));
+
+    // One pixel per 32-bit lane: h | s << 8 | v << 16
+    return _mm_or_si128(hue, _mm_or_si128(_mm_slli_epi32(saturation, 8), _mm_slli_epi32(value, 16)));
+}
+
+static inline HSV_TARGET("avx2") __m256i hsvAVX2(__m256 r, __m256 g, __m256 b) {
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 scale = _mm256_set1_ps(255.0f);
+
+    // Normalized to the range [0, 1]
+    __m256 red = _mm256_div_ps(r, scale);
+    __m256 green = _mm256_div_ps(g, scale);
+    __m256 blue = _mm256_div_ps(b, scale);
+
+    __m256 maxVal = _mm256_max_ps(red, _mm256_max_ps(green, blue));
+    __m256 minVal = _mm256_min_ps(red, _mm256_min_ps(green, blue));
+    __m256 delta = _mm256_sub_ps(maxVal, minVal);
+
+    // All three hue candidates, the branches of the scalar code become blends
+    __m256 sixty = _mm256_set1_ps(60.0f);
+    __m256 hueRed = _mm256_mul_ps(sixty, _mm256_div_ps(_mm256_sub_ps(green, blue), delta));
+    __m256 hueGreen = _mm256_add_ps(_mm256_mul_ps(sixty, _mm256_div_ps(_mm256_sub_ps(blue, red), delta)), _mm256_set1_ps(120.0f));
+    __m256 hueBlue = _mm256_add_ps(_mm256_mul_ps(sixty, _mm256_div_ps(_mm256_sub_ps(red, green), delta)), _mm256_set1_ps(240.0f));
+
+    __m256 h = hueBlue;
+    h = _mm256_blendv_ps(h, hueGreen, _mm256_cmp_ps(maxVal, green, _CMP_EQ_OQ));
+    h = _mm256_blendv_ps(h, hueRed, _mm256_cmp_ps(maxVal, red, _CMP_EQ_OQ));
+    h = _mm256_andnot_ps(_mm256_cmp_ps(delta, zero, _CMP_EQ_OQ), h);
+    h = _mm256_add_ps(h, _mm256_and_ps(_mm256_cmp_ps(h, zero, _CMP_LT_OQ), _mm256_set1_ps(360.0f)));
+
+    __m256 s = _mm256_andnot_ps(_mm256_cmp_ps(maxVal, zero, _CMP_EQ_OQ), _mm256_div_ps(delta, maxVal));
+
+    // Converting HSV to OpenCV Format, truncating like static_cast<uchar>
+    __m256i hue = _mm256_cvttps_epi32(_mm256_mul_ps(h, _mm256_set1_ps(0.5f)));
+    __m256i saturation = _mm256_cvttps_epi32(_mm256_mul_ps(s, scale));
+    __m256i value = _mm256_cvttps_epi32(_mm256_mul_ps(maxVal, scale));
+
+    // One pixel per 32-bit lane: h | s << 8 | v << 16
+    return _mm256_or_si256(hue, _mm256_or_si256(_mm256_slli_epi32(saturation, 8), _mm256_slli_epi32(value, 16)));
+}
+
+// Write the 12 valid bytes of 4 packed pixels without touching the bytes behind them,
+// which may belong to a row band of another thread
+static inline HSV_TARGET("sse4.1") void storePixels12(uchar* output, __m128i packed) {
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(output), packed);
+    int last = _mm_extract_epi32(packed, 2);
+    std::memcpy(output + 8, &last, sizeof(last));
+}
+
+HSV_TARGET("sse4.1") int rgbToHsvRowSSE41(const uchar* input, uchar* output, int width) {
+    // Spread the bytes of 4 interleaved pixels into one 32-bit lane per pixel and channel
+    const __m128i shuffleR = _mm_setr_epi8(0, -1, -1, -1, 3, -1, -1, -1, 6, -1, -1, -1, 9, -1, -1, -1);
+    const __m128i shuffleG = _mm_setr_epi8(1, -1, -1, -1, 4, -1, -1, -1, 7, -1, -1, -1, 10, -1, -1, -1);
+    const __m128i shuffleB = _mm_setr_epi8(2, -1, -1, -1, 5, -1, -1, -1, 8, -1, -1, -1, 11, -1, -1, -1);
+    const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+    // Every step loads 16 bytes but only uses 12, stop before that reads past the row
+    int j = 0;
+    for (; j + 6 <= width; j += 4) {
+        __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + j * 3));
+
+        __m128 r = _mm_cvtepi32_ps(_mm_shuffle_epi8(pixels, shuffleR));
+        __m128 g = _mm_cvtepi32_ps(_mm_shuffle_epi8(pixels, shuffleG));
+        __m128 b = _mm_cvtepi32_ps(_mm_shuffle_epi8(pixels, shuffleB));
+
+        storePixels12(output + j * 3, _mm_shuffle_epi8(hsvSSE41(r, g, b), pack));
+    }
+    return j;
+}
+
+HSV_TARGET("avx2") int rgbToHsvRowAVX2(const uchar* input, uchar* output, int width) {
+    // Same shuffles as the SSE4.1 version, applied to 4 pixels in each 128-bit half
+    const __m256i shuffleR = _mm256_setr_epi8(
+        0, -1, -1, -1, 3, -1, -1, -1, 6, -1, -1, -1, 9, -1, -1, -1,
+        0, -1, -1, -1, 3, -1, -1, -1, 6, -1, -1, -1, 9, -1, -1, -1);
+    const __m256i shuffleG = _mm256_setr_epi8(
+        1, -1, -1, -1, 4, -1, -1, -1, 7, -1, -1, -1, 10, -1, -1, -1,
+        1, -1, -1, -1, 4, -1, -1, -1, 7, -1, -1, -1, 10, -1, -1, -1);
+    const __m256i shuffleB = _mm256_setr_epi8(
+        2, -1, -1, -1, 5, -1, -1, -1, 8, -1, -1, -1, 11, -1, -1, -1,
+        2, -1, -1, -1, 5, -1, -1, -1, 8, -1, -1, -1, 11, -1, -1, -1);
+    const __m256i pack = _mm256_setr_epi8(
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1,
+        0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+
+    // The upper half is loaded from byte 12, so a step reads up to 28 bytes
+    int j = 0;
+    for (; j + 10 <= width; j += 8) {
+        const uchar* source = input + j * 3;
+        __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source));
+        __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + 12));
+        __m256i pixels = _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+
+        __m256 r = _mm256_cvtepi32_ps(_mm256_shuffle_epi8(pixels, shuffleR));
+        __m256 g = _mm256_cvtepi32_ps(_mm256_shuffle_epi8(pixels, shuffleG));
+        __m256 b = _mm256_cvtepi32_ps(_mm256_shuffle_epi8(pixels, shuffleB));
+
+        __m256i packed = _mm256_shuffle_epi8(hsvAVX2(r, g, b), pack);
+        storePixels12(output + j * 3, _mm256_castsi256_si128(packed));
+        storePixels12(output + j * 3 + 12, _mm256_extracti128_si256(packed, 1));
+    }
+    return j;
+}
+
+#else
+
+int rgbToHsvRowSSE41(const uchar*, uchar*, int) {
+    return 0;
+}
+
+int rgbToHsvRowAVX2(const uchar*, uchar*, int) {
+    return 0;
+}
+
+#endif
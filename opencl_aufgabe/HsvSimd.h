@@ -0,0 +1,24 @@
+#ifndef HSV_SIMD_H
+#define HSV_SIMD_H
+
+#include <opencv2/opencv.hpp>
+
+// Instruction sets the CPU HSV conversion can use, ordered from slowest to fastest
+enum class SimdLevel {
+    Scalar,
+    SSE41,
+    AVX2
+};
+
+// Highest level supported by the running CPU and operating system
+SimdLevel detectSimdLevel();
+const char* simdLevelName(SimdLevel level);
+
+// Convert the leading pixels of one row of 3-channel bytes to HSV bytes in a single pass.
+// The math is the same sequence of float operations as CpuImageProcessing::rgbToHsvCPU,
+// so the output bytes are identical. Return how many pixels were converted, the remaining
+// tail (fewer than one vector) is left to the scalar code
+int rgbToHsvRowSSE41(const uchar* input, uchar* output, int width);
+int rgbToHsvRowAVX2(const uchar* input, uchar* output, int width);
+
+#endif // HSV_SIMD_H
@@ -0,0 +1,131 @@
+#include "ImagePipeline.h"
+#include <sstream>
+#include "ImageProcessorInterface.h"
+
+ImagePipeline& ImagePipeline::rgbToHsv() {
+    ops.push_back({ OpType::RgbToHsv, 0, 0.0 });
+    plan();
+    return *this;
+}
+
+ImagePipeline& ImagePipeline::boxBlur(int kernelSize) {
+    ops.push_back({ OpType::BoxBlur, kernelSize, 0.0 });
+    plan();
+    return *this;
+}
+
+ImagePipeline& ImagePipeline::gaussianBlur(double sigma) {
+    ops.push_back({ OpType::GaussianBlur, 0, sigma });
+    plan();
+    return *this;
+}
+
+const std::vector<ImagePipeline::Operation>& ImagePipeline::operations() const {
+    return ops;
+}
+
+bool ImagePipeline::empty() const {
+    return ops.empty();
+}
+
+const std::vector<ImagePipeline::Stage>& ImagePipeline::stages() const {
+    return planned;
+}
+
+void ImagePipeline::plan() {
+    planned.clear();
+
+    // Point operations in front of the first stencil are applied to the rows it reads, every
+    // other point operation to the rows the stencil before it writes
+    std::vector<Operation> pending;
+    for (const Operation& op : ops) {
+        if (op.isPoint()) {
+            if (planned.empty())
+                pending.push_back(op);
+            else
+                planned.back().after.push_back(op);
+            continue;
+        }
+
+        Stage stage;
+        stage.before.swap(pending);
+        stage.hasStencil = true;
+        stage.stencil = op;
+        planned.push_back(stage);
+    }
+
+    // Only point operations: a single pass without stencil
+    if (planned.empty() && !pending.empty()) {
+        Stage stage;
+        stage.before.swap(pending);
+        planned.push_back(stage);
+    }
+}
+
+static std::string describeOperation(const ImagePipeline::Operation& op) {
+    std::ostringstream text;
+    switch (op.type) {
+        case ImagePipeline::OpType::RgbToHsv:
+            text << "hsv";
+            break;
+        case ImagePipeline::OpType::BoxBlur:
+            text << "box(" << op.kernelSize << ")";
+            break;
+        case ImagePipeline::OpType::GaussianBlur:
+            text << "gaussian(" << op.sigma << ")";
+            break;
+    }
+    return text.str();
+}
+
+std::string ImagePipeline::describe() const {
+    std::ostringstream text;
+    for (size_t i = 0; i < planned.size(); i++) {
+        const Stage& stage = planned[i];
+        std::vector<std::string> parts;
+        for (const Operation& op : stage.before)
+            parts.push_back(describeOperation(op));
+        if (stage.hasStencil)
+            parts.push_back(describeOperation(stage.stencil));
+        for (const Operation& op : stage.after)
+            parts.push_back(describeOperation(op));
+
+        text << (i > 0 ? " [" : "[");
+        for (size_t j = 0; j < parts.size(); j++)
+            text << (j > 0 ? " > " : "") << parts[j];
+        text << "]";
+    }
+    return text.str();
+}
+
+void ImagePipeline::runUnfused(ImageProcessorInterface& backend, const cv::Mat& input, cv::Mat& output) const {
+    if (ops.empty()) {
+        input.copyTo(output);
+        return;
+    }
+
+    // Every operation reads the previous result. The targets alternate so that the last one
+    // writes into the output, and no operation reads and writes the same image
+    const cv::Mat source = input.data == output.data ? input.clone() : input;
+    cv::Mat scratch;
+    cv::Mat* targets[2] = { &output, &scratch };
+    const cv::Mat* current = &source;
+    const int count = static_cast<int>(ops.size());
+
+    for (int i = 0; i < count; i++) {
+        cv::Mat* target = targets[(count - 1 - i) % 2];
+        const Operation& op = ops[i];
+        switch (op.type) {
+            case OpType::RgbToHsv:
+                backend.rgbToHsv(*current, *target);
+                break;
+            case OpType::BoxBlur:
+                backend.boxBlur(*current, *target, op.kernelSize);
+                break;
+            case OpType::GaussianBlur:
+                backend.gaussianBlur(*current, *target, op.sigma);
+                break;
+        }
+        current = target;
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef IMAGE_PIPELINE_H
+#define IMAGE_PIPELINE_H
+
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+class ImageProcessorInterface;
+
+// A chain of operations that is declared once and planned into passes over the image.
+// Point operations only look at one pixel and are fused into the neighbouring stencil pass,
+// stencils read a window around every pixel and get a pass of their own. Backends run every
+// pass in one go, so only the images between stencils are kept and point operations work on
+// line buffers
+class ImagePipeline {
+public:
+    enum class OpType {
+        RgbToHsv,
+        BoxBlur,
+        GaussianBlur
+    };
+
+    struct Operation {
+        OpType type;
+        int kernelSize;
+        double sigma;
+
+        bool isPoint() const { return type == OpType::RgbToHsv; }
+    };
+
+    // One pass: the point operations before the stencil are applied to every row the stencil
+    // reads, those after it to every row it writes. Without a stencil the pass only applies
+    // the point operations in before
+    struct Stage {
+        std::vector<Operation> before;
+        bool hasStencil = false;
+        Operation stencil{ OpType::BoxBlur, 0, 0.0 };
+        std::vector<Operation> after;
+    };
+
+    ImagePipeline& rgbToHsv();
+    ImagePipeline& boxBlur(int kernelSize);
+    ImagePipeline& gaussianBlur(double sigma);
+
+    const std::vector<Operation>& operations() const;
+    bool empty() const;
+
+    // Passes of the planned pipeline, planned again after every change
+    const std::vector<Stage>& stages() const;
+
+    // e.g. "[hsv > box(10)] [box(3) > hsv]"
+    std::string describe() const;
+
+    // Runs the passes one operation at a time through the backend, alternating between the
+    // output and one scratch image. Backends without fused passes use this
+    void runUnfused(ImageProcessorInterface& backend, const cv::Mat& input, cv::Mat& output) const;
+
+private:
+    std::vector<Operation> ops;
+    std::vector<Stage> planned;
+
+    void plan();
+};
+
+#endif // IMAGE_PIPELINE_H
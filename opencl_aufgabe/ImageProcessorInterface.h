@@ -6,6 +6,7 @@
 #include <opencv2/opencv.hpp>
 #include <fstream>
 #include <iostream>
+#include "ImagePipeline.h"
 
 class ImageProcessorInterface {
 public:
@@ -14,6 +15,8 @@ public:
     virtual void execute(std::vector<std::string>& files, std::string& path) = 0;
     virtual void rgbToHsv(const cv::Mat& input, cv::Mat& output) = 0;
     virtual void boxBlur(const cv::Mat& input, cv::Mat& output, int kernelSize) = 0;
+    virtual void gaussianBlur(const cv::Mat& input, cv::Mat& output, double sigma) = 0;
+    virtual void runPipeline(const ImagePipeline& pipeline, const cv::Mat& input, cv::Mat& output) = 0;
     virtual void runtime(std::vector<std::string>& files, std::string& path, int num_runs) = 0;
 };
 
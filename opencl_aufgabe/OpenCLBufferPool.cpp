@@ -0,0 +1,136 @@
+#include "OpenCLBufferPool.h"
+#include <algorithm>
+
+OpenCLBufferPool::OpenCLBufferPool() : stats{ 0, 0, 0, 0, 0 }, memoryCap(SIZE_MAX), useCounter(0) {}
+
+void OpenCLBufferPool::setContext(const cl::Context& context) {
+    this->context = context;
+}
+
+void OpenCLBufferPool::setQueues(const cl::CommandQueue& computeQueue, const cl::CommandQueue& transferQueue) {
+    this->computeQueue = computeQueue;
+    this->transferQueue = transferQueue;
+}
+
+void OpenCLBufferPool::setMemoryCap(size_t bytes) {
+    memoryCap = bytes;
+    evictFor(0);
+}
+
+size_t OpenCLBufferPool::getMemoryCap() const {
+    return memoryCap;
+}
+
+cl::Buffer OpenCLBufferPool::acquire(size_t size, cl_mem_flags flags) {
+    // Prefer a free buffer with exactly the same size and flags that has no pending fences
+    Entry* fenced = nullptr;
+    for (Entry& entry : entries) {
+        if (entry.inUse || entry.size != size || entry.flags != flags)
+            continue;
+
+        bool passed = true;
+        for (const cl::Event& fence : entry.fences) {
+            if (fence.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>() > CL_COMPLETE)
+                passed = false;
+        }
+        if (passed)
+            return handOut(entry);
+        if (fenced == nullptr || entry.lastUse < fenced->lastUse)
+            fenced = &entry;
+    }
+
+    // Letting the compute queue wait for the transfers of a matching buffer is cheaper than
+    // allocating another one, and it keeps the number of buffers at the steady state. The
+    // transfer queue is in order, a later transfer runs after them anyway
+    if (fenced != nullptr) {
+        computeQueue.enqueueBarrierWithWaitList(&fenced->fences);
+        return handOut(*fenced);
+    }
+
+    // Make room for the new buffer, then allocate it on the device
+    ++stats.misses;
+    evictFor(size);
+
+    entries.push_back({ cl::Buffer(context, flags, size), size, flags, true, ++useCounter, false });
+    stats.bytesHeld += size;
+    stats.peakBytesHeld = std::max(stats.peakBytesHeld, stats.bytesHeld);
+    return entries.back().buffer;
+}
+
+cl::Buffer OpenCLBufferPool::handOut(Entry& entry) {
+    entry.inUse = true;
+    entry.lastUse = ++useCounter;
+    entry.fences.clear();
+    ++stats.hits;
+    return entry.buffer;
+}
+
+void OpenCLBufferPool::release(const cl::Buffer& buffer) {
+    for (Entry& entry : entries) {
+        if (entry.buffer() != buffer())
+            continue;
+
+        entry.inUse = false;
+        entry.lastUse = ++useCounter;
+        // The markers complete once every command enqueued so far on the queue has finished.
+        // Flushing makes sure they are submitted and can complete at all. The compute marker is
+        // only waited for if the next owner uses the buffer on the transfer queue
+        computeQueue.enqueueMarkerWithWaitList(nullptr, &entry.computed);
+        computeQueue.flush();
+        if (entry.transferUse) {
+            cl::Event fence;
+            transferQueue.enqueueMarkerWithWaitList(nullptr, &fence);
+            transferQueue.flush();
+            entry.fences.push_back(fence);
+        }
+        entry.transferUse = false;
+        break;
+    }
+}
+
+void OpenCLBufferPool::markTransferUse(const cl::Buffer& buffer) {
+    for (Entry& entry : entries) {
+        if (entry.buffer() != buffer() || entry.transferUse)
+            continue;
+
+        entry.transferUse = true;
+        if (entry.computed() != nullptr) {
+            std::vector<cl::Event> waitCompute{ entry.computed };
+            transferQueue.enqueueBarrierWithWaitList(&waitCompute);
+            entry.computed = cl::Event();
+        }
+        break;
+    }
+}
+
+void OpenCLBufferPool::evictFor(size_t size) {
+    // Only free buffers can be evicted. Buffers still in use may keep the pool above the cap
+    while (stats.bytesHeld + size > memoryCap) {
+        auto victim = entries.end();
+        for (auto it = entries.begin(); it != entries.end(); ++it) {
+            if (!it->inUse && (victim == entries.end() || it->lastUse < victim->lastUse))
+                victim = it;
+        }
+        if (victim == entries.end())
+            break;
+
+        stats.bytesHeld -= victim->size;
+        ++stats.evictions;
+        entries.erase(victim);
+    }
+}
+
+void OpenCLBufferPool::clear() {
+    for (auto it = entries.begin(); it != entries.end();) {
+        if (it->inUse) {
+            ++it;
+            continue;
+        }
+        stats.bytesHeld -= it->size;
+        it = entries.erase(it);
+    }
+}
+
+const OpenCLBufferPool::Statistics& OpenCLBufferPool::statistics() const {
+    return stats;
+}
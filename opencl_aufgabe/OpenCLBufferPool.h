@@ -0,0 +1,91 @@
+#ifndef OPENCL_BUFFER_POOL_H
+#define OPENCL_BUFFER_POOL_H
+
+#include <CL/cl.hpp>
+#include <cstdint>
+#include <vector>
+
+// Pool of device buffers keyed by size and memory flags. Released buffers stay allocated and
+// are handed out again for the next request with the same key, so steady-state calls do not
+// allocate on the device. Free buffers are evicted least recently used first when the bytes
+// held by the pool would exceed the memory cap.
+// Commands enqueued on a buffer may still run when it is released. On the in-order compute
+// queue that is harmless, later commands run after them. Buffers the transfer queue used get a
+// marker on that queue at release, and acquire makes the compute queue wait for it instead of
+// allocating a new buffer. The transfer queue in turn waits for the commands the previous owner
+// enqueued on the compute queue when a reused buffer is marked for transfer use
+class OpenCLBufferPool {
+public:
+    struct Statistics {
+        size_t hits;
+        size_t misses;
+        size_t evictions;
+        size_t bytesHeld;
+        size_t peakBytesHeld;
+    };
+
+    OpenCLBufferPool();
+
+    void setContext(const cl::Context& context);
+    void setQueues(const cl::CommandQueue& computeQueue, const cl::CommandQueue& transferQueue);
+    void setMemoryCap(size_t bytes);
+    size_t getMemoryCap() const;
+
+    cl::Buffer acquire(size_t size, cl_mem_flags flags);
+    void release(const cl::Buffer& buffer);
+
+    // Has to be called before the buffer is used on the transfer queue. If its previous owner
+    // only used it on the compute queue, the transfer queue first waits for that queue
+    void markTransferUse(const cl::Buffer& buffer);
+
+    // Frees every buffer that is not in use
+    void clear();
+
+    const Statistics& statistics() const;
+
+private:
+    struct Entry {
+        cl::Buffer buffer;
+        size_t size;
+        cl_mem_flags flags;
+        bool inUse;
+        uint64_t lastUse;
+        // Used on the transfer queue since it was acquired
+        bool transferUse;
+        // Transfer queue marker enqueued at release, pending until it completed
+        std::vector<cl::Event> fences;
+        // Compute queue marker enqueued at release, covers the commands of the previous owner
+        cl::Event computed;
+    };
+
+    cl::Context context;
+    cl::CommandQueue computeQueue;
+    cl::CommandQueue transferQueue;
+    std::vector<Entry> entries;
+    Statistics stats;
+    size_t memoryCap;
+    uint64_t useCounter;
+
+    void evictFor(size_t size);
+    cl::Buffer handOut(Entry& entry);
+};
+
+// Returns its buffer to the pool when it goes out of scope
+class PooledBuffer {
+public:
+    PooledBuffer(OpenCLBufferPool& pool, size_t size, cl_mem_flags flags)
+        : pool(pool), buffer(pool.acquire(size, flags)) {}
+    ~PooledBuffer() { pool.release(buffer); }
+
+    PooledBuffer(const PooledBuffer&) = delete;
+    PooledBuffer& operator=(const PooledBuffer&) = delete;
+
+    cl::Buffer& operator*() { return buffer; }
+    operator cl::Buffer&() { return buffer; }
+
+private:
+    OpenCLBufferPool& pool;
+    cl::Buffer buffer;
+};
+
+#endif // OPENCL_BUFFER_POOL_H
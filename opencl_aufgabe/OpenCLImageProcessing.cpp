@@ -1,51 +1,435 @@
 
 #include "OpenCLImageProcessing.h"
 #include "OpenCVImageProcessing.h"
+#include "HostImagePool.h"
+#include "HsvFixedPoint.h"
+#include "Trace.h"
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <future>
+#include <limits>
+#include <stdexcept>
+
+// Devices of all platforms in platform order, the index of a device in this list is the
+// index used by DeviceSelection
+static std::vector<cl::Device> enumerateDevices() {
+    std::vector<cl::Device> allDevices;
 
-OpenCLImageProcessing::OpenCLImageProcessing() {
-    cl_int status;
-
-    // Get all platforms (drivers)
     std::vector<cl::Platform> platforms;
     cl::Platform::get(&platforms);
+    for (const cl::Platform& platform : platforms) {
+        // A platform without devices reports an error and simply contributes none
+        std::vector<cl::Device> devices;
+        if (platform.getDevices(CL_DEVICE_TYPE_ALL, &devices) == CL_SUCCESS)
+            allDevices.insert(allDevices.end(), devices.begin(), devices.end());
+    }
+    return allDevices;
+}
+
+static std::string toLower(std::string text) {
+    std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return text;
+}
+
+static const char* deviceTypeName(cl_device_type type) {
+    if (type & CL_DEVICE_TYPE_GPU)
+        return "GPU";
+    if (type & CL_DEVICE_TYPE_CPU)
+        return "CPU";
+    if (type & CL_DEVICE_TYPE_ACCELERATOR)
+        return "Accelerator";
+    return "Other";
+}
+
+OpenCLImageProcessing::DeviceSelection OpenCLImageProcessing::DeviceSelection::parse(const std::string& text) {
+    DeviceSelection selection;
+    std::string value = toLower(text);
+
+    if (value.empty() || value == "auto" || value == "all")
+        return selection;
+    if (value == "gpu")
+        selection.type = CL_DEVICE_TYPE_GPU;
+    else if (value == "cpu")
+        selection.type = CL_DEVICE_TYPE_CPU;
+    else if (value == "accelerator")
+        selection.type = CL_DEVICE_TYPE_ACCELERATOR;
+    else if (std::all_of(value.begin(), value.end(), [](unsigned char c) { return std::isdigit(c) != 0; }))
+        selection.index = std::stoi(value);
+    else
+        selection.name = text;
+    return selection;
+}
+
+OpenCLImageProcessing::DeviceSelection OpenCLImageProcessing::DeviceSelection::fromEnvironment() {
+    std::string value;
+#ifdef _MSC_VER
+    char* buffer = nullptr;
+    size_t length = 0;
+    if (_dupenv_s(&buffer, &length, "OPENCL_DEVICE") == 0 && buffer != nullptr) {
+        value = buffer;
+        free(buffer);
+    }
+#else
+    const char* buffer = std::getenv("OPENCL_DEVICE");
+    if (buffer != nullptr)
+        value = buffer;
+#endif
+    return parse(value);
+}
+
+void OpenCLImageProcessing::listDevices() {
+    std::vector<cl::Device> devices = enumerateDevices();
+    for (size_t i = 0; i < devices.size(); i++) {
+        std::cout << i << ": " << devices[i].getInfo<CL_DEVICE_NAME>() << " (" 
+            << deviceTypeName(devices[i].getInfo<CL_DEVICE_TYPE>()) << ")" << std::endl;
+    }
+}
+
+cl::Device OpenCLImageProcessing::selectDevice(const DeviceSelection& selection) {
+    std::vector<cl::Device> devices = enumerateDevices();
+    if (devices.empty()) {
+        std::cerr << "No OpenCL device found!" << std::endl;
+        exit(1);
+    }
+
+    if (selection.index >= 0) {
+        if (selection.index < static_cast<int>(devices.size()))
+            return devices[selection.index];
+        std::cerr << "OpenCL device " << selection.index << " does not exist, selecting a device automatically" << std::endl;
+    }
+    else if (selection.type != CL_DEVICE_TYPE_ALL || !selection.name.empty()) {
+        std::string name = toLower(selection.name);
+        for (const cl::Device& candidate : devices) {
+            bool typeMatches = (candidate.getInfo<CL_DEVICE_TYPE>() & selection.type) != 0;
+            bool nameMatches = toLower(candidate.getInfo<CL_DEVICE_NAME>()).find(name) != std::string::npos;
+            if (typeMatches && nameMatches)
+                return candidate;
+        }
+        std::cerr << "No OpenCL device matches the selection, selecting a device automatically" << std::endl;
+    }
+
+    // Prefer a GPU, hosts without one fall back to a CPU device such as PoCL, then to anything
+    for (cl_device_type type : std::initializer_list<cl_device_type>{ CL_DEVICE_TYPE_GPU, CL_DEVICE_TYPE_CPU, CL_DEVICE_TYPE_ALL }) {
+        for (const cl::Device& candidate : devices) {
+            if (candidate.getInfo<CL_DEVICE_TYPE>() & type)
+                return candidate;
+        }
+    }
+    return devices[0];
+}
 
-    // Get default device of the default platform
-    std::vector<cl::Device> devices;
-    platforms[0].getDevices(CL_DEVICE_TYPE_GPU, &devices);
-    device = devices[0];
+OpenCLImageProcessing::OpenCLImageProcessing() 
+    : OpenCLImageProcessing(DeviceSelection::fromEnvironment()) {}
+
+OpenCLImageProcessing::OpenCLImageProcessing(const DeviceSelection& selection) 
+    : maxWorkGroupSize(0), localMemSize(0), maxMemAllocSize(0), stripMemoryBudget(0), cpuDevice(false), cpuPixelsPerItem(1), vectorPixelsPerItem(4), kernelHits(0), kernelMisses(0), 
+    blurKernel(BlurKernel::Auto), hsvMode(HsvMode::Float), gaussianPasses(GAUSSIAN_MIN_PASSES), profiling(false), memoryMode(MemoryMode::Copy), memBaseAddrAlign(1), transferStats{ 0, 0, 0 }, 
+    integralWidth(0), integralHeight(0), integralDepth(0), integralType(0), programFromCache(false), buildSeconds(0.0), 
+    specializedKernels(true), tuningEnabled(true) {
+    cl_int status;
+
+    device = selectDevice(selection);
+
+    cl_device_type device_type = device.getInfo<CL_DEVICE_TYPE>();
+    cpuDevice = (device_type & CL_DEVICE_TYPE_CPU) != 0;
+    std::cout << "Using OpenCL device: " << device.getInfo<CL_DEVICE_NAME>() << " (" << deviceTypeName(device_type) << ")" << std::endl;
+
+    // On CPU devices every work-item converts a run of pixels. The run is a multiple of the
+    // preferred char vector width, so the compiler can vectorize it without a remainder
+    cl_uint vector_width_char = 1;
+    device.getInfo(CL_DEVICE_PREFERRED_VECTOR_WIDTH_CHAR, &vector_width_char);
+    cpuPixelsPerItem = static_cast<int>(std::max<cl_uint>(vector_width_char, 1)) * 64;
+
+    // On other devices the vectorized HSV kernel converts 4 pixels per vector load, as many
+    // of them per work-item as the preferred char vector width asks for
+    vectorPixelsPerItem = static_cast<int>(std::max<cl_uint>(vector_width_char, 4) / 4 * 4);
 
     // Create the context
     context = cl::Context(device);
 
     // Create queue to which we will push commands for the device
-    commandQueue = cl::CommandQueue(context, device);
+    // Profiling is enabled so runtime can split every command into its phases
+    commandQueue = cl::CommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE);
+
+    // Second queue for host transfers, so uploads and read backs of the batch pipeline can
+    // overlap with the kernels of the compute queue
+    transferQueue = cl::CommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE);
+
+    // Device limits used for every launch, queried once
+    device.getInfo(CL_DEVICE_MAX_WORK_GROUP_SIZE, &maxWorkGroupSize);
+    device.getInfo(CL_DEVICE_LOCAL_MEM_SIZE, &localMemSize);
+
+    // Alignment a host pointer needs to be used in place, reported in bits
+    cl_uint base_addr_align_bits;
+    device.getInfo(CL_DEVICE_MEM_BASE_ADDR_ALIGN, &base_addr_align_bits);
+    memBaseAddrAlign = std::max<size_t>(base_addr_align_bits / 8, 1);
+
+    // Device buffers are recycled between calls. By default the pool may keep up to half of
+    // the global memory of the device
+    cl_ulong global_mem_size;
+    device.getInfo(CL_DEVICE_GLOBAL_MEM_SIZE, &global_mem_size);
+    bufferPool.setContext(context);
+    bufferPool.setQueues(commandQueue, transferQueue);
+    bufferPool.setMemoryCap(static_cast<size_t>(global_mem_size / 2));
+
+    // Images whose buffers exceed the largest single allocation or a quarter of the global
+    // memory are blurred in strips
+    cl_ulong max_mem_alloc_size;
+    device.getInfo(CL_DEVICE_MAX_MEM_ALLOC_SIZE, &max_mem_alloc_size);
+    maxMemAllocSize = static_cast<size_t>(max_mem_alloc_size);
+    stripMemoryBudget = static_cast<size_t>(global_mem_size / 4);
 
     // Read the kernel code file
     std::string image_kernel = read_kernel("image_kernel.cl");
+    kernelSource = image_kernel;
 
-    // A list of pairs <kernel-code, string length>
-    cl::Program::Sources sources;
-    sources.push_back({ image_kernel.c_str(), image_kernel.length() });
-
-    // Create and build the kernel-code
-    program = cl::Program(context, sources);
+    // Create and build the kernel-code. A binary from an earlier run for the same source,
+    // device and driver is loaded instead of compiling again
+    auto startBuild = std::chrono::high_resolution_clock::now();
+    program = programCache.build(context, device, image_kernel, "", status, programFromCache);
+    auto endBuild = std::chrono::high_resolution_clock::now();
+    buildSeconds = std::chrono::duration<double>(endBuild - startBuild).count();
 
-    status = program.build({ device });
     if (status != CL_SUCCESS) {
         std::cerr << "There were problems when building the kernel!" << std::endl;
         std::cerr << "Build Status: " 
-            << program.getBuildInfo<CL_PROGRAM_BUILD_STATUS>(devices[0]) << std::endl;
+            << program.getBuildInfo<CL_PROGRAM_BUILD_STATUS>(device) << std::endl;
         std::cerr << "Build Log:\t " 
-            << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(devices[0]) << std::endl;
+            << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(device) << std::endl;
         exit(1);
     }
     else {
-        std::cout << "Build successful!" << std::endl << std::endl;
+        std::cout << "Build successful! (" << (programFromCache ? "loaded from binary cache" : "built from source") 
+            << " in " << buildSeconds << " seconds)" << std::endl << std::endl;
     }
+
+    // Launch parameters found by earlier autotuning runs
+    tuningPrefix = OpenCLTuningDatabase::devicePrefix(device);
+    tuning.load();
+    if (tuning.size() > 0)
+        std::cout << "Loaded " << tuning.size() << " tuned launch configurations from " << tuning.getFileName() << std::endl;
     
 }
 
-OpenCLImageProcessing::~OpenCLImageProcessing() {}
+OpenCLImageProcessing::~OpenCLImageProcessing() {
+    // Host images still handed out keep their memory, only their buffers are dropped
+    for (auto& hostImage : hostImages) {
+        if (hostImage.second.mapped)
+            commandQueue.enqueueUnmapMemObject(hostImage.second.buffer, hostImage.second.data);
+    }
+    commandQueue.finish();
+    transferQueue.finish();
+    traceEvents();
+}
+
+cl::Kernel& OpenCLImageProcessing::getKernel(const std::string& name) {
+    auto cached = kernels.find(name);
+    if (cached != kernels.end()) {
+        ++kernelHits;
+        return cached->second;
+    }
+
+    ++kernelMisses;
+    return kernels.emplace(name, cl::Kernel(program, name.c_str())).first->second;
+}
+
+cl::Kernel& OpenCLImageProcessing::getKernel(const std::string& name, int kernelSize, int depth) {
+    const cl::Program* variant = variantProgram(kernelSize, depth);
+    if (variant == nullptr)
+        return getKernel(name);
+
+    // Kernels of a specialized program are cached under the name plus radius and channel count
+    std::string key = name + "/r" + std::to_string(kernelSize) + "c" + std::to_string(depth);
+    auto cached = kernels.find(key);
+    if (cached != kernels.end()) {
+        ++kernelHits;
+        return cached->second;
+    }
+
+    ++kernelMisses;
+    return kernels.emplace(key, cl::Kernel(*variant, name.c_str())).first->second;
+}
+
+const cl::Program* OpenCLImageProcessing::variantProgram(int kernelSize, int depth) {
+    // Radii and channel counts worth a program of their own. Each one costs a build on its
+    // first use (or a load from the binary cache), rare values are served by the generic kernels
+    static const int commonRadii[] = { 1, 2, 3, 4, 5, 7, 10, 15 };
+    static const int commonDepths[] = { 1, 3, 4 };
+
+    if (!specializedKernels
+        || std::find(std::begin(commonRadii), std::end(commonRadii), kernelSize) == std::end(commonRadii)
+        || std::find(std::begin(commonDepths), std::end(commonDepths), depth) == std::end(commonDepths))
+        return nullptr;
+
+    auto found = variantPrograms.find({ kernelSize, depth });
+    if (found == variantPrograms.end()) {
+        std::string options = "-D RADIUS=" + std::to_string(kernelSize) + " -D CHANNELS=" + std::to_string(depth);
+
+        cl_int status;
+        bool fromCache;
+        cl::Program variant = programCache.build(context, device, kernelSource, options, status, fromCache);
+        if (status != CL_SUCCESS) {
+            std::cerr << "Building the blur variant with " << options << " failed, using the generic kernels" << std::endl;
+            variant = cl::Program();
+        }
+        found = variantPrograms.emplace(std::make_pair(kernelSize, depth), variant).first;
+    }
+
+    return found->second() != nullptr ? &found->second : nullptr;
+}
+
+cl::Event* OpenCLImageProcessing::profileEvent(ProfilePhase phase) {
+    bool tracing = Trace::isEnabled();
+    if (!profiling && !tracing)
+        return nullptr;
+
+    // Without profiling nothing collects the events, the finished ones go to the trace here
+    if (!profiling && profiledEvents.size() >= 64)
+        traceEvents();
+
+    // A deque keeps the returned pointer valid while more events are recorded
+    profiledEvents.push_back({ phase, cl::Event(), tracing ? Trace::now() : 0.0, "Compute queue", std::string() });
+    return &profiledEvents.back().event;
+}
+
+cl::Event* OpenCLImageProcessing::profileEvent(const cl::Kernel& kernel) {
+    std::string name;
+    if (Trace::isEnabled())
+        name = kernel.getInfo<CL_KERNEL_FUNCTION_NAME>().c_str();
+
+    cl::Event* event = profileEvent(ProfilePhase::Kernel);
+    if (event != nullptr)
+        profiledEvents.back().name = name;
+    return event;
+}
+
+void OpenCLImageProcessing::recordEvent(ProfilePhase phase, const cl::Event& event, const char* queue) {
+    bool tracing = Trace::isEnabled();
+    if (!profiling && !tracing)
+        return;
+
+    if (!profiling && profiledEvents.size() >= 64)
+        traceEvents();
+
+    profiledEvents.push_back({ phase, event, tracing ? Trace::now() : 0.0, queue, std::string() });
+}
+
+std::array<double, 5> OpenCLImageProcessing::collectPhaseTimes() {
+    // Seconds per phase, summed over all recorded commands. Queue is the time from enqueueing
+    // to submission to the device, Launch from submission to the start of execution. Write,
+    // Kernel and Read are the execution times of the commands of that kind
+    std::array<double, 5> phaseTimes{ 0.0, 0.0, 0.0, 0.0, 0.0 };
+    std::string deviceName = Trace::isEnabled() ? getDeviceName() : std::string();
+
+    for (auto& recorded : profiledEvents) {
+        cl::Event& event = recorded.event;
+        cl_ulong queued = event.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>();
+        cl_ulong submit = event.getProfilingInfo<CL_PROFILING_COMMAND_SUBMIT>();
+        cl_ulong start = event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
+        cl_ulong end = event.getProfilingInfo<CL_PROFILING_COMMAND_END>();
+
+        phaseTimes[0] += (submit - queued) * 1e-9;
+        phaseTimes[1] += (start - submit) * 1e-9;
+        phaseTimes[2 + static_cast<int>(recorded.phase)] += (end - start) * 1e-9;
+
+        if (!deviceName.empty())
+            traceEvent(recorded, deviceName);
+    }
+
+    profiledEvents.clear();
+    return phaseTimes;
+}
+
+void OpenCLImageProcessing::traceEvents() {
+    // While profiling, collectPhaseTimes takes the events and traces them
+    if (profiling)
+        return;
+
+    std::string deviceName;
+    while (!profiledEvents.empty()) {
+        ProfiledEvent& recorded = profiledEvents.front();
+        if (recorded.event() != nullptr) {
+            cl_int status = recorded.event.getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>();
+            if (status > CL_COMPLETE)
+                break;
+
+            // Failed commands have no timestamps
+            if (status == CL_COMPLETE && Trace::isEnabled()) {
+                if (deviceName.empty())
+                    deviceName = getDeviceName();
+                traceEvent(recorded, deviceName);
+            }
+        }
+        profiledEvents.pop_front();
+    }
+}
+
+void OpenCLImageProcessing::traceEvent(const ProfiledEvent& recorded, const std::string& deviceName) {
+    static const char* phaseNames[3] = { "Write", "Kernel", "Read" };
+    const cl::Event& event = recorded.event;
+
+    Trace::deviceSpan(deviceName, recorded.queue, recorded.name.empty() ? phaseNames[static_cast<int>(recorded.phase)] : recorded.name,
+        recorded.enqueued, event.getProfilingInfo<CL_PROFILING_COMMAND_QUEUED>(), 
+        event.getProfilingInfo<CL_PROFILING_COMMAND_START>(), event.getProfilingInfo<CL_PROFILING_COMMAND_END>());
+}
+
+std::string OpenCLImageProcessing::getDeviceName() const {
+    return device.getInfo<CL_DEVICE_NAME>();
+}
+
+bool OpenCLImageProcessing::isProgramFromCache() const {
+    return programFromCache;
+}
+
+double OpenCLImageProcessing::getBuildSeconds() const {
+    return buildSeconds;
+}
+
+bool OpenCLImageProcessing::isCpuDevice() const {
+    return cpuDevice;
+}
+
+void OpenCLImageProcessing::setBufferPoolCap(size_t bytes) {
+    bufferPool.setMemoryCap(bytes);
+}
+
+void OpenCLImageProcessing::printCacheStatistics() {
+    const OpenCLBufferPool::Statistics& stats = bufferPool.statistics();
+
+    std::cout << "Buffer pool: " << stats.hits << " hits, " << stats.misses << " misses, " 
+        << stats.evictions << " evictions, " << stats.bytesHeld << " bytes held (peak " 
+        << stats.peakBytesHeld << ", cap " << bufferPool.getMemoryCap() << ")" << std::endl;
+    std::cout << "Kernel cache: " << kernelHits << " hits, " << kernelMisses << " misses, " 
+        << kernels.size() << " kernels, " << variantPrograms.size() << " specialized programs" << std::endl;
+}
+
+void OpenCLImageProcessing::setBlurKernel(BlurKernel variant) {
+    blurKernel = variant;
+}
+
+OpenCLImageProcessing::BlurKernel OpenCLImageProcessing::getBlurKernel() const {
+    return blurKernel;
+}
+
+void OpenCLImageProcessing::setSpecializedKernels(bool enabled) {
+    specializedKernels = enabled;
+}
+
+bool OpenCLImageProcessing::getSpecializedKernels() const {
+    return specializedKernels;
+}
+
+void OpenCLImageProcessing::setHsvMode(HsvMode mode) {
+    hsvMode = mode;
+}
+
+OpenCLImageProcessing::HsvMode OpenCLImageProcessing::getHsvMode() const {
+    return hsvMode;
+}
 
 std::string OpenCLImageProcessing::read_kernel(const char* filename) {
     std::ifstream kernelFile(filename);
@@ -57,103 +441,1263 @@ std::string OpenCLImageProcessing::read_kernel(const char* filename) {
     return content;
 }
 
+OpenCLImageProcessing::DeviceImage OpenCLImageProcessing::allocateDeviceImage(int width, int height, int depth, int type, cl_mem_flags flags) {
+    DeviceImage image;
+    image.width = width;
+    image.height = height;
+    image.depth = depth;
+    image.type = type;
+
+    // The handle shares ownership of the pooled buffer, so the buffer goes back to the pool
+    // together with the last handle
+    std::shared_ptr<PooledBuffer> pooled = std::make_shared<PooledBuffer>(bufferPool, image.bytes(), flags);
+    image.buffer = std::shared_ptr<cl::Buffer>(pooled, &**pooled);
+    return image;
+}
+
+void OpenCLImageProcessing::setMemoryMode(MemoryMode mode) {
+    memoryMode = mode;
+}
+
+OpenCLImageProcessing::MemoryMode OpenCLImageProcessing::getMemoryMode() const {
+    return memoryMode;
+}
+
+cv::Mat OpenCLImageProcessing::allocateHostImage(int rows, int cols, int type) {
+    size_t bytes = static_cast<size_t>(rows) * cols * CV_ELEM_SIZE(type);
+
+    // Page-aligned host memory wrapped with USE_HOST_PTR. Mapping such a buffer returns the
+    // host pointer itself, so the Mat's data pointer is the same whether it is mapped or not.
+    // The buffer covers whole cache lines, which keeps drivers from using a shadow copy
+    const size_t pageSize = 4096;
+    const size_t cacheLine = 64;
+    const size_t elementBytes = CV_ELEM_SIZE1(type);
+    size_t bufferBytes = (bytes + cacheLine - 1) / cacheLine * cacheLine;
+    cv::Mat storage(1, static_cast<int>((bufferBytes + pageSize) / elementBytes), CV_MAKETYPE(CV_MAT_DEPTH(type), 1));
+    size_t offset = (pageSize - reinterpret_cast<uintptr_t>(storage.data) % pageSize) % pageSize;
+
+    // The image is a view into the storage and shares its reference count, so the memory
+    // stays valid as long as the Mat lives, even after releaseHostImage
+    int first = static_cast<int>(offset / elementBytes);
+    cv::Mat image = storage.colRange(first, first + static_cast<int>(bytes / elementBytes)).reshape(CV_MAT_CN(type), rows);
+
+    HostMapping mapping;
+    mapping.storage = storage;
+    mapping.buffer = cl::Buffer(context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, bufferBytes, image.data);
+    mapping.data = image.data;
+    mapping.bytes = bytes;
+    mapping.mapped = true;
+    mapping.users = 0;
+
+    // The host owns the memory while the buffer is mapped
+    commandQueue.enqueueMapBuffer(mapping.buffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, bytes);
+    hostImages[image.data] = mapping;
+    return image;
+}
+
+void OpenCLImageProcessing::releaseHostImage(const cv::Mat& image) {
+    auto found = hostImages.find(image.data);
+    if (found == hostImages.end())
+        return;
+
+    if (found->second.mapped)
+        commandQueue.enqueueUnmapMemObject(found->second.buffer, found->second.data);
+    commandQueue.finish();
+    hostImages.erase(found);
+}
+
+void OpenCLImageProcessing::mapHostImage(const uchar* data) {
+    auto found = hostImages.find(data);
+    if (found == hostImages.end() || found->second.mapped)
+        return;
+
+    // Hand the memory back to the host. For a USE_HOST_PTR buffer the mapping is the host
+    // pointer the Mat already has, mapping only makes the device results visible there
+    commandQueue.enqueueMapBuffer(found->second.buffer, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, found->second.bytes,
+        nullptr, profileEvent(ProfilePhase::Read));
+    found->second.mapped = true;
+}
+
+OpenCLImageProcessing::DeviceImage OpenCLImageProcessing::wrapHostImage(const cv::Mat& image, cl_mem_flags flags) {
+    DeviceImage wrapped;
+    if (memoryMode != MemoryMode::ZeroCopy || !image.isContinuous())
+        return wrapped;
+
+    wrapped.width = image.cols;
+    wrapped.height = image.rows;
+    wrapped.depth = image.channels();
+    wrapped.type = image.type();
+    wrapped.hostData = image.data;
+
+    // Memory from allocateHostImage: the buffer is unmapped while the device uses it and
+    // mapped again when the last handle is gone or the image is downloaded
+    auto found = hostImages.find(image.data);
+    if (found != hostImages.end() && found->second.bytes == wrapped.bytes()) {
+        if (found->second.mapped) {
+            commandQueue.enqueueUnmapMemObject(found->second.buffer, found->second.data, 
+                nullptr, profileEvent(ProfilePhase::Write));
+            found->second.mapped = false;
+        }
+        ++found->second.users;
+
+        const uchar* data = found->first;
+        wrapped.buffer = std::shared_ptr<cl::Buffer>(new cl::Buffer(found->second.buffer),
+            [this, data](cl::Buffer* buffer) {
+                auto mapping = hostImages.find(data);
+                if (mapping != hostImages.end() && --mapping->second.users == 0)
+                    mapHostImage(data);
+                delete buffer;
+            });
+        wrapped.path = TransferPath::Mapped;
+        return wrapped;
+    }
+
+    // Any other Mat can be used in place if its storage meets the alignment of the device.
+    // Sizes that are whole cache lines keep the driver from falling back to a shadow copy
+    const size_t cacheLine = 64;
+    bool aligned = reinterpret_cast<uintptr_t>(image.data) % memBaseAddrAlign == 0 
+        && wrapped.bytes() % cacheLine == 0;
+    if (!aligned) {
+        wrapped.hostData = nullptr;
+        return wrapped;
+    }
+
+    wrapped.buffer = std::make_shared<cl::Buffer>(context, flags | CL_MEM_USE_HOST_PTR, wrapped.bytes(), image.data);
+    wrapped.path = TransferPath::HostPtr;
+    return wrapped;
+}
+
+void OpenCLImageProcessing::countTransfer(TransferPath path) {
+    switch (path) {
+        case TransferPath::Mapped:
+            ++transferStats.mapped;
+            break;
+        case TransferPath::HostPtr:
+            ++transferStats.hostPtr;
+            break;
+        default:
+            ++transferStats.copied;
+            break;
+    }
+}
+
+void OpenCLImageProcessing::printTransferStatistics() {
+    std::cout << "Host transfers: " << transferStats.copied << " copied, " << transferStats.hostPtr 
+        << " zero-copy with USE_HOST_PTR, " << transferStats.mapped << " zero-copy with mapped host images" << std::endl;
+}
+
+OpenCLImageProcessing::DeviceImage OpenCLImageProcessing::upload(const cv::Mat& input) {
+    // In zero-copy mode the device reads the Mat storage directly if it can
+    DeviceImage wrapped = wrapHostImage(input, CL_MEM_READ_ONLY);
+    if (wrapped.buffer) {
+        countTransfer(wrapped.path);
+        return wrapped;
+    }
+
+    // Uploaded images are only read by kernels
+    DeviceImage image = allocateDeviceImage(input.cols, input.rows, input.channels(), input.type(), CL_MEM_READ_ONLY);
+
+    // Copy data into the GPU
+    TraceSpan span("upload", "transfer");
+    commandQueue.enqueueWriteBuffer(image.data(), CL_TRUE, 0, image.bytes(), input.data, nullptr, profileEvent(ProfilePhase::Write));
+    countTransfer(TransferPath::Copy);
+    return image;
+}
+
+void OpenCLImageProcessing::download(const DeviceImage& image, cv::Mat& output) {
+    output.create(image.height, image.width, image.type);
+
+    // The results already are in the Mat storage, it only has to be handed back to the host
+    if (image.hostData != nullptr && image.hostData == output.data) {
+        if (image.path == TransferPath::Mapped) {
+            mapHostImage(image.hostData);
+        }
+        else {
+            void* mapped = commandQueue.enqueueMapBuffer(image.data(), CL_TRUE, CL_MAP_READ, 0, image.bytes(),
+                nullptr, profileEvent(ProfilePhase::Read));
+            commandQueue.enqueueUnmapMemObject(image.data(), mapped);
+        }
+        countTransfer(image.path);
+        return;
+    }
+
+    // Read the results from the device memory back into the host memory. The queue is in
+    // order, so every operation enqueued before has finished when the read returns
+    TraceSpan span("download", "transfer");
+    commandQueue.enqueueReadBuffer(image.data(), CL_TRUE, 0, image.bytes(), output.data, nullptr, profileEvent(ProfilePhase::Read));
+    countTransfer(TransferPath::Copy);
+}
+
+OpenCLImageProcessing::DeviceImage OpenCLImageProcessing::outputImage(const DeviceImage& input, cv::Mat& output) {
+    output.create(input.height, input.width, input.type);
+
+    // Kernels write straight into the output Mat in zero-copy mode if it can be wrapped
+    DeviceImage wrapped = wrapHostImage(output, CL_MEM_READ_WRITE);
+    if (wrapped.buffer)
+        return wrapped;
+    return allocateDeviceImage(input.width, input.height, input.depth, input.type);
+}
+
 void OpenCLImageProcessing::rgbToHsv(const cv::Mat& input, cv::Mat& output) {
+    DeviceImage deviceInput = upload(input);
+    DeviceImage deviceOutput = outputImage(deviceInput, output);
+    enqueueRgbToHsv(deviceInput, deviceOutput);
+    download(deviceOutput, output);
 
-    // Define the required puffer size
-    size_t bufferSize = input.total() * input.channels() * sizeof(uchar);
+    // Close the command queue
+    commandQueue.finish();
+}
 
-    // Allocate memory on device
-    cl::Buffer gpuBuffer(context, CL_MEM_READ_ONLY, bufferSize);
-    cl::Buffer outputBuffer(context, CL_MEM_WRITE_ONLY, bufferSize);
+void OpenCLImageProcessing::uploadHsvTables() {
+    // The tables are the same as on the CPU, so both backends give identical bytes
+    if (hsvSaturationTable() != nullptr)
+        return;
+
+    const HsvFixedPointTables& tables = hsvFixedPointTables();
+    hsvSaturationTable = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(tables.saturation),
+        const_cast<int*>(tables.saturation));
+    hsvHueTable = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(tables.hue),
+        const_cast<int*>(tables.hue));
+}
+
+OpenCLImageProcessing::DeviceImage OpenCLImageProcessing::rgbToHsv(const DeviceImage& input) {
+    DeviceImage output = allocateDeviceImage(input.width, input.height, input.depth, input.type);
+    enqueueRgbToHsv(input, output);
+    return output;
+}
+
+void OpenCLImageProcessing::enqueueRgbToHsv(const DeviceImage& input, const DeviceImage& output) {
+    size_t pixels = static_cast<size_t>(input.width) * input.height;
+
+    if (hsvMode == HsvMode::FixedPoint) {
+        uploadHsvTables();
+
+        // Runs of pixels per work-item, as long as on CPU devices and one vector width elsewhere
+        cl::Kernel& fixedPoint = getKernel("rgbToHsvFixedPoint");
+        LaunchConfig config = launchConfig(fixedPoint, "rgbToHsvFixedPoint", input.width, input.height, input.depth, 0,
+            { cpuDevice ? 0 : localSize1D(fixedPoint), 0, cpuDevice ? cpuPixelsPerItem : vectorPixelsPerItem });
+
+        fixedPoint.setArg(0, input.data());
+        fixedPoint.setArg(1, output.data());
+        fixedPoint.setArg(2, hsvSaturationTable);
+        fixedPoint.setArg(3, hsvHueTable);
+        fixedPoint.setArg(4, static_cast<int>(pixels));
+        fixedPoint.setArg(5, input.depth);
+        fixedPoint.setArg(6, config.perItem);
+
+        enqueueKernel1D(fixedPoint, (pixels + config.perItem - 1) / config.perItem, config.localX);
+        return;
+    }
+
+    if (cpuDevice) {
+        // Long runs of pixels per work-item, by default the runtime picks the work-group size
+        cl::Kernel& chunked = getKernel("rgbToHsvChunked");
+        LaunchConfig config = launchConfig(chunked, "rgbToHsvChunked", input.width, input.height, input.depth, 0,
+            { 0, 0, cpuPixelsPerItem });
+
+        chunked.setArg(0, input.data());
+        chunked.setArg(1, output.data());
+        chunked.setArg(2, input.width);
+        chunked.setArg(3, input.height);
+        chunked.setArg(4, input.depth);
+        chunked.setArg(5, config.perItem);
+
+        enqueueKernel1D(chunked, (pixels + config.perItem - 1) / config.perItem, config.localX);
+        return;
+    }
+
+    // Packed 3- and 4-channel images use vector loads and stores
+    if (input.depth == 3 || input.depth == 4) {
+        cl::Kernel& vector = getKernel("rgbToHsvVector");
+        LaunchConfig config = launchConfig(vector, "rgbToHsvVector", input.width, input.height, input.depth, 0,
+            { localSize1D(vector), 0, vectorPixelsPerItem });
+
+        // The kernel converts whole vectors of 4 pixels
+        int pixelsPerItem = (config.perItem + 3) / 4 * 4;
+
+        vector.setArg(0, input.data());
+        vector.setArg(1, output.data());
+        vector.setArg(2, static_cast<int>(pixels));
+        vector.setArg(3, input.depth);
+        vector.setArg(4, pixelsPerItem);
+
+        enqueueKernel1D(vector, (pixels + pixelsPerItem - 1) / pixelsPerItem, config.localX);
+        return;
+    }
 
     // Create a kernel and specify its name
-    cl::Kernel kernel(program, "rgbToHsv");
+    cl::Kernel& kernel = getKernel("rgbToHsv");
 
-    int width = input.cols;
-    int height = input.rows;
-    int depth = input.channels();
+    int width = input.width;
+    int height = input.height;
+    int depth = input.depth;
 
     // Specify the arguments of kernel function
-    kernel.setArg(0, gpuBuffer);
-    kernel.setArg(1, outputBuffer);
+    kernel.setArg(0, input.data());
+    kernel.setArg(1, output.data());
     kernel.setArg(2, width);
     kernel.setArg(3, height);
     kernel.setArg(4, depth);
 
-    // Copy data into the GPU
-    commandQueue.enqueueWriteBuffer(gpuBuffer, CL_TRUE, 0, bufferSize, input.data);
+    cl::NDRange global_size, local_size;
+    launchGeometry2D(kernel, "rgbToHsv", width, height, depth, 0, global_size, local_size);
 
-    // Set the size of our kernels. For that, first, check what is permissible by our GPU:
-    size_t max_work_group_size;
-    device.getInfo(CL_DEVICE_MAX_WORK_GROUP_SIZE, &max_work_group_size);
+    // Execute kernel
+    commandQueue.enqueueNDRangeKernel(kernel, cl::NullRange, global_size, local_size,
+        nullptr, profileEvent(kernel));
+}
 
-    // Calculate the local work size based on the square root of the maximum work group size
-    int localSize = static_cast<int>(std::floor(std::sqrtf(static_cast<float>(max_work_group_size))));
-    size_t local_size[3]{ localSize, max_work_group_size / localSize, 1 };
+size_t OpenCLImageProcessing::kernelWorkGroupLimit(const cl::Kernel& kernel) {
+    // A compiled kernel may allow fewer work-items per group than the device, e.g. because
+    // of its register or local memory use
+    size_t kernel_work_group_size = maxWorkGroupSize;
+    kernel.getWorkGroupInfo(device, CL_KERNEL_WORK_GROUP_SIZE, &kernel_work_group_size);
+    return std::max<size_t>(std::min(maxWorkGroupSize, kernel_work_group_size), 1);
+}
 
-    // Calculate the global work size to cover the entire image
-    size_t global_size[3]{
-      // Ensure that the global size is a multiple of the local size
-      std::ceil(static_cast<float>(width) / localSize) * localSize,
-      std::ceil(static_cast<float>(height) / localSize) * localSize,
-      1
+size_t OpenCLImageProcessing::preferredMultiple(const cl::Kernel& kernel) {
+    size_t preferred_multiple = 1;
+    kernel.getWorkGroupInfo(device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, &preferred_multiple);
+    return std::max<size_t>(preferred_multiple, 1);
+}
+
+size_t OpenCLImageProcessing::localSize1D(const cl::Kernel& kernel) {
+    // Largest multiple of the preferred work-group size multiple up to 256 work-items that
+    // the device and the compiled kernel allow
+    size_t limit = std::min<size_t>(kernelWorkGroupLimit(kernel), 256);
+    size_t preferred_multiple = preferredMultiple(kernel);
+    if (preferred_multiple > limit)
+        return limit;
+    return limit / preferred_multiple * preferred_multiple;
+}
+
+void OpenCLImageProcessing::launchGeometry2D(const cl::Kernel& kernel, const std::string& name, int width, int height, 
+    int depth, int radius, cl::NDRange& global, cl::NDRange& local) {
+    // Work-group of about sqrt(limit) x sqrt(limit) work-items, where the limit is what the
+    // device and the compiled kernel allow, unless a tuned size is known
+    size_t limit = kernelWorkGroupLimit(kernel);
+    size_t default_x = static_cast<size_t>(std::floor(std::sqrt(static_cast<double>(limit))));
+    LaunchConfig config = launchConfig(kernel, name, width, height, depth, radius, { default_x, limit / default_x, 0 });
+
+    size_t local_x = std::max<size_t>(config.localX, 1);
+    size_t local_y = std::max<size_t>(config.localY, 1);
+
+    // Each dimension of the global size is padded to a multiple of its own local size
+    local = cl::NDRange(local_x, local_y);
+    global = cl::NDRange((width + local_x - 1) / local_x * local_x, (height + local_y - 1) / local_y * local_y);
+}
+
+void OpenCLImageProcessing::enqueueKernel1D(cl::Kernel& kernel, size_t items, size_t localSize) {
+    // A local size of 0 leaves the work-group size to the runtime
+    if (localSize == 0) {
+        commandQueue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(items), cl::NullRange,
+            nullptr, profileEvent(kernel));
+        return;
+    }
+
+    size_t global_size = (items + localSize - 1) / localSize * localSize;
+    commandQueue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(global_size), cl::NDRange(localSize),
+        nullptr, profileEvent(kernel));
+}
+
+LaunchConfig OpenCLImageProcessing::launchConfig(const cl::Kernel& kernel, const std::string& name, int width, int height, 
+    int depth, int radius, const LaunchConfig& defaults) {
+    LaunchConfig config;
+    if (name == forcedKernel) {
+        config = forcedLaunch;
+    }
+    else if (!tuningEnabled || !tuning.find(OpenCLTuningDatabase::key(tuningPrefix, name, width, height, depth, radius), config)) {
+        return defaults;
+    }
+
+    // A file from another driver version may hold sizes this kernel does not allow anymore
+    size_t items = std::max<size_t>(config.localX, 1) * std::max<size_t>(config.localY, 1);
+    if (items > kernelWorkGroupLimit(kernel) || (defaults.localY != 0 && (config.localX == 0 || config.localY == 0)))
+        return defaults;
+
+    if (config.perItem <= 0)
+        config.perItem = defaults.perItem;
+    return config;
+}
+
+void OpenCLImageProcessing::setTuningEnabled(bool enabled) {
+    tuningEnabled = enabled;
+}
+
+std::vector<LaunchConfig> OpenCLImageProcessing::launchCandidates1D(const cl::Kernel& kernel, const std::vector<int>& perItem) {
+    // The runtime's choice and every power of two times the preferred multiple the kernel allows
+    size_t limit = kernelWorkGroupLimit(kernel);
+    std::vector<size_t> localSizes{ 0 };
+    for (size_t localSize = std::min(preferredMultiple(kernel), limit); localSize <= limit; localSize *= 2) {
+        localSizes.push_back(localSize);
+    }
+
+    std::vector<LaunchConfig> candidates;
+    for (size_t localSize : localSizes) {
+        for (int items : perItem)
+            candidates.push_back({ localSize, 0, items });
+    }
+    return candidates;
+}
+
+std::vector<LaunchConfig> OpenCLImageProcessing::launchCandidates2D(const cl::Kernel& kernel) {
+    // Powers of two in both dimensions whose product is a multiple of the preferred multiple
+    size_t limit = kernelWorkGroupLimit(kernel);
+    size_t multiple = std::min(preferredMultiple(kernel), limit);
+
+    std::vector<LaunchConfig> candidates;
+    for (size_t localX = 1; localX <= limit; localX *= 2) {
+        for (size_t localY = 1; localX * localY <= limit; localY *= 2) {
+            if ((localX * localY) % multiple == 0)
+                candidates.push_back({ localX, localY, 0 });
+        }
+    }
+    return candidates;
+}
+
+void OpenCLImageProcessing::autotune(int width, int height, int depth, int kernelSize, int repetitions) {
+    std::cout << "Autotuning " << width << "x" << height << ", " << depth << " channels, radius " << kernelSize 
+        << " on " << getDeviceName() << std::endl;
+
+    // The median needs at least one measured run after the warm-up
+    repetitions = std::max(repetitions, 1);
+
+    // Random input, only the launch parameters matter
+    cv::Mat input(height, width, CV_8UC(depth));
+    cv::randu(input, cv::Scalar::all(0), cv::Scalar::all(256));
+    DeviceImage deviceInput = upload(input);
+    DeviceImage deviceOutput = allocateDeviceImage(width, height, depth, input.type());
+    commandQueue.finish();
+
+    // The kernel under test gets the forced parameters, all others keep their built-in ones.
+    // Kernel times come from the profiling events, the median of the repetitions counts
+    // The settings are restored on every exit, a failing launch must not leave them forced
+    struct RestoreSettings {
+        OpenCLImageProcessing& processor;
+        bool profiling;
+        bool tuningEnabled;
+        ~RestoreSettings() {
+            processor.forcedKernel.clear();
+            processor.profiling = profiling;
+            processor.tuningEnabled = tuningEnabled;
+        }
+    } restoreSettings{ *this, profiling, tuningEnabled };
+    profiling = true;
+    tuningEnabled = false;
+    collectPhaseTimes();
+
+    auto measure = [&](const std::string& name, const LaunchConfig& config, const std::function<void()>& run) {
+        forcedKernel = name;
+        forcedLaunch = config;
+
+        std::vector<double> times;
+        for (int i = 0; i <= repetitions; ++i) {
+            run();
+            commandQueue.finish();
+            double kernelSeconds = collectPhaseTimes()[3];
+
+            // The first run only warms up
+            if (i > 0)
+                times.push_back(kernelSeconds);
+        }
+
+        forcedKernel.clear();
+        std::sort(times.begin(), times.end());
+        return times[times.size() / 2];
     };
 
-    // Execute kernel
-    commandQueue.enqueueNDRangeKernel(
-        kernel, cl::NullRange, cl::NDRange(global_size[0], global_size[1], global_size[2]), 
-        cl::NDRange(local_size[0], local_size[1], local_size[2]));
+    auto tune = [&](const std::string& name, const std::vector<LaunchConfig>& candidates, const std::function<void()>& run) {
+        double defaultSeconds = measure("", LaunchConfig(), run);
+
+        LaunchConfig best;
+        double bestSeconds = std::numeric_limits<double>::max();
+        for (const LaunchConfig& candidate : candidates) {
+            double seconds = measure(name, candidate, run);
+            if (seconds < bestSeconds) {
+                bestSeconds = seconds;
+                best = candidate;
+            }
+        }
+        if (candidates.empty())
+            return;
+
+        // The blur kernels are tuned per radius bucket, the HSV kernels have no radius
+        int radius = name.compare(0, 8, "rgbToHsv") == 0 ? 0 : kernelSize;
+        tuning.set(OpenCLTuningDatabase::key(tuningPrefix, name, width, height, depth, radius), best);
+        std::cout << "  " << name << ": " << defaultSeconds * 1000.0 << " ms built-in, " << bestSeconds * 1000.0 
+            << " ms with local " << best.localX;
+        if (best.localY != 0)
+            std::cout << "x" << best.localY;
+        if (best.perItem != 0)
+            std::cout << ", " << best.perItem << " per work-item";
+        std::cout << std::endl;
+    };
 
-    // Read the results from the device memory back into the host memory
-    commandQueue.enqueueReadBuffer(outputBuffer, CL_TRUE, 0, bufferSize, output.data);
+    auto hsv = [&]() { enqueueRgbToHsv(deviceInput, deviceOutput); };
+    auto separable = [&]() { 
+        enqueueBlurSeparable(deviceInput.data(), deviceOutput.data(), width, height, depth, kernelSize); 
+    };
+
+    // Only the HSV kernel of the current mode runs, so only that one can be tuned
+    const bool floatHsv = hsvMode == HsvMode::Float;
+    if (!floatHsv) {
+        const int perItem = cpuDevice ? cpuPixelsPerItem : vectorPixelsPerItem;
+        tune("rgbToHsvFixedPoint", launchCandidates1D(getKernel("rgbToHsvFixedPoint"),
+            { std::max(perItem / 4, 1), std::max(perItem / 2, 1), perItem, perItem * 2, perItem * 4 }), hsv);
+    }
+
+    if (cpuDevice) {
+        if (floatHsv)
+            tune("rgbToHsvChunked", launchCandidates1D(getKernel("rgbToHsvChunked"), 
+                { cpuPixelsPerItem / 4, cpuPixelsPerItem / 2, cpuPixelsPerItem, cpuPixelsPerItem * 2, cpuPixelsPerItem * 4 }), hsv);
+        tune("blurVertical", launchCandidates1D(getKernel("blurVertical", kernelSize, depth), { 64, 128, 256, 512, 1024 }), 
+            separable);
+    }
+    else {
+        if (floatHsv && (depth == 3 || depth == 4))
+            tune("rgbToHsvVector", launchCandidates1D(getKernel("rgbToHsvVector"), { 4, 8, 16, 32, 64 }), hsv);
+        else if (floatHsv)
+            tune("rgbToHsv", launchCandidates2D(getKernel("rgbToHsv")), hsv);
+
+        tune("blur", launchCandidates2D(getKernel("blur", kernelSize, depth)), [&]() {
+            enqueueBlurGlobal(deviceInput.data(), deviceOutput.data(), width, height, depth, kernelSize);
+        });
+
+        // Square tiles whose halo fits into local memory
+        cl::Kernel& local = getKernel("blurLocal", kernelSize, depth);
+        std::vector<LaunchConfig> tiles;
+        for (size_t tileSize = 4; tileSize * tileSize <= kernelWorkGroupLimit(local); tileSize *= 2) {
+            size_t tileSide = tileSize + 2 * kernelSize;
+            if (tileSide * tileSide * depth <= localMemSize)
+                tiles.push_back({ tileSize, tileSize, 0 });
+        }
+        tune("blurLocal", tiles, [&]() {
+            enqueueBlurLocal(deviceInput.data(), deviceOutput.data(), width, height, depth, kernelSize, localTileSize());
+        });
+
+        tune("blurHorizontal", launchCandidates2D(getKernel("blurHorizontal", kernelSize, depth)), separable);
+        tune("blurVertical", launchCandidates1D(getKernel("blurVertical", kernelSize, depth), { 8, 16, 32, 64, 128, 256 }), 
+            separable);
+    }
+
+    if (tuning.save())
+        std::cout << "Saved " << tuning.size() << " tuned launch configurations to " << tuning.getFileName() << std::endl;
+    else
+        std::cerr << "Could not write " << tuning.getFileName() << std::endl;
+}
+
+void OpenCLImageProcessing::boxBlur(const cv::Mat& input, cv::Mat& output, int kernelSize) {
+    if (needsStrips(input)) {
+        boxBlurStrips(input, output, kernelSize);
+        return;
+    }
+
+    DeviceImage deviceInput = upload(input);
+    DeviceImage deviceOutput = outputImage(deviceInput, output);
+    enqueueBoxBlur(deviceInput, deviceOutput, kernelSize);
+    download(deviceOutput, output);
 
     // Close the command queue
     commandQueue.finish();
 }
 
-void OpenCLImageProcessing::boxBlur(const cv::Mat& input, cv::Mat& output, int kernelSize) {
+void OpenCLImageProcessing::setGaussianPasses(int passes) {
+    gaussianPasses = std::max(GAUSSIAN_MIN_PASSES, std::min(passes, GAUSSIAN_MAX_PASSES));
+}
 
-    // Define the required puffer size
-    size_t bufferSize = input.total() * input.channels() * sizeof(uchar);
+int OpenCLImageProcessing::getGaussianPasses() const {
+    return gaussianPasses;
+}
 
-    // Allocate memory on device
-    cl::Buffer gpuBuffer(context, CL_MEM_READ_ONLY, bufferSize);
-    cl::Buffer outputBuffer(context, CL_MEM_WRITE_ONLY, bufferSize);
+void OpenCLImageProcessing::gaussianBlur(const cv::Mat& inputImage, cv::Mat& output, double sigma) {
+    if (needsStrips(inputImage)) {
+        // Every pass is a blur in strips, alternating between the output and a scratch
+        // image on the host so that the last pass writes into the output
+        std::vector<int> radii = gaussianBoxRadii(sigma, gaussianPasses);
+        const cv::Mat input = inputImage.data == output.data ? inputImage.clone() : inputImage;
+        output.create(input.size(), input.type());
+        if (radii.empty()) {
+            // The sampled kernel of a small sigma reads only a few rows, it runs on the host
+            gaussianKernelRows(input, output, gaussianKernelWeights(sigma), 0, input.rows);
+            return;
+        }
 
-    // Create a kernel and specify its name
-    cl::Kernel kernel(program, "blur");
+        gaussianScratch.create(input.size(), input.type());
+        cv::Mat* targets[2] = { &output, &gaussianScratch };
+        const cv::Mat* source = &input;
+        const int passes = static_cast<int>(radii.size());
+        for (int i = 0; i < passes; ++i) {
+            cv::Mat* target = targets[(passes - 1 - i) % 2];
+            boxBlurStrips(*source, *target, radii[i]);
+            source = target;
+        }
+        return;
+    }
+
+    DeviceImage deviceInput = upload(inputImage);
+    DeviceImage deviceOutput = outputImage(deviceInput, output);
+    enqueueGaussianBlur(deviceInput, deviceOutput, sigma);
+    download(deviceOutput, output);
+
+    // Close the command queue
+    commandQueue.finish();
+}
+
+void OpenCLImageProcessing::runPipeline(const ImagePipeline& pipeline, const cv::Mat& input, cv::Mat& output) {
+    if (needsStrips(input)) {
+        pipeline.runUnfused(*this, input, output);
+        return;
+    }
+
+    DeviceImage deviceInput = upload(input);
+    DeviceImage deviceResult = runPipeline(pipeline, deviceInput);
+    download(deviceResult, output);
+
+    // Close the command queue
+    commandQueue.finish();
+}
+
+OpenCLImageProcessing::DeviceImage OpenCLImageProcessing::runPipeline(const ImagePipeline& pipeline, const DeviceImage& input) {
+    // Intermediates are pooled device images that return to the pool as soon as the next
+    // stage has been enqueued
+    DeviceImage current = input;
+    auto pointOperations = [&](const std::vector<ImagePipeline::Operation>& operations) {
+        for (const ImagePipeline::Operation& op : operations) {
+            if (op.type == ImagePipeline::OpType::RgbToHsv)
+                current = rgbToHsv(current);
+        }
+    };
+
+    for (const ImagePipeline::Stage& stage : pipeline.stages()) {
+        const bool fuseHsv = stage.hasStencil && stage.stencil.type == ImagePipeline::OpType::BoxBlur
+            && stage.before.size() == 1 && stage.before[0].type == ImagePipeline::OpType::RgbToHsv;
+
+        if (fuseHsv) {
+            current = rgbToHsvBlur(current, stage.stencil.kernelSize);
+        }
+        else {
+            pointOperations(stage.before);
+            if (stage.hasStencil && stage.stencil.type == ImagePipeline::OpType::BoxBlur)
+                current = boxBlur(current, stage.stencil.kernelSize);
+            else if (stage.hasStencil)
+                current = gaussianBlur(current, stage.stencil.sigma);
+        }
+        pointOperations(stage.after);
+    }
+
+    // An empty pipeline still hands back an image of its own
+    if (current.buffer == input.buffer) {
+        DeviceImage copy = allocateDeviceImage(input.width, input.height, input.depth, input.type);
+        commandQueue.enqueueCopyBuffer(input.data(), copy.data(), 0, 0, input.bytes(),
+            nullptr, profileEvent(ProfilePhase::Kernel));
+        return copy;
+    }
+    return current;
+}
+
+void OpenCLImageProcessing::rgbToHsvBatch(const std::vector<cv::Mat>& inputs, std::vector<cv::Mat>& outputs) {
+    runBatch(inputs, outputs, -1);
+}
+
+void OpenCLImageProcessing::boxBlurBatch(const std::vector<cv::Mat>& inputs, std::vector<cv::Mat>& outputs, int kernelSize) {
+    runBatch(inputs, outputs, kernelSize);
+}
+
+void OpenCLImageProcessing::runBatch(const std::vector<cv::Mat>& inputs, std::vector<cv::Mat>& outputs, int kernelSize) {
+    const int numImages = static_cast<int>(inputs.size());
+    outputs.resize(inputs.size());
+    if (numImages == 0)
+        return;
+
+    // Table of the batch: byte offset, width, height and depth of every image, then the first
+    // pixel of every image and the total pixel count
+    std::vector<cl_int> table(5 * numImages + 1);
+    size_t dataBytes = 0;
+    size_t pixels = 0;
+    for (int i = 0; i < numImages; i++) {
+        const cv::Mat& image = inputs[i];
+        table[4 * i] = static_cast<cl_int>(dataBytes);
+        table[4 * i + 1] = image.cols;
+        table[4 * i + 2] = image.rows;
+        table[4 * i + 3] = image.channels();
+        table[4 * numImages + i] = static_cast<cl_int>(pixels);
+
+        dataBytes += image.total() * image.elemSize();
+        pixels += image.total();
+    }
+    table[5 * numImages] = static_cast<cl_int>(pixels);
+
+    // Offsets are ints on the device, and the row sums of a blur must fit into one allocation.
+    // A batch beyond that is split in halves, a single image that still does not fit takes the
+    // per-image path, which blurs in strips if needed
+    bool exceedsLimit = dataBytes * sizeof(cl_uint) > maxMemAllocSize || dataBytes * sizeof(cl_uint) > INT_MAX;
+    if (exceedsLimit && numImages == 1) {
+        if (kernelSize < 0)
+            rgbToHsv(inputs[0], outputs[0]);
+        else
+            boxBlur(inputs[0], outputs[0], kernelSize);
+        return;
+    }
+    if (exceedsLimit) {
+        std::vector<cv::Mat> first(inputs.begin(), inputs.begin() + numImages / 2);
+        std::vector<cv::Mat> second(inputs.begin() + numImages / 2, inputs.end());
+        std::vector<cv::Mat> firstOutputs, secondOutputs;
+        runBatch(first, firstOutputs, kernelSize);
+        runBatch(second, secondOutputs, kernelSize);
+
+        std::copy(firstOutputs.begin(), firstOutputs.end(), outputs.begin());
+        std::copy(secondOutputs.begin(), secondOutputs.end(), outputs.begin() + numImages / 2);
+        return;
+    }
+
+    // Table and images are packed into one host staging buffer, so the batch goes up in one
+    // transfer. The image data starts at a 64-byte boundary behind the table
+    const size_t tableBytes = table.size() * sizeof(cl_int);
+    const size_t dataOffset = (tableBytes + 63) / 64 * 64;
+    batchStaging.resize(dataOffset + dataBytes);
+    std::memcpy(batchStaging.data(), table.data(), tableBytes);
+
+    for (int i = 0; i < numImages; i++) {
+        const cv::Mat& image = inputs[i];
+        uchar* destination = batchStaging.data() + dataOffset + table[4 * i];
+        const size_t rowBytes = image.cols * image.elemSize();
+        for (int y = 0; y < image.rows; y++)
+            std::memcpy(destination + y * rowBytes, image.ptr<uchar>(y), rowBytes);
+    }
+
+    PooledBuffer staging(bufferPool, batchStaging.size(), CL_MEM_READ_ONLY);
+    PooledBuffer result(bufferPool, dataBytes, CL_MEM_READ_WRITE);
+    commandQueue.enqueueWriteBuffer(*staging, CL_FALSE, 0, batchStaging.size(), batchStaging.data(), 
+        nullptr, profileEvent(ProfilePhase::Write));
+
+    // One work-item per pixel of the whole batch
+    if (kernelSize < 0) {
+        const bool fixedPoint = hsvMode == HsvMode::FixedPoint;
+        cl::Kernel& kernel = getKernel(fixedPoint ? "rgbToHsvFixedPointBatch" : "rgbToHsvBatch");
+        kernel.setArg(0, *staging);
+        kernel.setArg(1, *result);
+        kernel.setArg(2, numImages);
+        kernel.setArg(3, static_cast<int>(dataOffset));
+        if (fixedPoint) {
+            uploadHsvTables();
+            kernel.setArg(4, hsvSaturationTable);
+            kernel.setArg(5, hsvHueTable);
+        }
+        enqueueKernel1D(kernel, pixels, localSize1D(kernel));
+    }
+    else {
+        PooledBuffer rowSums(bufferPool, dataBytes * sizeof(cl_uint), CL_MEM_READ_WRITE);
+
+        cl::Kernel& horizontal = getKernel("blurHorizontalBatch");
+        horizontal.setArg(0, *staging);
+        horizontal.setArg(1, *rowSums);
+        horizontal.setArg(2, numImages);
+        horizontal.setArg(3, static_cast<int>(dataOffset));
+        horizontal.setArg(4, kernelSize);
+        enqueueKernel1D(horizontal, pixels, localSize1D(horizontal));
+
+        cl::Kernel& vertical = getKernel("blurVerticalBatch");
+        vertical.setArg(0, *staging);
+        vertical.setArg(1, *rowSums);
+        vertical.setArg(2, *result);
+        vertical.setArg(3, numImages);
+        vertical.setArg(4, kernelSize);
+        enqueueKernel1D(vertical, pixels, localSize1D(vertical));
+    }
+
+    // One read back of the packed results, then every image gets its part
+    batchResult.resize(dataBytes);
+    commandQueue.enqueueReadBuffer(*result, CL_TRUE, 0, dataBytes, batchResult.data(), 
+        nullptr, profileEvent(ProfilePhase::Read));
+
+    for (int i = 0; i < numImages; i++) {
+        const cv::Mat& image = inputs[i];
+        outputs[i].create(image.rows, image.cols, image.type());
+        std::memcpy(outputs[i].data, batchResult.data() + table[4 * i], image.total() * image.elemSize());
+    }
+}
+
+void OpenCLImageProcessing::setStripMemoryBudget(size_t bytes) {
+    stripMemoryBudget = bytes;
+}
+
+bool OpenCLImageProcessing::needsStrips(const cv::Mat& input) const {
+    // Whole-image blur holds the input, the output and the 32-bit row sums of the separable kernel
+    size_t bytes = input.total() * input.elemSize();
+    return bytes * sizeof(cl_uint) > maxMemAllocSize || bytes * (2 + sizeof(cl_uint)) > stripMemoryBudget;
+}
+
+void OpenCLImageProcessing::boxBlurStrips(const cv::Mat& inputImage, cv::Mat& outputImage, int kernelSize) {
+    // Non-blocking uploads read the strips straight from the Mat, so its rows must be contiguous
+    cv::Mat input = inputImage.isContinuous() ? inputImage : inputImage.clone();
+    const int width = input.cols;
+    const int height = input.rows;
+    const int depth = input.channels();
+    const size_t rowBytes = static_cast<size_t>(width) * depth * sizeof(uchar);
+    outputImage.create(input.size(), input.type());
+
+    // Two input and two output strip buffers and the row sums of one strip must fit into the
+    // budget, the row sums also into a single allocation. Every strip carries kernelSize halo
+    // rows above and below, so its rows are blurred exactly like in the whole image
+    size_t budgetRows = stripMemoryBudget / (rowBytes * (2 + 2 + sizeof(cl_uint)));
+    size_t allocationRows = maxMemAllocSize / (rowBytes * sizeof(cl_uint));
+    int stripRows = static_cast<int>(std::min<size_t>({ budgetRows, allocationRows, static_cast<size_t>(height) + 2 * kernelSize })) 
+        - 2 * kernelSize;
+    if (stripRows < 1) {
+        throw std::runtime_error("A strip of " + std::to_string(2 * kernelSize + 1) + " rows of " + std::to_string(width)
+            + " pixels does not fit into the device memory budget");
+    }
+    stripRows = std::min(stripRows, height);
+
+    // A strip is uploaded before the strip above is read back, so in place the halo is still
+    // unblurred. The halo of short strips reaches further up, into rows already written back
+    if (input.data == outputImage.data && stripRows < kernelSize)
+        input = input.clone();
+    const int numStrips = (height + stripRows - 1) / stripRows;
+    const int maxStripHeight = std::min(stripRows + 2 * kernelSize, height);
+
+    // The strips cycle through two slots: while one strip is computed, the next one is uploaded
+    // and the previous one is read back on the transfer queue
+    struct Slot {
+        DeviceImage input;
+        DeviceImage output;
+        cl::Event uploaded;
+        cl::Event computed;
+        cl::Event readBack;
+    };
+
+    std::vector<Slot> slots(2);
+    for (Slot& slot : slots) {
+        slot.input = allocateDeviceImage(width, maxStripHeight, depth, input.type(), CL_MEM_READ_ONLY);
+        slot.output = allocateDeviceImage(width, maxStripHeight, depth, input.type());
+        bufferPool.markTransferUse(slot.input.data());
+        bufferPool.markTransferUse(slot.output.data());
+    }
+
+    // Output rows of strip i and the input rows it needs including the halo
+    auto stripBounds = [&](int i, int& begin, int& end, int& inputBegin, int& inputEnd) {
+        begin = i * stripRows;
+        end = std::min(begin + stripRows, height);
+        inputBegin = std::max(begin - kernelSize, 0);
+        inputEnd = std::min(end + kernelSize, height);
+    };
+
+    auto upload = [&](int i) {
+        Slot& slot = slots[i % slots.size()];
+        int begin, end, inputBegin, inputEnd;
+        stripBounds(i, begin, end, inputBegin, inputEnd);
+
+        // The slot's input buffer is free once the strip before in this slot is computed
+        std::vector<cl::Event> waitCompute;
+        if (slot.computed() != nullptr)
+            waitCompute.push_back(slot.computed);
+
+        transferQueue.enqueueWriteBuffer(slot.input.data(), CL_FALSE, 0, (inputEnd - inputBegin) * rowBytes, 
+            input.ptr<uchar>(inputBegin), waitCompute.empty() ? nullptr : &waitCompute, &slot.uploaded);
+        transferQueue.flush();
+        recordEvent(ProfilePhase::Write, slot.uploaded, "Transfer queue");
+    };
+
+    upload(0);
+    for (int i = 0; i < numStrips; i++) {
+        Slot& slot = slots[i % slots.size()];
+        int begin, end, inputBegin, inputEnd;
+        stripBounds(i, begin, end, inputBegin, inputEnd);
+
+        // The blur waits for its upload and for the read back of the strip before in this slot
+        std::vector<cl::Event> waitTransfers{ slot.uploaded };
+        if (slot.readBack() != nullptr)
+            waitTransfers.push_back(slot.readBack);
+        commandQueue.enqueueBarrierWithWaitList(&waitTransfers);
+
+        DeviceImage stripInput = slot.input;
+        DeviceImage stripOutput = slot.output;
+        stripInput.height = inputEnd - inputBegin;
+        stripOutput.height = inputEnd - inputBegin;
+        enqueueBoxBlur(stripInput, stripOutput, kernelSize);
+
+        commandQueue.enqueueMarkerWithWaitList(nullptr, &slot.computed);
+        commandQueue.flush();
+
+        // The next upload is enqueued before this read back, so the in-order transfer queue
+        // does not hold it back until this strip is computed
+        if (i + 1 < numStrips)
+            upload(i + 1);
+
+        // Only the strip's own rows are read back, the halo rows belong to its neighbours
+        std::vector<cl::Event> waitCompute{ slot.computed };
+        transferQueue.enqueueReadBuffer(slot.output.data(), CL_FALSE, (begin - inputBegin) * rowBytes, (end - begin) * rowBytes,
+            outputImage.ptr<uchar>(begin), &waitCompute, &slot.readBack);
+        transferQueue.flush();
+        recordEvent(ProfilePhase::Read, slot.readBack, "Transfer queue");
+    }
+
+    transferQueue.finish();
+}
+
+OpenCLImageProcessing::DeviceImage OpenCLImageProcessing::boxBlur(const DeviceImage& input, int kernelSize) {
+    DeviceImage output = allocateDeviceImage(input.width, input.height, input.depth, input.type);
+    enqueueBoxBlur(input, output, kernelSize);
+    return output;
+}
+
+OpenCLImageProcessing::DeviceImage OpenCLImageProcessing::gaussianBlur(const DeviceImage& input, double sigma) {
+    DeviceImage output = allocateDeviceImage(input.width, input.height, input.depth, input.type);
+    enqueueGaussianBlur(input, output, sigma);
+    return output;
+}
+
+void OpenCLImageProcessing::enqueueGaussianBlur(const DeviceImage& input, const DeviceImage& output, double sigma) {
+    std::vector<int> radii = gaussianBoxRadii(sigma, gaussianPasses);
+    if (radii.empty()) {
+        enqueueGaussianKernel(input, output, sigma);
+        return;
+    }
+
+    // The passes alternate between the output and a scratch buffer from the pool, starting
+    // with the one that makes the last pass write into the output. The scratch buffer goes
+    // back to the pool afterwards, later commands on the in-order queue reuse it safely
+    DeviceImage scratch;
+    if (radii.size() > 1)
+        scratch = allocateDeviceImage(input.width, input.height, input.depth, input.type);
+
+    const DeviceImage* targets[2] = { &output, &scratch };
+    const DeviceImage* source = &input;
+    const int passes = static_cast<int>(radii.size());
+    for (int i = 0; i < passes; ++i) {
+        const DeviceImage* target = targets[(passes - 1 - i) % 2];
+        enqueueBoxBlur(*source, *target, radii[i]);
+        source = target;
+    }
+}
 
-    int width = input.cols;
-    int height = input.rows;
-    int depth = input.channels();
+void OpenCLImageProcessing::enqueueGaussianKernel(const DeviceImage& input, const DeviceImage& output, double sigma) {
+    // Too small a sigma for the box passes: the sampled kernel, columns first into a pooled
+    // float buffer. The weights are a few floats, they are uploaded with every call
+    std::vector<float> weights = gaussianKernelWeights(sigma);
+    const int radius = static_cast<int>(weights.size()) / 2;
+    cl::Buffer weightBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, weights.size() * sizeof(float), 
+        weights.data());
+    PooledBuffer columnSums(bufferPool, input.bytes() * sizeof(cl_float), CL_MEM_READ_WRITE);
+    const cl::NDRange global(input.width, input.height);
+
+    cl::Kernel& vertical = getKernel("gaussianVertical");
+    vertical.setArg(0, input.data());
+    vertical.setArg(1, *columnSums);
+    vertical.setArg(2, input.width);
+    vertical.setArg(3, input.height);
+    vertical.setArg(4, input.depth);
+    vertical.setArg(5, radius);
+    vertical.setArg(6, weightBuffer);
+    commandQueue.enqueueNDRangeKernel(vertical, cl::NullRange, global, cl::NullRange, nullptr, profileEvent(vertical));
+
+    cl::Kernel& horizontal = getKernel("gaussianHorizontal");
+    horizontal.setArg(0, *columnSums);
+    horizontal.setArg(1, output.data());
+    horizontal.setArg(2, input.width);
+    horizontal.setArg(3, input.height);
+    horizontal.setArg(4, input.depth);
+    horizontal.setArg(5, radius);
+    horizontal.setArg(6, weightBuffer);
+    commandQueue.enqueueNDRangeKernel(horizontal, cl::NullRange, global, cl::NullRange, nullptr, profileEvent(horizontal));
+}
+
+void OpenCLImageProcessing::enqueueBoxBlur(const DeviceImage& input, const DeviceImage& output, int kernelSize) {
+    // Choose the kernel variant for this radius
+    size_t tileSize = localTileSize();
+    switch (selectBlurKernel(kernelSize, input.depth, tileSize)) {
+        case BlurKernel::LocalTile:
+            enqueueBlurLocal(input.data(), output.data(), input.width, input.height, input.depth, kernelSize, tileSize);
+            break;
+        case BlurKernel::Separable:
+            enqueueBlurSeparable(input.data(), output.data(), input.width, input.height, input.depth, kernelSize);
+            break;
+        default:
+            enqueueBlurGlobal(input.data(), output.data(), input.width, input.height, input.depth, kernelSize);
+            break;
+    }
+}
+
+OpenCLImageProcessing::DeviceImage OpenCLImageProcessing::rgbToHsvBlur(const DeviceImage& input, int kernelSize) {
+    // The fused kernel converts the tile plus halo to HSV while loading it into local memory.
+    // If that does not fit, the two operations are chained on the device instead
+    size_t tileSize = localTileSize();
+    size_t tileSide = tileSize + 2 * kernelSize;
+    size_t tileBytes = tileSide * tileSide * input.depth * sizeof(uchar);
+
+    // Local memory of CPU devices is ordinary memory, the tile would only add copies there. The
+    // fused kernel converts with the float formula, fixed-point HSV is chained as well
+    if (cpuDevice || tileBytes > localMemSize || hsvMode == HsvMode::FixedPoint) {
+        return boxBlur(rgbToHsv(input), kernelSize);
+    }
+
+    DeviceImage output = allocateDeviceImage(input.width, input.height, input.depth, input.type);
+
+    cl::Kernel& kernel = getKernel("rgbToHsvBlurLocal", kernelSize, input.depth);
+    tileSize = localTileSize(kernel);
+    tileSide = tileSize + 2 * kernelSize;
+    tileBytes = tileSide * tileSide * input.depth * sizeof(uchar);
+    kernel.setArg(0, input.data());
+    kernel.setArg(1, output.data());
+    kernel.setArg(2, input.width);
+    kernel.setArg(3, input.height);
+    kernel.setArg(4, input.depth);
+    kernel.setArg(5, kernelSize);
+    kernel.setArg(6, cl::Local(tileBytes));
+
+    // One work-group per tile, the global size is padded to whole tiles
+    size_t global_size[2]{
+      (input.width + tileSize - 1) / tileSize * tileSize,
+      (input.height + tileSize - 1) / tileSize * tileSize
+    };
+
+    commandQueue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(global_size[0], global_size[1]),
+        cl::NDRange(tileSize, tileSize),
+        nullptr, profileEvent(kernel));
+
+    return output;
+}
+
+size_t OpenCLImageProcessing::localTileSize() {
+    // Square work-groups of 16 x 16, smaller if the device does not allow that many work-items
+    size_t max_work_group_size = maxWorkGroupSize;
+
+    size_t tileSize = 16;
+    while (tileSize > 1 && tileSize * tileSize > max_work_group_size) {
+        tileSize /= 2;
+    }
+    return tileSize;
+}
+
+size_t OpenCLImageProcessing::localTileSize(const cl::Kernel& kernel) {
+    size_t kernel_work_group_size = kernelWorkGroupLimit(kernel);
+
+    size_t tileSize = localTileSize();
+    while (tileSize > 1 && tileSize * tileSize > kernel_work_group_size) {
+        tileSize /= 2;
+    }
+    return tileSize;
+}
+
+OpenCLImageProcessing::BlurKernel OpenCLImageProcessing::selectBlurKernel(int kernelSize, int depth, size_t tileSize) {
+    // The tiled kernel still reads (2r+1)^2 values per pixel, only from local memory.
+    // Beyond this radius the two passes of the separable kernel are cheaper
+    const int maxLocalTileRadius = 4;
+
+    // Tile plus halo has to fit into the local memory of the device
+    size_t tileSide = tileSize + 2 * kernelSize;
+    bool tileFits = tileSide * tileSide * depth <= localMemSize;
+
+    switch (blurKernel) {
+        case BlurKernel::Global:
+        case BlurKernel::Separable:
+            return blurKernel;
+        case BlurKernel::LocalTile:
+            return tileFits ? BlurKernel::LocalTile : BlurKernel::Separable;
+        default:
+            // The running sums of the separable kernel are what CPU devices do best
+            if (cpuDevice)
+                return BlurKernel::Separable;
+            return (tileFits && kernelSize <= maxLocalTileRadius) ? BlurKernel::LocalTile : BlurKernel::Separable;
+    }
+}
+
+void OpenCLImageProcessing::enqueueBlurGlobal(cl::Buffer& input, cl::Buffer& output, int width, int height, int depth, int kernelSize) {
+    // Create a kernel and specify its name
+    cl::Kernel& kernel = getKernel("blur", kernelSize, depth);
 
     // Specify the arguments of kernel function
-    kernel.setArg(0, gpuBuffer);
-    kernel.setArg(1, outputBuffer);
+    kernel.setArg(0, input);
+    kernel.setArg(1, output);
     kernel.setArg(2, width);
     kernel.setArg(3, height);
     kernel.setArg(4, depth);
     kernel.setArg(5, kernelSize);
 
+    // Work-group size from what is permissible by the device and the kernel
+    cl::NDRange global_size, local_size;
+    launchGeometry2D(kernel, "blur", width, height, depth, kernelSize, global_size, local_size);
+
+    // Execute kernel
+    commandQueue.enqueueNDRangeKernel(kernel, cl::NullRange, global_size, local_size,
+        nullptr, profileEvent(kernel));
+}
+
+void OpenCLImageProcessing::enqueueBlurLocal(cl::Buffer& input, cl::Buffer& output, int width, int height, int depth, 
+    int kernelSize, size_t tileSize) {
+    cl::Kernel& kernel = getKernel("blurLocal", kernelSize, depth);
+    tileSize = std::min(tileSize, localTileSize(kernel));
+
+    // A tuned tile is only taken if its halo still fits into local memory
+    LaunchConfig config = launchConfig(kernel, "blurLocal", width, height, depth, kernelSize, { tileSize, tileSize, 0 });
+    size_t tunedSide = config.localX + 2 * kernelSize;
+    if (config.localX == config.localY && tunedSide * tunedSide * depth <= localMemSize)
+        tileSize = config.localX;
+
+    // Local memory for the tile plus a halo of kernelSize pixels on every side
+    size_t tileSide = tileSize + 2 * kernelSize;
+    size_t tileBytes = tileSide * tileSide * depth * sizeof(uchar);
+
+    kernel.setArg(0, input);
+    kernel.setArg(1, output);
+    kernel.setArg(2, width);
+    kernel.setArg(3, height);
+    kernel.setArg(4, depth);
+    kernel.setArg(5, kernelSize);
+    kernel.setArg(6, cl::Local(tileBytes));
+
+    // One work-group per tile, the global size is padded to whole tiles
+    size_t global_size[2]{
+      (width + tileSize - 1) / tileSize * tileSize,
+      (height + tileSize - 1) / tileSize * tileSize
+    };
+
+    commandQueue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(global_size[0], global_size[1]),
+        cl::NDRange(tileSize, tileSize),
+        nullptr, profileEvent(kernel));
+}
+
+void OpenCLImageProcessing::enqueueBlurSeparable(cl::Buffer& input, cl::Buffer& output, int width, int height, int depth, 
+    int kernelSize) {
+    // Horizontal window sums of every pixel and channel
+    PooledBuffer rowSums(bufferPool, static_cast<size_t>(width) * height * depth * sizeof(cl_uint), CL_MEM_READ_WRITE);
+
+    // CPU devices slide the window along a whole row per work-item, GPUs sum each pixel's window
+    cl::Kernel& horizontal = getKernel(cpuDevice ? "blurHorizontalRows" : "blurHorizontal", kernelSize, depth);
+    horizontal.setArg(0, input);
+    horizontal.setArg(1, *rowSums);
+    horizontal.setArg(2, width);
+    horizontal.setArg(3, height);
+    horizontal.setArg(4, depth);
+    horizontal.setArg(5, kernelSize);
+
+    if (cpuDevice) {
+        commandQueue.enqueueNDRangeKernel(horizontal, cl::NullRange, cl::NDRange(depth, height), cl::NullRange,
+            nullptr, profileEvent(horizontal));
+    }
+    else {
+        size_t tileSize = localTileSize(horizontal);
+        LaunchConfig config = launchConfig(horizontal, "blurHorizontal", width, height, depth, kernelSize, { tileSize, tileSize, 0 });
+        size_t global_size[2]{
+          (width + config.localX - 1) / config.localX * config.localX,
+          (height + config.localY - 1) / config.localY * config.localY
+        };
+
+        commandQueue.enqueueNDRangeKernel(horizontal, cl::NullRange, cl::NDRange(global_size[0], global_size[1]),
+            cl::NDRange(config.localX, config.localY),
+            nullptr, profileEvent(horizontal));
+    }
+
+    // Every work-item of the vertical pass slides over a segment of rows. Segments of at least
+    // one window height keep the initial window sum of each segment amortized. CPU devices
+    // take longer segments, they have few cores to keep busy
+    cl::Kernel& vertical = getKernel("blurVertical", kernelSize, depth);
+    LaunchConfig config = launchConfig(vertical, "blurVertical", width, height, depth, kernelSize, { 0, 0, cpuDevice ? 256 : 32 });
+    int rowsPerItem = std::max(config.perItem, 2 * kernelSize + 1);
+    int segments = (height + rowsPerItem - 1) / rowsPerItem;
+
+    vertical.setArg(0, *rowSums);
+    vertical.setArg(1, output);
+    vertical.setArg(2, width);
+    vertical.setArg(3, height);
+    vertical.setArg(4, depth);
+    vertical.setArg(5, kernelSize);
+    vertical.setArg(6, rowsPerItem);
+
+    // Work-groups span columns of the same segments, by default the runtime picks their size
+    if (config.localX == 0) {
+        commandQueue.enqueueNDRangeKernel(vertical, cl::NullRange, cl::NDRange(width * depth, segments), cl::NullRange,
+            nullptr, profileEvent(vertical));
+    }
+    else {
+        size_t columns = (static_cast<size_t>(width) * depth + config.localX - 1) / config.localX * config.localX;
+        commandQueue.enqueueNDRangeKernel(vertical, cl::NullRange, cl::NDRange(columns, segments), cl::NDRange(config.localX, 1),
+            nullptr, profileEvent(vertical));
+    }
+}
+
+void OpenCLImageProcessing::buildIntegralImage(const cv::Mat& input) {
+    integralWidth = input.cols;
+    integralHeight = input.rows;
+    integralDepth = input.channels();
+    integralType = input.type();
+
+    // Define the required puffer sizes
+    size_t bufferSize = input.total() * input.channels() * sizeof(uchar);
+    size_t integralSize = static_cast<size_t>(integralWidth + 1) * (integralHeight + 1) * integralDepth * sizeof(cl_uint);
+
+    // Allocate memory on device, the table stays there for the following blur calls and
+    // goes back to the pool when the next table is built
+    PooledBuffer gpuBuffer(bufferPool, bufferSize, CL_MEM_READ_ONLY);
+    if (integralBuffer() != nullptr)
+        bufferPool.release(integralBuffer);
+    integralBuffer = bufferPool.acquire(integralSize, CL_MEM_READ_WRITE);
+
     // Copy data into the GPU
     commandQueue.enqueueWriteBuffer(gpuBuffer, CL_TRUE, 0, bufferSize, input.data);
 
-    // Set the size of our kernels. For that, first, check what is permissible by our GPU:
-    size_t max_work_group_size;
-    device.getInfo(CL_DEVICE_MAX_WORK_GROUP_SIZE, &max_work_group_size);
+    // First pass: one work-item per row of the table
+    cl::Kernel& rowKernel = getKernel("integralRows");
+    rowKernel.setArg(0, *gpuBuffer);
+    rowKernel.setArg(1, integralBuffer);
+    rowKernel.setArg(2, integralWidth);
+    rowKernel.setArg(3, integralHeight);
+    rowKernel.setArg(4, integralDepth);
+    commandQueue.enqueueNDRangeKernel(rowKernel, cl::NullRange, cl::NDRange(integralHeight + 1), cl::NullRange);
+
+    // Second pass: one work-item per column and channel of the table
+    cl::Kernel& columnKernel = getKernel("integralColumns");
+    columnKernel.setArg(0, integralBuffer);
+    columnKernel.setArg(1, integralWidth);
+    columnKernel.setArg(2, integralHeight);
+    columnKernel.setArg(3, integralDepth);
+    commandQueue.enqueueNDRangeKernel(columnKernel, cl::NullRange, 
+        cl::NDRange((integralWidth + 1) * integralDepth), cl::NullRange);
+
+    commandQueue.finish();
+}
+
+void OpenCLImageProcessing::boxBlurIntegral(cv::Mat& output, int kernelSize) {
+    boxBlurIntegral(output, kernelSize, kernelSize);
+}
+
+void OpenCLImageProcessing::boxBlurIntegral(cv::Mat& output, int radiusX, int radiusY) {
+    output.create(integralHeight, integralWidth, integralType);
+
+    // Define the required puffer size
+    size_t bufferSize = output.total() * output.channels() * sizeof(uchar);
+
+    // Allocate memory on device
+    PooledBuffer outputBuffer(bufferPool, bufferSize, CL_MEM_WRITE_ONLY);
+
+    // Create a kernel and specify its name
+    cl::Kernel& kernel = getKernel("blurIntegral");
+
+    // Specify the arguments of kernel function
+    kernel.setArg(0, integralBuffer);
+    kernel.setArg(1, *outputBuffer);
+    kernel.setArg(2, integralWidth);
+    kernel.setArg(3, integralHeight);
+    kernel.setArg(4, integralDepth);
+    kernel.setArg(5, radiusX);
+    kernel.setArg(6, radiusY);
+
+    // Set the size of our kernels from what is permissible by our GPU (queried once in the constructor)
+    size_t max_work_group_size = maxWorkGroupSize;
 
     int localSize = static_cast<int>(std::floor(std::sqrtf(static_cast<float>(max_work_group_size))));
     size_t local_size[3]{ localSize, max_work_group_size / localSize, 1 };
 
     size_t global_size[3]{
-      std::ceil(static_cast<float>(width) / localSize) * localSize,
-      std::ceil(static_cast<float>(height) / localSize) * localSize,
+      std::ceil(static_cast<float>(integralWidth) / localSize) * localSize,
+      std::ceil(static_cast<float>(integralHeight) / local_size[1]) * local_size[1],
       1
     };
 
     // Execute kernel
     commandQueue.enqueueNDRangeKernel(kernel, cl::NullRange, cl::NDRange(global_size[0], global_size[1], global_size[2]),
-        cl::NDRange(local_size[0], local_size[1], local_size[2]));
+        cl::NDRange(local_size[0], local_size[1], local_size[2]),
+        nullptr, profileEvent(kernel));
 
     // Read the results from the device memory back into the host memory
     commandQueue.enqueueReadBuffer(outputBuffer, CL_TRUE, 0, bufferSize, output.data);
@@ -162,17 +1706,68 @@ void OpenCLImageProcessing::boxBlur(const cv::Mat& input, cv::Mat& output, int k
     commandQueue.finish();
 }
 
+// Min, median, p95 and max of one phase over all runs
+static std::string summarizeSeconds(const std::vector<std::array<double, 5>>& runs, int phase) {
+    std::vector<double> values;
+    for (const auto& run : runs) {
+        values.push_back(run[phase]);
+    }
+    if (values.empty())
+        return "no runs";
+
+    std::sort(values.begin(), values.end());
+    auto percentile = [&values](double p) {
+        // Nearest rank
+        size_t rank = static_cast<size_t>(std::ceil(p * values.size()));
+        return values[std::max<size_t>(rank, 1) - 1];
+    };
+
+    return "min " + std::to_string(values.front()) + ", median " + std::to_string(percentile(0.5)) 
+        + ", p95 " + std::to_string(percentile(0.95)) + ", max " + std::to_string(values.back()) + " seconds";
+}
+
 void OpenCLImageProcessing::runtime(std::vector<std::string>& files, std::string& path, int num_runs) {
     // Vector to store durations
     std::vector<std::chrono::duration<double>> durationsHSV;
     std::vector<std::chrono::duration<double>> durationsBlur;
 
+    // Device-side phases of every run, from the profiling events of the commands
+    std::vector<std::array<double, 5>> phasesHSV;
+    std::vector<std::array<double, 5>> phasesBlur;
+    const char* phaseNames[5] = { "Queue", "Launch", "Write", "Kernel", "Read" };
+    profiling = true;
+
+    // Results are labeled with the memory mode, both modes can be written into the same file
+    std::string backend = memoryMode == MemoryMode::ZeroCopy ? "OpenCL Zero-Copy" : "OpenCL";
+
     for (int i = 0; i < files.size(); i++) {
+        // In zero-copy mode the images live in host memory the device can use directly
+        cv::Mat hostInput;
+        cv::Mat hostHSV;
+        cv::Mat hostBlurred;
+        TransferStatistics transfersBefore = transferStats;
 
         for (int j = 0; j < num_runs; ++j) {
             cv::Mat inputImage = cv::imread(path + files.at(i), cv::IMREAD_UNCHANGED);
-            cv::Mat hsvImage = cv::Mat::zeros(inputImage.size(), inputImage.type());
-            cv::Mat blurredImage = cv::Mat::zeros(inputImage.size(), inputImage.type());
+            cv::Mat hsvImage = HostImagePool::instance().image(inputImage.size(), inputImage.type());
+            cv::Mat blurredImage = HostImagePool::instance().image(inputImage.size(), inputImage.type());
+
+            if (memoryMode == MemoryMode::ZeroCopy) {
+                if (hostInput.empty()) {
+                    hostInput = allocateHostImage(inputImage.rows, inputImage.cols, inputImage.type());
+                    hostHSV = allocateHostImage(inputImage.rows, inputImage.cols, inputImage.type());
+                    hostBlurred = allocateHostImage(inputImage.rows, inputImage.cols, inputImage.type());
+                }
+
+                // Stands in for decoding straight into the mapped memory, outside the measurement
+                inputImage.copyTo(hostInput);
+                inputImage = hostInput;
+                hsvImage = hostHSV;
+                blurredImage = hostBlurred;
+            }
+
+            // Commands enqueued while preparing the images do not belong to the measurement
+            collectPhaseTimes();
 
             // Record the starting time
             auto startHSV = std::chrono::high_resolution_clock::now();
@@ -184,6 +1779,7 @@ void OpenCLImageProcessing::runtime(std::vector<std::string>& files, std::string
 
             // Calculate the duration and add it to the vector
             durationsHSV.push_back(endHSV - startHSV);
+            phasesHSV.push_back(collectPhaseTimes());
             
             // Record the starting time
             auto startBlur = std::chrono::high_resolution_clock::now();
@@ -195,7 +1791,7 @@ void OpenCLImageProcessing::runtime(std::vector<std::string>& files, std::string
            
             // Calculate the duration and add it to the vector
             durationsBlur.push_back(endBlur - startBlur);
-            
+            phasesBlur.push_back(collectPhaseTimes());
         }
 
         // Calculate the total duration
@@ -217,7 +1813,7 @@ void OpenCLImageProcessing::runtime(std::vector<std::string>& files, std::string
         std::ofstream myfile;
         myfile.open("runtimeEvaluation.txt", std::fstream::app);
 
-        std::string notifyHsvRuntime = "Average Runtime HSV With OpenCL, Picture " + std::to_string(i + 1) + ": " + std::to_string(average_duration) + " seconds\n";
+        std::string notifyHsvRuntime = "Average Runtime HSV With " + backend + ", Picture " + std::to_string(i + 1) + ": " + std::to_string(average_duration) + " seconds\n";
 
         // Output the average duration
         std::cout << notifyHsvRuntime;
@@ -225,15 +1821,49 @@ void OpenCLImageProcessing::runtime(std::vector<std::string>& files, std::string
 
         average_duration = total_duration_blur .count() / num_runs;
 
-        std::string notifyBlurRuntime = "Average Runtime Blur With OpenCL, Picture " + std::to_string(i + 1) + ": " + std::to_string(average_duration) + " seconds\n";
+        std::string notifyBlurRuntime = "Average Runtime Blur With " + backend + ", Picture " + std::to_string(i + 1) + ": " + std::to_string(average_duration) + " seconds\n";
         // Output the average duration
         std::cout << notifyBlurRuntime;
         myfile << notifyBlurRuntime;
 
+        // Distribution of every phase over the runs
+        for (int phase = 0; phase < 5; phase++) {
+            std::string notifyHsvPhase = "Phase " + std::string(phaseNames[phase]) + " HSV With " + backend + ", Picture " 
+                + std::to_string(i + 1) + ": " + summarizeSeconds(phasesHSV, phase) + "\n";
+            std::string notifyBlurPhase = "Phase " + std::string(phaseNames[phase]) + " Blur With " + backend + ", Picture " 
+                + std::to_string(i + 1) + ": " + summarizeSeconds(phasesBlur, phase) + "\n";
+            std::cout << notifyHsvPhase << notifyBlurPhase;
+            myfile << notifyHsvPhase << notifyBlurPhase;
+        }
+
+        // Which path the host transfers of this picture took
+        std::string notifyTransfers = "Transfers With " + backend + ", Picture " + std::to_string(i + 1) + ": "
+            + std::to_string(transferStats.copied - transfersBefore.copied) + " copied, "
+            + std::to_string(transferStats.hostPtr - transfersBefore.hostPtr) + " USE_HOST_PTR, "
+            + std::to_string(transferStats.mapped - transfersBefore.mapped) + " mapped\n";
+        std::cout << notifyTransfers;
+        myfile << notifyTransfers;
+
+        if (!hostInput.empty()) {
+            releaseHostImage(hostInput);
+            releaseHostImage(hostHSV);
+            releaseHostImage(hostBlurred);
+        }
+
         durationsHSV.clear();
         durationsBlur.clear();
+        phasesHSV.clear();
+        phasesBlur.clear();
         myfile.close();
     }
+
+    collectPhaseTimes();
+    profiling = false;
+
+    // Steady-state calls should be served from the buffer pool and the kernel cache
+    printCacheStatistics();
+    printTransferStatistics();
+    HostImagePool::instance().printStatistics(std::cout);
 }
 
 void OpenCLImageProcessing::execute(std::vector<std::string>&files, std::string & path) {
@@ -242,56 +1872,88 @@ void OpenCLImageProcessing::execute(std::vector<std::string>&files, std::string
 
     // Process all of the images that are included in the files parameter
     for (int i = 0; i < files.size(); i++) {
+        TraceSpan imageSpan(files.at(i), "image");
+
         // Variables for original, hsv, and blurred image
-        cv::Mat inputImage = cv::imread(path + files.at(i), cv::IMREAD_UNCHANGED);
-        cv::Mat hsvImage = cv::Mat::zeros(inputImage.size(), inputImage.type());
-        cv::Mat blurImage = cv::Mat::zeros(inputImage.size(), inputImage.type());
-        cv::Mat blurHSVImage = cv::Mat::zeros(inputImage.size(), inputImage.type());
+        cv::Mat inputImage;
+        cv::Mat hsvImage;
+        cv::Mat blurImage;
+        cv::Mat blurHSVImage;
+        {
+            TraceSpan span("imread", "decode");
+            inputImage = cv::imread(path + files.at(i), cv::IMREAD_UNCHANGED);
+        }
 
-        // Convert RGB image to HSV image
-        rgbToHsv(inputImage, hsvImage);
+        // The input is uploaded once, every intermediate result stays on the device
+        DeviceImage deviceInput = upload(inputImage);
 
-        // Blur Original Image
         int kernelSize = 10;
-        boxBlur(inputImage, blurImage, kernelSize);
+        DeviceImage deviceHSV;
+        DeviceImage deviceBlur;
+        DeviceImage deviceBlurHSV;
+        {
+            // Only the enqueueing, the kernels themselves are on the device tracks
+            TraceSpan span("enqueue kernels", "compute");
+
+            // Convert RGB image to HSV image
+            deviceHSV = rgbToHsv(deviceInput);
+
+            // Blur Original Image
+            deviceBlur = boxBlur(deviceInput, kernelSize);
 
-        // Blur HSV Image
-        boxBlur(hsvImage, blurHSVImage, kernelSize);
+            // Blur HSV Image
+            deviceBlurHSV = boxBlur(deviceHSV, kernelSize);
+        }
+
+        // Only the results are read back
+        download(deviceHSV, hsvImage);
+        download(deviceBlur, blurImage);
+        download(deviceBlurHSV, blurHSVImage);
         std::cout << "Finished processing image " << i + 1 << " with OpenCL." << std::endl;
 
         // Display the results
-        cv::imshow("Original Image", inputImage);
-        cv::imshow("HSV Image", hsvImage);
-        cv::imshow("Blurred Original Image", blurImage);
-        cv::imshow("Blurred HSV Image ", blurHSVImage);
-        cv::waitKey(0);
-        cv::destroyAllWindows();
+        {
+            TraceSpan span("display results", "display");
+            cv::imshow("Original Image", inputImage);
+            cv::imshow("HSV Image", hsvImage);
+            cv::imshow("Blurred Original Image", blurImage);
+            cv::imshow("Blurred HSV Image ", blurHSVImage);
+            cv::waitKey(0);
+            cv::destroyAllWindows();
+        }
 
         // Compare the custom result with the already existing operation from OpenCV
         // Variables for hsv and blur image with OpenCV
-        cv::Mat hsvImageOpenCV = cv::Mat::zeros(inputImage.size(), inputImage.type());
-        cv::Mat blurImageOpenCV = cv::Mat::zeros(inputImage.size(), inputImage.type());
-        cv::Mat blurHSVImageOpenCV = cv::Mat::zeros(inputImage.size(), inputImage.type());
+        cv::Mat hsvImageOpenCV = HostImagePool::instance().image(inputImage.size(), inputImage.type());
+        cv::Mat blurImageOpenCV = HostImagePool::instance().image(inputImage.size(), inputImage.type());
+        cv::Mat blurHSVImageOpenCV = HostImagePool::instance().image(inputImage.size(), inputImage.type());
         
         // HSV and Blur with OpenCV
-        ocvip.rgbToHsv(inputImage, hsvImageOpenCV);
-        ocvip.boxBlur(inputImage, blurImageOpenCV, kernelSize);
-        ocvip.boxBlur(hsvImageOpenCV, blurHSVImageOpenCV, kernelSize);
+        {
+            TraceSpan span("OpenCV reference", "compute");
+            ocvip.rgbToHsv(inputImage, hsvImageOpenCV);
+            ocvip.boxBlur(inputImage, blurImageOpenCV, kernelSize);
+            ocvip.boxBlur(hsvImageOpenCV, blurHSVImageOpenCV, kernelSize);
+        }
 
         // Compare the results
-        cv::Mat diff_hsv_image = hsvImage - hsvImageOpenCV;
-        cv::Mat diff_blur_image = blurImage - blurImageOpenCV;
-        cv::Mat diff_hsv_blur_image = blurHSVImage - blurHSVImageOpenCV;
-        cv::imshow("Diff HSV Image", diff_hsv_image);
-        cv::imshow("Diff Blur Image", diff_blur_image);
-        cv::imshow("Diff HSV Blur Image", diff_hsv_blur_image);
-        cv::waitKey(0);
-        cv::destroyAllWindows();
+        {
+            TraceSpan span("display differences", "display");
+            cv::Mat diff_hsv_image = hsvImage - hsvImageOpenCV;
+            cv::Mat diff_blur_image = blurImage - blurImageOpenCV;
+            cv::Mat diff_hsv_blur_image = blurHSVImage - blurHSVImageOpenCV;
+            cv::imshow("Diff HSV Image", diff_hsv_image);
+            cv::imshow("Diff Blur Image", diff_blur_image);
+            cv::imshow("Diff HSV Blur Image", diff_hsv_blur_image);
+            cv::waitKey(0);
+            cv::destroyAllWindows();
+        }
 
         // Specify the folder path to save the images
         std::string folderPath = "Results OpenCL\\";
 
         // Create .jpg file from the result
+        TraceSpan span("imwrite", "encode");
         std::string numberingFile = std::to_string(i + 1);
         std::string hsvImageFile = folderPath + numberingFile + ".hsvImage.jpg";
         std::string blurredImageFile = folderPath + numberingFile + ".blurredImage.jpg";
@@ -300,4 +1962,149 @@ void OpenCLImageProcessing::execute(std::vector<std::string>&files, std::string
         cv::imwrite(blurredImageFile, blurImage);
         cv::imwrite(blurredHSVImageFile, blurHSVImage);
     }
-}
\ No newline at end of file
+}
+
+void OpenCLImageProcessing::streamBatch(std::vector<std::string>& files, std::string& path, int kernelSize) {
+    // Everything one image needs while it moves through the pipeline. Host images and device
+    // handles stay in the slot until the slot is reused, so non-blocking transfers always
+    // see valid memory
+    struct Slot {
+        cv::Mat inputImage;
+        cv::Mat hsvImage;
+        cv::Mat blurImage;
+        cv::Mat blurHSVImage;
+        DeviceImage deviceInput;
+        DeviceImage deviceHSV;
+        DeviceImage deviceBlur;
+        DeviceImage deviceBlurHSV;
+        cl::Event computed;
+        std::vector<cl::Event> readBack;
+        std::future<void> encoded;
+    };
+
+    // Triple buffering: one slot is computed, one is read back and one is encoded
+    const int numSlots = 3;
+    const int decodeAhead = 2;
+    const int numFiles = static_cast<int>(files.size());
+    std::vector<Slot> slots(numSlots);
+    std::vector<std::future<cv::Mat>> decoded(numFiles);
+
+    // Specify the folder path to save the images
+    std::string folderPath = "Results OpenCL\\";
+
+    auto startDecode = [&](int i) {
+        if (i < numFiles)
+            decoded[i] = std::async(std::launch::async, [&files, &path, i]() {
+                TraceSpan span("imread " + files.at(i), "decode");
+                return cv::imread(path + files.at(i), cv::IMREAD_UNCHANGED);
+            });
+    };
+
+    // Record the starting time
+    auto start = std::chrono::high_resolution_clock::now();
+
+    for (int i = 0; i < decodeAhead; i++)
+        startDecode(i);
+
+    // Two extra iterations drain the read back and encode stages
+    for (int i = 0; i < numFiles + 2; i++) {
+        // Decode image i + 2 on a worker thread
+        startDecode(i + decodeAhead);
+
+        // Upload and compute image i
+        if (i < numFiles) {
+            Slot& slot = slots[i % numSlots];
+
+            // The slot was last used by image i - 3, its files must be written before reuse
+            if (slot.encoded.valid())
+                slot.encoded.get();
+
+            slot.inputImage = decoded[i].get();
+            const cv::Mat& inputImage = slot.inputImage;
+
+            // Non-blocking upload on the transfer queue, the compute queue waits for its event
+            cl::Event uploaded;
+            slot.deviceInput = allocateDeviceImage(inputImage.cols, inputImage.rows, inputImage.channels(), inputImage.type(), CL_MEM_READ_ONLY);
+            bufferPool.markTransferUse(slot.deviceInput.data());
+            transferQueue.enqueueWriteBuffer(slot.deviceInput.data(), CL_FALSE, 0, slot.deviceInput.bytes(), inputImage.data, nullptr, &uploaded);
+            transferQueue.flush();
+            recordEvent(ProfilePhase::Write, uploaded, "Transfer queue");
+
+            std::vector<cl::Event> waitUpload{ uploaded };
+            commandQueue.enqueueBarrierWithWaitList(&waitUpload);
+
+            slot.deviceHSV = rgbToHsv(slot.deviceInput);
+            slot.deviceBlur = boxBlur(slot.deviceInput, kernelSize);
+            slot.deviceBlurHSV = boxBlur(slot.deviceHSV, kernelSize);
+
+            commandQueue.enqueueMarkerWithWaitList(nullptr, &slot.computed);
+            commandQueue.flush();
+        }
+
+        // Read back image i - 1. It is enqueued after the upload of image i, so the in-order
+        // transfer queue does not hold that upload back until image i - 1 is computed
+        if (i >= 1 && i <= numFiles) {
+            Slot& slot = slots[(i - 1) % numSlots];
+            const DeviceImage& deviceInput = slot.deviceInput;
+
+            slot.hsvImage.create(deviceInput.height, deviceInput.width, deviceInput.type);
+            slot.blurImage.create(deviceInput.height, deviceInput.width, deviceInput.type);
+            slot.blurHSVImage.create(deviceInput.height, deviceInput.width, deviceInput.type);
+
+            std::vector<cl::Event> waitCompute{ slot.computed };
+            slot.readBack.assign(3, cl::Event());
+            bufferPool.markTransferUse(slot.deviceHSV.data());
+            bufferPool.markTransferUse(slot.deviceBlur.data());
+            bufferPool.markTransferUse(slot.deviceBlurHSV.data());
+            transferQueue.enqueueReadBuffer(slot.deviceHSV.data(), CL_FALSE, 0, deviceInput.bytes(), slot.hsvImage.data, &waitCompute, &slot.readBack[0]);
+            transferQueue.enqueueReadBuffer(slot.deviceBlur.data(), CL_FALSE, 0, deviceInput.bytes(), slot.blurImage.data, &waitCompute, &slot.readBack[1]);
+            transferQueue.enqueueReadBuffer(slot.deviceBlurHSV.data(), CL_FALSE, 0, deviceInput.bytes(), slot.blurHSVImage.data, &waitCompute, &slot.readBack[2]);
+            transferQueue.flush();
+            for (const cl::Event& readBack : slot.readBack)
+                recordEvent(ProfilePhase::Read, readBack, "Transfer queue");
+        }
+
+        // Encode image i - 2 on a worker thread once its results are on the host
+        if (i >= 2) {
+            int finished = i - 2;
+            Slot& slot = slots[finished % numSlots];
+            cl::Event::waitForEvents(slot.readBack);
+
+            // All device work of the image is done, its buffers can go back to the pool
+            slot.deviceInput = DeviceImage();
+            slot.deviceHSV = DeviceImage();
+            slot.deviceBlur = DeviceImage();
+            slot.deviceBlurHSV = DeviceImage();
+
+            slot.encoded = std::async(std::launch::async, [&slot, folderPath, finished]() {
+                // Create .jpg file from the result
+                std::string numberingFile = std::to_string(finished + 1);
+                TraceSpan span("imwrite " + numberingFile, "encode");
+                cv::imwrite(folderPath + numberingFile + ".hsvImage.jpg", slot.hsvImage);
+                cv::imwrite(folderPath + numberingFile + ".blurredImage.jpg", slot.blurImage);
+                cv::imwrite(folderPath + numberingFile + ".blurredHSVImage.jpg", slot.blurHSVImage);
+            });
+            std::cout << "Finished processing image " << finished + 1 << " with OpenCL." << std::endl;
+        }
+    }
+
+    // Wait for the last files to be written
+    for (Slot& slot : slots) {
+        if (slot.encoded.valid())
+            slot.encoded.get();
+    }
+    traceEvents();
+
+    // Record the ending time
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> duration = end - start;
+
+    std::string notifyThroughput = "Streaming batch With OpenCL: " + std::to_string(numFiles) + " pictures in " 
+        + std::to_string(duration.count()) + " seconds (" + std::to_string(numFiles / duration.count()) + " pictures per second)\n";
+    std::cout << notifyThroughput;
+
+    std::ofstream myfile;
+    myfile.open("runtimeEvaluation.txt", std::fstream::app);
+    myfile << notifyThroughput;
+    myfile.close();
+}
@@ -2,25 +2,340 @@
 #define OPENCL_IMAGE_PROCESSING_H
 
 #include <CL/cl.hpp>
+#include <array>
+#include <deque>
+#include <map>
+#include <memory>
+#include "GaussianBoxes.h"
 #include "ImageProcessorInterface.h"
+#include "OpenCLBufferPool.h"
+#include "OpenCLProgramCache.h"
+#include "OpenCLTuningDatabase.h"
 
 class OpenCLImageProcessing : public ImageProcessorInterface {
 public:
+	// Which device the constructor uses. The index counts the devices of all platforms in
+	// order and the name matches any part of the device name. Without any of them a GPU is
+	// preferred and a CPU device such as PoCL is the fallback
+	struct DeviceSelection {
+		cl_device_type type = CL_DEVICE_TYPE_ALL;
+		std::string name;
+		int index = -1;
+
+		static DeviceSelection parse(const std::string& text);
+		static DeviceSelection fromEnvironment();
+	};
+
+	// The default constructor takes the selection from the environment variable OPENCL_DEVICE,
+	// e.g. "gpu", "cpu", "1" or "Intel"
 	OpenCLImageProcessing();
+	explicit OpenCLImageProcessing(const DeviceSelection& selection);
 	virtual ~OpenCLImageProcessing();
 
+	// Prints the devices of all platforms with the index DeviceSelection uses
+	static void listDevices();
+	std::string getDeviceName() const;
+
+	// Whether the program came from the on-disk binary cache and how long loading or
+	// building it took in the constructor
+	bool isProgramFromCache() const;
+	double getBuildSeconds() const;
+
+	// CPU devices get kernel variants with long runs of pixels per work-item
+	bool isCpuDevice() const;
+
+	// Global reads the whole window from global memory, LocalTile blurs from a tile plus halo
+	// in local memory and Separable runs a horizontal and a running-sum vertical pass.
+	// Auto picks LocalTile for small radii and Separable for everything else
+	enum class BlurKernel {
+		Auto,
+		Global,
+		LocalTile,
+		Separable
+	};
+
+	void setBlurKernel(BlurKernel variant);
+	BlurKernel getBlurKernel() const;
+
+	// Blur kernels for common radii and channel counts come from programs built with
+	// -D RADIUS and -D CHANNELS on first use, so their window loops have constant bounds.
+	// Other values, or disabling it, use the generic program
+	void setSpecializedKernels(bool enabled);
+	bool getSpecializedKernels() const;
+
+	// Float keeps the float kernels. FixedPoint converts with integer reciprocal tables in
+	// constant memory instead of two float divisions per pixel and rounds like OpenCV
+	enum class HsvMode {
+		Float,
+		FixedPoint
+	};
+
+	void setHsvMode(HsvMode mode);
+	HsvMode getHsvMode() const;
+
+	// Measures candidate work-group sizes and amounts of work per work-item for every kernel
+	// used on images of this size, channel count and radius, and saves the fastest ones to the
+	// tuning file. The file is loaded at construction, its values are used for images of the
+	// same size bucket on the same device and driver
+	void autotune(int width, int height, int depth, int kernelSize, int repetitions = 5);
+	void setTuningEnabled(bool enabled);
+
+	// Copy transfers through pooled device buffers, HostPtr uses the Mat storage in place and
+	// Mapped uses memory handed out by allocateHostImage
+	enum class TransferPath {
+		Copy,
+		HostPtr,
+		Mapped
+	};
+
+	// Handle to an image that lives in device memory. Operations on device images are only
+	// enqueued, nothing is read back until download is called. The buffer returns to the
+	// buffer pool when the last copy of the handle is gone, so handles must not outlive
+	// the OpenCLImageProcessing that created them
+	struct DeviceImage {
+		std::shared_ptr<cl::Buffer> buffer;
+		int width = 0;
+		int height = 0;
+		int depth = 0;
+		int type = 0;
+
+		// Host memory backing the buffer when it wraps a Mat, nullptr for device memory
+		uchar* hostData = nullptr;
+		TransferPath path = TransferPath::Copy;
+
+		size_t bytes() const { return static_cast<size_t>(width) * height * depth * sizeof(uchar); }
+		cl::Buffer& data() const { return *buffer; }
+	};
+
+	// Copy always transfers through device buffers. ZeroCopy lets the device work on the Mat
+	// storage directly when the memory allows it and falls back to copying otherwise
+	enum class MemoryMode {
+		Copy,
+		ZeroCopy
+	};
+
+	void setMemoryMode(MemoryMode mode);
+	MemoryMode getMemoryMode() const;
+
+	// Mat in page-aligned memory backed by a mapped CL_MEM_USE_HOST_PTR buffer. In zero-copy
+	// mode such images are used by the device without a transfer. The Mat must not be accessed
+	// while a device image made from it is alive, except after downloading into it. The Mat
+	// owns its memory like any other, releaseHostImage only drops the buffer
+	cv::Mat allocateHostImage(int rows, int cols, int type);
+	void releaseHostImage(const cv::Mat& image);
+	void printTransferStatistics();
+
+	DeviceImage upload(const cv::Mat& input);
+	void download(const DeviceImage& image, cv::Mat& output);
+	DeviceImage rgbToHsv(const DeviceImage& input);
+	DeviceImage boxBlur(const DeviceImage& input, int kernelSize);
+	DeviceImage gaussianBlur(const DeviceImage& input, double sigma);
+
+	// HSV conversion and blur in a single launch, without an intermediate HSV image. The fused
+	// kernel uses the float formula, in fixed-point mode the two operations are chained
+	DeviceImage rgbToHsvBlur(const DeviceImage& input, int kernelSize);
+
+	// Many small images at once: they are packed into one staging buffer behind a table of their
+	// offsets and sizes, uploaded in one transfer, processed by one launch per pass over all
+	// their pixels and read back in one transfer. The images may differ in size and depth
+	void rgbToHsvBatch(const std::vector<cv::Mat>& inputs, std::vector<cv::Mat>& outputs);
+	void boxBlurBatch(const std::vector<cv::Mat>& inputs, std::vector<cv::Mat>& outputs, int kernelSize);
+
 	virtual void execute(std::vector<std::string>& files, std::string& path) override;
 	virtual void rgbToHsv(const cv::Mat& input, cv::Mat& output) override;
 	virtual void boxBlur(const cv::Mat& input, cv::Mat& output, int kernelSize) override;
+
+	// Gaussian approximated by 3 to 5 box blurs on the device. The passes alternate between the
+	// output and one pooled scratch buffer, images blurred in strips alternate on the host.
+	// Sigmas too small for the boxes use the sampled kernel of gaussianKernelWeights
+	virtual void gaussianBlur(const cv::Mat& input, cv::Mat& output, double sigma) override;
+	void setGaussianPasses(int passes);
+	int getGaussianPasses() const;
+
+	// The image is uploaded once, every stage runs on device images and only the result is read
+	// back. HSV before a box blur uses the fused kernel, other point operations are launched
+	// next to their stencil on the device. Images blurred in strips run one operation at a time
+	virtual void runPipeline(const ImagePipeline& pipeline, const cv::Mat& input, cv::Mat& output) override;
+	DeviceImage runPipeline(const ImagePipeline& pipeline, const DeviceImage& input);
+
 	virtual void runtime(std::vector<std::string>& files, std::string& path, int num_runs) override;
 
+	// Processes the files as a pipeline without showing them: while image N is computed,
+	// image N + 1 is uploaded on the transfer queue, image N + 2 is decoded and image N - 1
+	// is read back and encoded on worker threads. Results are written like in execute
+	void streamBatch(std::vector<std::string>& files, std::string& path, int kernelSize);
+
+	// Builds the 32-bit summed-area table of the input on the device once, afterwards any
+	// box radius can be answered with four lookups per pixel and channel
+	void buildIntegralImage(const cv::Mat& input);
+	void boxBlurIntegral(cv::Mat& output, int kernelSize);
+	void boxBlurIntegral(cv::Mat& output, int radiusX, int radiusY);
+
+	// Upper bound for the device memory kept by the buffer pool, free buffers beyond it are
+	// evicted least recently used first
+	void setBufferPoolCap(size_t bytes);
+	void printCacheStatistics();
+
+	// Device memory one blur of a Mat may use. Larger images, and images whose buffers exceed
+	// CL_DEVICE_MAX_MEM_ALLOC_SIZE, are blurred in horizontal strips with a halo of kernelSize
+	// rows that cycle through a fixed set of buffers. Defaults to a quarter of the global memory.
+	// The blur throws std::runtime_error if not even a single output row with its halo fits
+	void setStripMemoryBudget(size_t bytes);
+
 private:
 	cl::Context context;
 	cl::CommandQueue commandQueue;
+	cl::CommandQueue transferQueue;
 	cl::Program program;
 	cl::Device device;
+	size_t maxWorkGroupSize;
+	cl_ulong localMemSize;
+	size_t maxMemAllocSize;
+	size_t stripMemoryBudget;
+	bool cpuDevice;
+	int cpuPixelsPerItem;
+	int vectorPixelsPerItem;
+
+	// Device buffers and kernel objects are reused across calls
+	OpenCLBufferPool bufferPool;
+	std::map<std::string, cl::Kernel> kernels;
+	size_t kernelHits;
+	size_t kernelMisses;
+
+	BlurKernel blurKernel;
+
+	// Reciprocal tables of the fixed-point HSV kernel, uploaded on first use
+	HsvMode hsvMode;
+	cl::Buffer hsvSaturationTable;
+	cl::Buffer hsvHueTable;
+
+	int gaussianPasses;
+	cv::Mat gaussianScratch;
+
+	// Host side of the batch transfers, kept to avoid reallocating them for every batch
+	std::vector<uchar> batchStaging;
+	std::vector<uchar> batchResult;
+
+	// Zero-copy state: mapped host images by their data pointer and the paths taken so far
+	struct HostMapping {
+		cv::Mat storage;
+		cl::Buffer buffer;
+		uchar* data;
+		size_t bytes;
+		bool mapped;
+		int users;
+	};
+
+	struct TransferStatistics {
+		size_t copied;
+		size_t hostPtr;
+		size_t mapped;
+	};
+
+	// Commands of the phases runtime reports, recorded with an event while profiling or
+	// tracing is on
+	enum class ProfilePhase {
+		Write,
+		Kernel,
+		Read
+	};
+
+	// The trace needs the host time of the enqueue, the queue and the kernel name as well
+	struct ProfiledEvent {
+		ProfilePhase phase;
+		cl::Event event;
+		double enqueued;
+		const char* queue;
+		std::string name;
+	};
+
+	bool profiling;
+	std::deque<ProfiledEvent> profiledEvents;
 
+	MemoryMode memoryMode;
+	size_t memBaseAddrAlign;
+	std::map<const uchar*, HostMapping> hostImages;
+	TransferStatistics transferStats;
+
+	// Device-resident summed-area table: (rows + 1) x (cols + 1) x depth
+	cl::Buffer integralBuffer;
+	int integralWidth;
+	int integralHeight;
+	int integralDepth;
+	int integralType;
+
+	OpenCLProgramCache programCache;
+	bool programFromCache;
+	double buildSeconds;
+
+	// Specialized programs by radius and channel count, built from the same source. A failed
+	// build is kept as an empty program, so that combination stays on the generic kernels
+	std::string kernelSource;
+	bool specializedKernels;
+	std::map<std::pair<int, int>, cl::Program> variantPrograms;
+
+	// Tuned launch parameters. While autotuning, forcedKernel gets forcedLaunch instead. The
+	// device part of the keys is queried once at construction
+	OpenCLTuningDatabase tuning;
+	std::string tuningPrefix;
+	bool tuningEnabled;
+	std::string forcedKernel;
+	LaunchConfig forcedLaunch;
+
+	static cl::Device selectDevice(const DeviceSelection& selection);
 	std::string read_kernel(const char* filename);
+	cl::Kernel& getKernel(const std::string& name);
+	cl::Kernel& getKernel(const std::string& name, int kernelSize, int depth);
+	const cl::Program* variantProgram(int kernelSize, int depth);
+	DeviceImage allocateDeviceImage(int width, int height, int depth, int type, cl_mem_flags flags = CL_MEM_READ_WRITE);
+	DeviceImage outputImage(const DeviceImage& input, cv::Mat& output);
+	DeviceImage wrapHostImage(const cv::Mat& image, cl_mem_flags flags);
+	void mapHostImage(const uchar* data);
+	void countTransfer(TransferPath path);
+
+	// Event for the next command while profiling or tracing, nullptr otherwise
+	cl::Event* profileEvent(ProfilePhase phase);
+	cl::Event* profileEvent(const cl::Kernel& kernel);
+	// Records a command that was enqueued with its own event, e.g. on the transfer queue
+	void recordEvent(ProfilePhase phase, const cl::Event& event, const char* queue);
+	std::array<double, 5> collectPhaseTimes();
+	// Hands the recorded commands to the trace. Without profiling only the finished commands
+	// at the front are taken, so the list stays short while the commands keep running
+	void traceEvents();
+	void traceEvent(const ProfiledEvent& recorded, const std::string& deviceName);
+
+	void uploadHsvTables();
+	void enqueueRgbToHsv(const DeviceImage& input, const DeviceImage& output);
+	void enqueueBoxBlur(const DeviceImage& input, const DeviceImage& output, int kernelSize);
+	void enqueueGaussianBlur(const DeviceImage& input, const DeviceImage& output, double sigma);
+	void enqueueGaussianKernel(const DeviceImage& input, const DeviceImage& output, double sigma);
+
+	// kernelSize < 0 converts to HSV, otherwise the batch is blurred
+	void runBatch(const std::vector<cv::Mat>& inputs, std::vector<cv::Mat>& outputs, int kernelSize);
+
+	bool needsStrips(const cv::Mat& input) const;
+	void boxBlurStrips(const cv::Mat& input, cv::Mat& output, int kernelSize);
+
+	size_t kernelWorkGroupLimit(const cl::Kernel& kernel);
+	size_t preferredMultiple(const cl::Kernel& kernel);
+	size_t localSize1D(const cl::Kernel& kernel);
+	void launchGeometry2D(const cl::Kernel& kernel, const std::string& name, int width, int height, int depth, int radius,
+		cl::NDRange& global, cl::NDRange& local);
+	void enqueueKernel1D(cl::Kernel& kernel, size_t items, size_t localSize);
+
+	// Launch parameters of a kernel for an image of this size and radius, 0 for kernels without
+	// one: forced while autotuning, tuned if the tuning file has valid ones, the defaults otherwise
+	LaunchConfig launchConfig(const cl::Kernel& kernel, const std::string& name, int width, int height, int depth,
+		int radius, const LaunchConfig& defaults);
+	std::vector<LaunchConfig> launchCandidates1D(const cl::Kernel& kernel, const std::vector<int>& perItem);
+	std::vector<LaunchConfig> launchCandidates2D(const cl::Kernel& kernel);
+
+	BlurKernel selectBlurKernel(int kernelSize, int depth, size_t tileSize);
+	size_t localTileSize();
+	size_t localTileSize(const cl::Kernel& kernel);
+	void enqueueBlurGlobal(cl::Buffer& input, cl::Buffer& output, int width, int height, int depth, int kernelSize);
+	void enqueueBlurLocal(cl::Buffer& input, cl::Buffer& output, int width, int height, int depth, int kernelSize, size_t tileSize);
+	void enqueueBlurSeparable(cl::Buffer& input, cl::Buffer& output, int width, int height, int depth, int kernelSize);
 };
 
 #endif // OPENCL_IMAGE_PROCESSING_H
\ No newline at end of file
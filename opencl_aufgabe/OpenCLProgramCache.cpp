@@ -0,0 +1,123 @@
+#include "OpenCLProgramCache.h"
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iterator>
+#include <sstream>
+#include <vector>
+
+// 64-bit FNV-1a, good enough to tell kernel sources and devices apart
+static uint64_t hashBytes(uint64_t hash, const std::string& bytes) {
+    for (unsigned char c : bytes) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    // Separator, so that "ab" + "c" and "a" + "bc" differ
+    hash ^= 0xFF;
+    hash *= 1099511628211ULL;
+    return hash;
+}
+
+OpenCLProgramCache::OpenCLProgramCache(const std::string& directory) : directory(directory) {}
+
+std::string OpenCLProgramCache::key(const cl::Device& device, const std::string& source, const std::string& options) {
+    uint64_t hash = 14695981039346656037ULL;
+    hash = hashBytes(hash, source);
+    hash = hashBytes(hash, options);
+    hash = hashBytes(hash, device.getInfo<CL_DEVICE_NAME>());
+    hash = hashBytes(hash, device.getInfo<CL_DEVICE_VERSION>());
+    hash = hashBytes(hash, device.getInfo<CL_DRIVER_VERSION>());
+
+    std::ostringstream text;
+    text << std::hex << std::setw(16) << std::setfill('0') << hash;
+    return text.str();
+}
+
+void OpenCLProgramCache::clear() {
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(directory, error)) {
+        if (entry.path().extension() == ".bin")
+            std::filesystem::remove(entry.path(), error);
+    }
+}
+
+std::string OpenCLProgramCache::binaryPath(const std::string& key) const {
+    return (std::filesystem::path(directory) / (key + ".bin")).string();
+}
+
+bool OpenCLProgramCache::load(const std::string& key, std::vector<unsigned char>& binary) const {
+    std::ifstream file(binaryPath(key), std::ios::binary);
+    if (!file)
+        return false;
+
+    // The first line repeats the key, a truncated or foreign file is ignored
+    std::string header;
+    std::getline(file, header);
+    if (header != "OCLBIN " + key)
+        return false;
+
+    binary.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    return !binary.empty();
+}
+
+void OpenCLProgramCache::store(const std::string& key, const cl::Program& program) const {
+    // The program is built for exactly one device, so there is exactly one binary
+    size_t size = 0;
+    if (clGetProgramInfo(program(), CL_PROGRAM_BINARY_SIZES, sizeof(size), &size, nullptr) != CL_SUCCESS || size == 0)
+        return;
+
+    std::vector<unsigned char> binary(size);
+    unsigned char* data = binary.data();
+    if (clGetProgramInfo(program(), CL_PROGRAM_BINARIES, sizeof(data), &data, nullptr) != CL_SUCCESS)
+        return;
+
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+
+    // Written to a temporary file first, so that another instance never reads half a binary
+    std::string path = binaryPath(key);
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary);
+        if (!file)
+            return;
+        file << "OCLBIN " << key << "\n";
+        file.write(reinterpret_cast<const char*>(binary.data()), binary.size());
+    }
+    std::filesystem::rename(temporary, path, error);
+}
+
+cl::Program OpenCLProgramCache::build(const cl::Context& context, const cl::Device& device, const std::string& source,
+    const std::string& options, cl_int& status, bool& loadedFromCache) {
+    std::string programKey = key(device, source, options);
+    loadedFromCache = false;
+
+    std::vector<unsigned char> binary;
+    if (load(programKey, binary)) {
+        cl::Program::Binaries binaries;
+        binaries.push_back({ binary.data(), binary.size() });
+
+        std::vector<cl_int> binaryStatus;
+        cl_int error = CL_SUCCESS;
+        cl::Program program(context, { device }, binaries, &binaryStatus, &error);
+
+        // A binary still has to be built, which only links it. If the driver rejects it,
+        // the source build below replaces the cached file
+        if (error == CL_SUCCESS && !binaryStatus.empty() && binaryStatus[0] == CL_SUCCESS
+            && program.build({ device }, options.c_str()) == CL_SUCCESS) {
+            loadedFromCache = true;
+            status = CL_SUCCESS;
+            return program;
+        }
+    }
+
+    cl::Program::Sources sources;
+    sources.push_back({ source.c_str(), source.length() });
+
+    cl::Program program(context, sources);
+    status = program.build({ device }, options.c_str());
+    if (status == CL_SUCCESS)
+        store(programKey, program);
+    return program;
+}
@@ -0,0 +1,34 @@
+#ifndef OPENCL_PROGRAM_CACHE_H
+#define OPENCL_PROGRAM_CACHE_H
+
+#include <CL/cl.hpp>
+#include <string>
+#include <vector>
+
+// On-disk cache of built program binaries. A binary is stored under a hash of the kernel
+// source, the build options, the device name and version and the driver version, so any
+// change to one of them misses the cache and leads to a new build from source
+class OpenCLProgramCache {
+public:
+    explicit OpenCLProgramCache(const std::string& directory = "kernel_cache");
+
+    // Loads the program from a cached binary if there is one for this key, otherwise builds
+    // it from source and stores the binary for the next run. status is the result of the
+    // build, loadedFromCache tells which path was taken
+    cl::Program build(const cl::Context& context, const cl::Device& device, const std::string& source,
+        const std::string& options, cl_int& status, bool& loadedFromCache);
+
+    // Removes all cached binaries, the next build of every program is a cold build from source
+    void clear();
+
+    static std::string key(const cl::Device& device, const std::string& source, const std::string& options);
+
+private:
+    std::string directory;
+
+    std::string binaryPath(const std::string& key) const;
+    bool load(const std::string& key, std::vector<unsigned char>& binary) const;
+    void store(const std::string& key, const cl::Program& program) const;
+};
+
+#endif // OPENCL_PROGRAM_CACHE_H
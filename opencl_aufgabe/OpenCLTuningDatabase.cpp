@@ -0,0 +1,80 @@
+#include "OpenCLTuningDatabase.h"
+#include <fstream>
+#include <sstream>
+
+OpenCLTuningDatabase::OpenCLTuningDatabase(const std::string& fileName) : fileName(fileName) {}
+
+std::string OpenCLTuningDatabase::devicePrefix(const cl::Device& device) {
+    return device.getInfo<CL_DEVICE_NAME>() + "|" + device.getInfo<CL_DRIVER_VERSION>();
+}
+
+std::string OpenCLTuningDatabase::key(const std::string& devicePrefix, const std::string& kernelName, int width,
+    int height, int depth, int radius) {
+    size_t pixels = static_cast<size_t>(width) * height;
+    int bucket = 0;
+    while ((static_cast<size_t>(2) << bucket) <= pixels) {
+        ++bucket;
+    }
+
+    std::ostringstream text;
+    text << devicePrefix << "|" << kernelName << "|" << depth << "ch|2^" << bucket;
+    if (radius > 0) {
+        int radiusBucket = 0;
+        while ((2 << radiusBucket) <= radius) {
+            ++radiusBucket;
+        }
+        text << "|r2^" << radiusBucket;
+    }
+    return text.str();
+}
+
+void OpenCLTuningDatabase::load() {
+    std::ifstream file(fileName);
+    std::string line;
+
+    while (std::getline(file, line)) {
+        size_t tab = line.find('\t');
+        if (line.empty() || line[0] == '#' || tab == std::string::npos)
+            continue;
+
+        LaunchConfig config;
+        std::istringstream values(line.substr(tab + 1));
+        if (values >> config.localX >> config.localY >> config.perItem)
+            entries[line.substr(0, tab)] = config;
+    }
+}
+
+bool OpenCLTuningDatabase::save() const {
+    std::ofstream file(fileName);
+    if (!file)
+        return false;
+
+    // A tab separates the key from the values, so device names may contain spaces
+    file << "# device|driver|kernel|channels|pixel bucket\tlocalX localY perItem" << std::endl;
+    for (const auto& entry : entries) {
+        file << entry.first << "\t" << entry.second.localX << " " << entry.second.localY << " "
+            << entry.second.perItem << std::endl;
+    }
+    return static_cast<bool>(file);
+}
+
+bool OpenCLTuningDatabase::find(const std::string& key, LaunchConfig& config) const {
+    auto found = entries.find(key);
+    if (found == entries.end())
+        return false;
+
+    config = found->second;
+    return true;
+}
+
+void OpenCLTuningDatabase::set(const std::string& key, const LaunchConfig& config) {
+    entries[key] = config;
+}
+
+size_t OpenCLTuningDatabase::size() const {
+    return entries.size();
+}
+
+const std::string& OpenCLTuningDatabase::getFileName() const {
+    return fileName;
+}
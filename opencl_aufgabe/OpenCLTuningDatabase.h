@@ -0,0 +1,47 @@
+#ifndef OPENCL_TUNING_DATABASE_H
+#define OPENCL_TUNING_DATABASE_H
+
+#include <CL/cl.hpp>
+#include <map>
+#include <string>
+
+// Launch parameters of one kernel. A local size of 0 leaves the work-group size to the
+// runtime, localY is 0 for one-dimensional launches. perItem is the kernel specific amount
+// of work per work-item (pixels or rows), 0 keeps the built-in default
+struct LaunchConfig {
+    size_t localX = 0;
+    size_t localY = 0;
+    int perItem = 0;
+};
+
+// Fastest launch parameters per device, kernel, channel count, image size and radius bucket, found by
+// OpenCLImageProcessing::autotune. The entries are kept in a text file, one per line, so later
+// runs start with them
+class OpenCLTuningDatabase {
+public:
+    explicit OpenCLTuningDatabase(const std::string& fileName = "kernel_tuning.txt");
+
+    // Reads the file if it exists, entries of other devices are kept as well
+    void load();
+    bool save() const;
+
+    bool find(const std::string& key, LaunchConfig& config) const;
+    void set(const std::string& key, const LaunchConfig& config);
+    size_t size() const;
+    const std::string& getFileName() const;
+
+    // Device name and driver version that start every key of a device. Querying them is slow,
+    // so callers build the prefix once
+    static std::string devicePrefix(const cl::Device& device);
+
+    // Images with the same power of two of their pixel count share a bucket, blur radii with the
+    // same power of two as well. A radius of 0 is left out, for kernels that have none
+    static std::string key(const std::string& devicePrefix, const std::string& kernelName, int width, int height,
+        int depth, int radius = 0);
+
+private:
+    std::string fileName;
+    std::map<std::string, LaunchConfig> entries;
+};
+
+#endif // OPENCL_TUNING_DATABASE_H
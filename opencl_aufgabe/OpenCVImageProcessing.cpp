@@ -1,4 +1,6 @@
 #include "OpenCVImageProcessing.h"
+#include "HostImagePool.h"
+#include "Trace.h"
 
 OpenCVImageProcessing::OpenCVImageProcessing() {}
 
@@ -17,6 +19,15 @@ void OpenCVImageProcessing::boxBlur(const cv::Mat& input, cv::Mat& output, int k
     cv::filter2D(input, output, -1, kernel);
 }
 
+void OpenCVImageProcessing::gaussianBlur(const cv::Mat& input, cv::Mat& output, double sigma) {
+    // The kernel size follows from sigma
+    cv::GaussianBlur(input, output, cv::Size(0, 0), sigma, sigma, cv::BORDER_REPLICATE);
+}
+
+void OpenCVImageProcessing::runPipeline(const ImagePipeline& pipeline, const cv::Mat& input, cv::Mat& output) {
+    pipeline.runUnfused(*this, input, output);
+}
+
 void OpenCVImageProcessing::runtime(std::vector<std::string>& files, std::string& path, int num_runs){
     //Vector to store durations
     std::vector<std::chrono::duration<double>> durationsHSV;
@@ -26,8 +37,8 @@ void OpenCVImageProcessing::runtime(std::vector<std::string>& files, std::string
 
         for (int j = 0; j < num_runs; ++j) {
             cv::Mat inputImage = cv::imread(path + files.at(i), cv::IMREAD_UNCHANGED);
-            cv::Mat hsvImage = cv::Mat::zeros(inputImage.size(), inputImage.type());
-            cv::Mat blurredImage = cv::Mat::zeros(inputImage.size(), inputImage.type());
+            cv::Mat hsvImage = HostImagePool::instance().image(inputImage.size(), inputImage.type());
+            cv::Mat blurredImage = HostImagePool::instance().image(inputImage.size(), inputImage.type());
 
             // Record the starting time
             auto start = std::chrono::high_resolution_clock::now();
@@ -89,38 +100,55 @@ void OpenCVImageProcessing::runtime(std::vector<std::string>& files, std::string
         durationsBlur.clear();
         myfile.close();
     }
+
+    // Intermediates of later runs come from the blocks the first run released
+    HostImagePool::instance().printStatistics(std::cout);
 }
 
 void OpenCVImageProcessing::execute(std::vector<std::string>& files, std::string& path) {
     for (int i = 0; i < files.size(); i++) {
-        cv::Mat inputImage = cv::imread(path + files.at(i), cv::IMREAD_UNCHANGED);
-        cv::Mat hsvImage = cv::Mat::zeros(inputImage.size(), inputImage.type());
-        cv::Mat blurImage = cv::Mat::zeros(inputImage.size(), inputImage.type());
-        cv::Mat blurHSVImage = cv::Mat::zeros(inputImage.size(), inputImage.type());
+        TraceSpan imageSpan(files.at(i), "image");
 
-        // Convert RGB image to HSV image
-        rgbToHsv(inputImage, hsvImage);
+        cv::Mat inputImage;
+        {
+            TraceSpan span("imread", "decode");
+            inputImage = cv::imread(path + files.at(i), cv::IMREAD_UNCHANGED);
+        }
+        cv::Mat hsvImage = HostImagePool::instance().image(inputImage.size(), inputImage.type());
+        cv::Mat blurImage = HostImagePool::instance().image(inputImage.size(), inputImage.type());
+        cv::Mat blurHSVImage = HostImagePool::instance().image(inputImage.size(), inputImage.type());
 
-        // Blur Original Image
         int kernelSize = 10;
-        boxBlur(inputImage, blurImage, kernelSize);
+        {
+            TraceSpan span("compute", "compute");
 
-        // Blur HSV Image
-        boxBlur(hsvImage, blurHSVImage, kernelSize);
+            // Convert RGB image to HSV image
+            rgbToHsv(inputImage, hsvImage);
+
+            // Blur Original Image
+            boxBlur(inputImage, blurImage, kernelSize);
+
+            // Blur HSV Image
+            boxBlur(hsvImage, blurHSVImage, kernelSize);
+        }
         std::cout << "Finished processing image " << i + 1 << " with OpenCV." << std::endl;
 
         // Display the results
-        cv::imshow("Original Image", inputImage);
-        cv::imshow("HSV Image", hsvImage);
-        cv::imshow("Blurred Original Image", blurImage);
-        cv::imshow("Blurred HSV Image ", blurHSVImage);
-        cv::waitKey(0);
-        cv::destroyAllWindows();
+        {
+            TraceSpan span("display results", "display");
+            cv::imshow("Original Image", inputImage);
+            cv::imshow("HSV Image", hsvImage);
+            cv::imshow("Blurred Original Image", blurImage);
+            cv::imshow("Blurred HSV Image ", blurHSVImage);
+            cv::waitKey(0);
+            cv::destroyAllWindows();
+        }
 
         // Specify the folder path to save the images
         std::string folderPath = "Results OpenCV\\";
 
         // Create .jpg file from the result
+        TraceSpan span("imwrite", "encode");
         std::string numberingFile = std::to_string(i + 1);
         std::string hsvImageFile = folderPath + numberingFile + ".hsvImage.jpg";
         std::string blurredImageFile = folderPath + numberingFile + ".blurredImage.jpg";
@@ -11,6 +11,13 @@ public:
 	virtual void execute(std::vector<std::string>& files, std::string& path) override;
 	virtual void rgbToHsv(const cv::Mat& input, cv::Mat& output) override;
 	virtual void boxBlur(const cv::Mat& input, cv::Mat& output, int kernelSize) override;
+
+	// Exact Gaussian, the reference for the box approximations of the other backends. The
+	// border repeats the edge pixels like their box blurs
+	virtual void gaussianBlur(const cv::Mat& input, cv::Mat& output, double sigma) override;
+
+	// OpenCV has no fused passes, the operations run one after another
+	virtual void runPipeline(const ImagePipeline& pipeline, const cv::Mat& input, cv::Mat& output) override;
 	virtual void runtime(std::vector<std::string>& files, std::string& path, int num_runs) override;
 };
 
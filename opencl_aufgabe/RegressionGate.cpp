@@ -0,0 +1,436 @@
+#include "RegressionGate.h"
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include "Benchmark.h"
+#include "CommandLine.h"
+#include "CpuImageProcessing.h"
+#include "HostImagePool.h"
+#include "OpenCLImageProcessing.h"
+#include "OpenCVImageProcessing.h"
+
+void printRegressionUsage() {
+    std::cout << "Usage: opencl_aufgabe --regression [options]" << std::endl;
+    std::cout << "  --backends cpu,opencl          Backends compared with OpenCV" << std::endl;
+    std::cout << "  --ops hsv,blur,gaussian,hsv-blur" << std::endl;
+    std::cout << "  --radii 1,10,64                Blur radii of the accuracy checks" << std::endl;
+    std::cout << "  --sigmas 1,3,8                 Gaussian sigmas of the accuracy checks" << std::endl;
+    std::cout << "  --device gpu                   OpenCL device: gpu, cpu, index or name" << std::endl;
+    std::cout << "  --hsv-fixed-point              Check the integer HSV conversion" << std::endl;
+    std::cout << "  --thresholds file              Accuracy thresholds (regressionThresholds.txt)" << std::endl;
+    std::cout << "  --baseline file                Throughput baseline (regressionBaseline.txt)" << std::endl;
+    std::cout << "  --tolerance 0.1                Allowed throughput loss against the baseline" << std::endl;
+    std::cout << "  --results name                 Write the measurements to name.json and name.csv" << std::endl;
+    std::cout << "  --warmup 2                     Untimed runs per measurement" << std::endl;
+    std::cout << "  --iterations 10                Timed runs per measurement" << std::endl;
+    std::cout << "  --update-baseline              Store the measured throughput as the new baseline" << std::endl;
+    std::cout << "  --no-performance               Only check the accuracy" << std::endl;
+}
+
+bool parseRegressionOptions(int argc, char** argv, RegressionOptions& options) {
+    for (int i = 0; i < argc; i++) {
+        std::string flag = argv[i];
+
+        // Flags without a value
+        if (flag == "--update-baseline") {
+            options.updateBaseline = true;
+            continue;
+        }
+        if (flag == "--no-performance") {
+            options.performance = false;
+            continue;
+        }
+        if (flag == "--hsv-fixed-point") {
+            options.fixedPointHsv = true;
+            continue;
+        }
+
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << flag << std::endl;
+            printRegressionUsage();
+            return false;
+        }
+        std::string value = argv[++i];
+
+        try {
+            if (flag == "--backends") {
+                options.backends = splitList(value);
+            }
+            else if (flag == "--ops") {
+                options.operations = splitList(value);
+            }
+            else if (flag == "--radii") {
+                options.radii.clear();
+                for (const std::string& radius : splitList(value))
+                    options.radii.push_back(std::stoi(radius));
+            }
+            else if (flag == "--sigmas") {
+                options.sigmas.clear();
+                for (const std::string& sigma : splitList(value))
+                    options.sigmas.push_back(std::stod(sigma));
+            }
+            else if (flag == "--device") {
+                options.device = value;
+            }
+            else if (flag == "--thresholds") {
+                options.thresholdsFile = value;
+            }
+            else if (flag == "--baseline") {
+                options.baselineFile = value;
+            }
+            else if (flag == "--results") {
+                options.resultsFile = value;
+            }
+            else if (flag == "--tolerance") {
+                options.tolerance = std::stod(value);
+            }
+            else if (flag == "--warmup") {
+                options.warmup = std::stoi(value);
+            }
+            else if (flag == "--iterations") {
+                options.iterations = std::stoi(value);
+            }
+            else {
+                std::cerr << "Unknown option " << flag << std::endl;
+                printRegressionUsage();
+                return false;
+            }
+        }
+        catch (const std::exception&) {
+            std::cerr << "Invalid value for " << flag << ": " << value << std::endl;
+            printRegressionUsage();
+            return false;
+        }
+    }
+
+    for (const std::string& backend : options.backends) {
+        if (backend != "cpu" && backend != "opencl") {
+            std::cerr << "Unknown backend " << backend << ", OpenCV is the reference" << std::endl;
+            return false;
+        }
+    }
+    for (const std::string& operation : options.operations) {
+        if (operation != "hsv" && operation != "blur" && operation != "gaussian" && operation != "hsv-blur") {
+            std::cerr << "Unknown operation " << operation << std::endl;
+            return false;
+        }
+    }
+    for (int radius : options.radii) {
+        if (radius < 1) {
+            std::cerr << "Radii have to be positive" << std::endl;
+            return false;
+        }
+    }
+    for (double sigma : options.sigmas) {
+        if (sigma <= 0.0) {
+            std::cerr << "Sigmas have to be positive" << std::endl;
+            return false;
+        }
+    }
+    if (options.backends.empty() || options.operations.empty() || options.radii.empty() || options.sigmas.empty()
+        || options.tolerance < 0.0 || options.warmup < 0 || options.iterations < 1) {
+        std::cerr << "At least one backend, operation, radius and sigma, a tolerance of at least 0 and "
+            "one iteration are needed" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+std::map<std::string, RegressionThreshold> loadRegressionThresholds(const std::string& fileName) {
+    // The blurs divide without rounding, OpenCV rounds, so one off is expected. The box
+    // passes only approximate a Gaussian: on the pictures they stay within 15 and above 44 dB,
+    // on the synthetic noise and images smaller than the kernel they reach 29 and 26.8 dB
+    std::map<std::string, RegressionThreshold> thresholds{
+        { "hsv", { 2, 40.0 } },
+        { "blur", { 1, 45.0 } },
+        { "gaussian", { 16, 44.0 } },
+        { "gaussian|synthetic", { 32, 25.0 } },
+        { "hsv-blur", { 2, 40.0 } },
+    };
+
+    std::ifstream file(fileName);
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t tab = line.find('\t');
+        if (line.empty() || line[0] == '#' || tab == std::string::npos)
+            continue;
+
+        RegressionThreshold threshold;
+        std::istringstream values(line.substr(tab + 1));
+        if (values >> threshold.maxDifference >> threshold.minPsnr)
+            thresholds[line.substr(0, tab)] = threshold;
+    }
+    return thresholds;
+}
+
+static std::map<std::string, double> loadBaseline(const std::string& fileName) {
+    std::map<std::string, double> baseline;
+    std::ifstream file(fileName);
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t tab = line.find('\t');
+        if (line.empty() || line[0] == '#' || tab == std::string::npos)
+            continue;
+
+        double megapixelsPerSecond;
+        std::istringstream values(line.substr(tab + 1));
+        if (values >> megapixelsPerSecond)
+            baseline[line.substr(0, tab)] = megapixelsPerSecond;
+    }
+    return baseline;
+}
+
+static bool saveBaseline(const std::string& fileName, const std::map<std::string, double>& baseline) {
+    std::ofstream file(fileName);
+    if (!file)
+        return false;
+
+    file << "# backend|operation\tmegapixels per second" << std::endl;
+    for (const auto& entry : baseline)
+        file << entry.first << "\t" << entry.second << std::endl;
+    return static_cast<bool>(file);
+}
+
+static std::unique_ptr<ImageProcessorInterface> createBackend(const std::string& name, const RegressionOptions& options) {
+    if (name == "cpu") {
+        auto cpu = std::make_unique<CpuImageProcessing>();
+        if (options.fixedPointHsv)
+            cpu->setHsvMode(CpuImageProcessing::HsvMode::FixedPoint);
+        return cpu;
+    }
+    auto opencl = options.device.empty() ? std::make_unique<OpenCLImageProcessing>()
+        : std::make_unique<OpenCLImageProcessing>(OpenCLImageProcessing::DeviceSelection::parse(options.device));
+    if (options.fixedPointHsv)
+        opencl->setHsvMode(OpenCLImageProcessing::HsvMode::FixedPoint);
+    return opencl;
+}
+
+// Reproducible noise, so a failing case can be repeated
+// The most specific key wins: backend and input class, then the input class, the backend and
+// the operation alone. Synthetic inputs are the "synthetic" class, the pictures have none
+static const RegressionThreshold& findThreshold(const std::map<std::string, RegressionThreshold>& thresholds,
+    const std::string& backend, const std::string& operation, bool synthetic) {
+    std::vector<std::string> keys;
+    if (synthetic) {
+        keys.push_back(backend + "|" + operation + "|synthetic");
+        keys.push_back(operation + "|synthetic");
+    }
+    keys.push_back(backend + "|" + operation);
+    keys.push_back(operation);
+
+    for (const std::string& key : keys) {
+        auto threshold = thresholds.find(key);
+        if (threshold != thresholds.end())
+            return threshold->second;
+    }
+    return thresholds.at(operation);
+}
+
+static cv::Mat syntheticImage(int width, int height, int channels, std::mt19937& generator) {
+    std::uniform_int_distribution<int> distribution(0, 255);
+    cv::Mat image(height, width, CV_8UC(channels));
+    for (int i = 0; i < image.rows; i++) {
+        uchar* row = image.ptr<uchar>(i);
+        for (int j = 0; j < image.cols * channels; j++)
+            row[j] = static_cast<uchar>(distribution(generator));
+    }
+    return image;
+}
+
+// The backends convert the first three channels and pass further ones (alpha) through,
+// cv::cvtColor drops them
+static cv::Mat referenceHsv(const cv::Mat& input) {
+    cv::Mat hsv;
+    cv::cvtColor(input, hsv, cv::COLOR_RGB2HSV);
+    if (input.channels() == 3)
+        return hsv;
+
+    cv::Mat withAlpha(input.size(), input.type());
+    const cv::Mat sources[] = { hsv, input };
+    const int fromTo[] = { 0, 0, 1, 1, 2, 2, 6, 3 };
+    cv::mixChannels(sources, 2, &withAlpha, 1, fromTo, 4);
+    return withAlpha;
+}
+
+// The custom blurs clamp at the image border, which is BORDER_REPLICATE in OpenCV
+static cv::Mat referenceBlur(const cv::Mat& input, int radius) {
+    cv::Mat blurred;
+    cv::blur(input, blurred, cv::Size(2 * radius + 1, 2 * radius + 1), cv::Point(-1, -1), cv::BORDER_REPLICATE);
+    return blurred;
+}
+
+RegressionSummary runRegression(const RegressionOptions& options, const std::vector<std::string>& images) {
+    RegressionSummary summary;
+    std::map<std::string, RegressionThreshold> thresholds = loadRegressionThresholds(options.thresholdsFile);
+
+    // The bundled images and the cases they do not cover
+    std::vector<std::pair<std::string, cv::Mat>> inputs;
+    for (const std::string& file : images) {
+        cv::Mat image = cv::imread(file, cv::IMREAD_UNCHANGED);
+        if (image.empty()) {
+            std::cerr << "Could not read " << file << ", skipping it" << std::endl;
+            continue;
+        }
+        inputs.emplace_back(file, image);
+    }
+
+    const size_t pictureCount = inputs.size();
+    std::mt19937 generator(42);
+    inputs.emplace_back("1x1", syntheticImage(1, 1, 3, generator));
+    inputs.emplace_back("7x5", syntheticImage(7, 5, 3, generator));
+    inputs.emplace_back("333x217", syntheticImage(333, 217, 3, generator));
+    inputs.emplace_back("257x129x4", syntheticImage(257, 129, 4, generator));
+
+    OpenCVImageProcessing ocvip;
+
+    for (const std::string& backendName : options.backends) {
+        std::unique_ptr<ImageProcessorInterface> backend = createBackend(backendName, options);
+
+        for (const std::string& operation : options.operations) {
+            // HSV has no parameter, the Gaussian takes the sigmas, the blurs the radii
+            std::vector<double> parameters{ 0.0 };
+            if (operation == "gaussian")
+                parameters = options.sigmas;
+            else if (operation != "hsv")
+                parameters.assign(options.radii.begin(), options.radii.end());
+
+            for (size_t i = 0; i < inputs.size(); ++i) {
+                const auto& input = inputs[i];
+                const cv::Mat& image = input.second;
+                const RegressionThreshold& threshold = findThreshold(thresholds, backendName, operation, i >= pictureCount);
+
+                for (double parameter : parameters) {
+                    const int radius = static_cast<int>(parameter);
+                    std::string label = backendName + " " + operation + " " + input.first;
+                    if (operation == "gaussian")
+                        label += " sigma=" + cv::format("%g", parameter);
+                    else if (operation != "hsv")
+                        label += " r=" + std::to_string(radius);
+
+                    cv::Mat reference;
+                    if (operation == "hsv")
+                        reference = referenceHsv(image);
+                    else if (operation == "blur")
+                        reference = referenceBlur(image, radius);
+                    else if (operation == "gaussian")
+                        ocvip.gaussianBlur(image, reference, parameter);
+                    else
+                        reference = referenceBlur(referenceHsv(image), radius);
+
+                    summary.accuracyChecks++;
+                    cv::Mat result = HostImagePool::instance().image(image.size(), image.type());
+                    try {
+                        if (operation == "hsv") {
+                            backend->rgbToHsv(image, result);
+                        }
+                        else if (operation == "blur") {
+                            backend->boxBlur(image, result, radius);
+                        }
+                        else if (operation == "gaussian") {
+                            backend->gaussianBlur(image, result, parameter);
+                        }
+                        else {
+                            ImagePipeline hsvBlur;
+                            hsvBlur.rgbToHsv().boxBlur(radius);
+                            backend->runPipeline(hsvBlur, image, result);
+                        }
+                    }
+                    catch (const std::exception& exception) {
+                        std::cout << label << ": FAILED, " << exception.what() << std::endl;
+                        summary.accuracyFailures++;
+                        continue;
+                    }
+
+                    if (result.size() != reference.size() || result.type() != reference.type()) {
+                        std::cout << label << ": FAILED, result is " << result.cols << "x" << result.rows << "x"
+                            << result.channels() << std::endl;
+                        summary.accuracyFailures++;
+                        continue;
+                    }
+
+                    cv::Mat difference;
+                    cv::absdiff(result, reference, difference);
+                    double maxDifference;
+                    cv::minMaxLoc(difference.reshape(1), nullptr, &maxDifference);
+                    double psnr = cv::PSNR(result, reference);
+
+                    bool passed = maxDifference <= threshold.maxDifference && psnr >= threshold.minPsnr;
+                    if (!passed)
+                        summary.accuracyFailures++;
+                    std::cout << label << ": max diff " << maxDifference << " (<= " << threshold.maxDifference
+                        << "), PSNR " << psnr << " dB (>= " << threshold.minPsnr << ")"
+                        << (passed ? "" : " FAILED") << std::endl;
+                }
+            }
+        }
+    }
+
+    if (!options.performance)
+        return summary;
+
+    // Throughput on the bundled images with the demo's radius. OpenCV is measured as well, a
+    // change of its throughput points at the machine rather than at the code
+    BenchmarkOptions benchmark;
+    benchmark.backends = options.backends;
+    benchmark.backends.push_back("opencv");
+    benchmark.operations = options.operations;
+    benchmark.radii = { 10 };
+    benchmark.images = images;
+    benchmark.device = options.device;
+    benchmark.fixedPointHsv = options.fixedPointHsv;
+    benchmark.warmup = options.warmup;
+    benchmark.iterations = options.iterations;
+    benchmark.jsonFile = options.resultsFile.empty() ? "" : options.resultsFile + ".json";
+    benchmark.csvFile = options.resultsFile.empty() ? "" : options.resultsFile + ".csv";
+    std::vector<BenchmarkResult> results = runBenchmark(benchmark);
+
+    // Pixels over the summed median times, so large images weigh more than small ones
+    std::map<std::string, std::pair<double, double>> totals;
+    for (const BenchmarkResult& result : results) {
+        std::pair<double, double>& total = totals[result.backend + "|" + result.operation];
+        total.first += static_cast<double>(result.width) * result.height / 1e6;
+        total.second += result.median;
+    }
+
+    std::map<std::string, double> measured;
+    for (const auto& total : totals)
+        measured[total.first] = total.second.first / total.second.second;
+
+    if (options.updateBaseline) {
+        if (saveBaseline(options.baselineFile, measured))
+            std::cout << "Baseline written to " << options.baselineFile << std::endl;
+        else
+            std::cerr << "Could not write the baseline to " << options.baselineFile << std::endl;
+        return summary;
+    }
+
+    std::map<std::string, double> baseline = loadBaseline(options.baselineFile);
+    for (const auto& entry : measured) {
+        auto found = baseline.find(entry.first);
+
+        // OpenCV is the reference, its throughput only tells whether the machine changed
+        if (entry.first.compare(0, 7, "opencv|") == 0) {
+            std::cout << entry.first << ": " << entry.second << " MP/s";
+            if (found != baseline.end())
+                std::cout << ", baseline " << found->second << " MP/s";
+            std::cout << " (reference, not checked)" << std::endl;
+            continue;
+        }
+        if (found == baseline.end()) {
+            std::cout << entry.first << ": " << entry.second << " MP/s, no baseline, run with --update-baseline" << std::endl;
+            continue;
+        }
+
+        summary.performanceChecks++;
+        double minimum = found->second * (1.0 - options.tolerance);
+        bool passed = entry.second >= minimum;
+        if (!passed)
+            summary.performanceFailures++;
+        std::cout << entry.first << ": " << entry.second << " MP/s, baseline " << found->second << " MP/s (>= "
+            << minimum << ")" << (passed ? "" : " FAILED") << std::endl;
+    }
+
+    return summary;
+}
@@ -0,0 +1,69 @@
+#ifndef REGRESSION_GATE_H
+#define REGRESSION_GATE_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Largest allowed difference of a channel value and the lowest allowed PSNR against OpenCV
+struct RegressionThreshold {
+    int maxDifference;
+    double minPsnr;
+};
+
+// Settings of a headless regression run, filled from the command line
+struct RegressionOptions {
+    // Backends checked against OpenCV, which computes the reference
+    std::vector<std::string> backends{ "cpu", "opencl" };
+    std::vector<std::string> operations{ "hsv", "blur", "gaussian", "hsv-blur" };
+
+    // Blur radii and Gaussian sigmas of the accuracy checks. The large ones exceed the
+    // synthetic images on purpose
+    std::vector<int> radii{ 1, 10, 64 };
+    std::vector<double> sigmas{ 1.0, 3.0, 8.0 };
+
+    // OpenCL device as understood by OpenCLImageProcessing::DeviceSelection::parse
+    std::string device;
+    bool fixedPointHsv = false;
+
+    // Tab-separated files. Thresholds are keyed by "backend|operation" or "operation", with
+    // "|synthetic" appended for the synthetic inputs, and override the built-in ones. The
+    // baseline holds the throughput per "backend|operation"
+    std::string thresholdsFile = "regressionThresholds.txt";
+    std::string baselineFile = "regressionBaseline.txt";
+
+    // The measurements of the performance check are written to resultsFile + ".json" and
+    // ".csv" like those of the benchmark, nothing is written if it is empty
+    std::string resultsFile;
+
+    // The median throughput over the bundled images may fall this fraction below the baseline.
+    // updateBaseline stores the measured throughput instead of comparing
+    bool performance = true;
+    bool updateBaseline = false;
+    double tolerance = 0.1;
+    int warmup = 2;
+    int iterations = 10;
+};
+
+// Failed checks of a run. Missing baseline entries and OpenCV's throughput are reported but
+// do not fail
+struct RegressionSummary {
+    int accuracyChecks = 0;
+    int accuracyFailures = 0;
+    int performanceChecks = 0;
+    int performanceFailures = 0;
+};
+
+// Parses the flags after --regression. Prints the usage and returns false on invalid input
+bool parseRegressionOptions(int argc, char** argv, RegressionOptions& options);
+void printRegressionUsage();
+
+// Built-in thresholds, overridden by the entries of the file if it exists
+std::map<std::string, RegressionThreshold> loadRegressionThresholds(const std::string& fileName);
+
+// Compares every backend and operation with OpenCV on the images and on synthetic edge cases
+// (1x1, odd sizes, 4 channels), then measures the throughput on the images and compares it
+// with the baseline
+RegressionSummary runRegression(const RegressionOptions& options, const std::vector<std::string>& images);
+
+#endif // REGRESSION_GATE_H
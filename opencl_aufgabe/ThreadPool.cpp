@@ -0,0 +1,126 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned int numThreads) : pendingTasks(0), nextQueue(0), stopping(false) {
+    // The calling thread of parallelFor is part of the pool, so one thread less is spawned
+    unsigned int numWorkers = std::max(numThreads, 1u) - 1;
+
+    for (unsigned int i = 0; i < numWorkers; ++i) {
+        queues.push_back(std::make_unique<WorkerQueue>());
+    }
+    for (unsigned int i = 0; i < numWorkers; ++i) {
+        workers.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        stopping = true;
+    }
+    wakeCondition.notify_all();
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
+
+unsigned int ThreadPool::size() const {
+    return static_cast<unsigned int>(workers.size()) + 1;
+}
+
+void ThreadPool::push(std::function<void()> task) {
+    // Distribute new tasks round robin, idle workers steal the rest
+    unsigned int index = nextQueue.fetch_add(1) % queues.size();
+    {
+        std::lock_guard<std::mutex> lock(queues[index]->mutex);
+        queues[index]->tasks.push_back(std::move(task));
+    }
+    pendingTasks.fetch_add(1);
+
+    std::lock_guard<std::mutex> lock(wakeMutex);
+    wakeCondition.notify_one();
+}
+
+bool ThreadPool::tryRunTask(unsigned int preferredQueue) {
+    std::function<void()> task;
+    const unsigned int numQueues = static_cast<unsigned int>(queues.size());
+
+    // Own queue first (newest task, still warm in the cache), then steal the oldest task of the others
+    for (unsigned int n = 0; n < numQueues && !task; ++n) {
+        WorkerQueue& queue = *queues[(preferredQueue + n) % numQueues];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty())
+            continue;
+
+        if (n == 0) {
+            task = std::move(queue.tasks.back());
+            queue.tasks.pop_back();
+        }
+        else {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+    }
+
+    if (!task)
+        return false;
+
+    pendingTasks.fetch_sub(1);
+    task();
+    return true;
+}
+
+void ThreadPool::workerLoop(unsigned int index) {
+    while (true) {
+        if (tryRunTask(index))
+            continue;
+
+        std::unique_lock<std::mutex> lock(wakeMutex);
+        wakeCondition.wait(lock, [this] { return stopping || pendingTasks.load() > 0; });
+        if (stopping && pendingTasks.load() == 0)
+            return;
+    }
+}
+
+void ThreadPool::parallelFor(int begin, int end, int grain, const std::function<void(int, int)>& body) {
+    if (begin >= end)
+        return;
+
+    grain = std::max(grain, 1);
+    const int numChunks = (end - begin + grain - 1) / grain;
+
+    // Nothing to share, run on the calling thread
+    if (workers.empty() || numChunks == 1) {
+        for (int chunkBegin = begin; chunkBegin < end; chunkBegin += grain) {
+            body(chunkBegin, std::min(chunkBegin + grain, end));
+        }
+        return;
+    }
+
+    struct Completion {
+        std::mutex mutex;
+        std::condition_variable condition;
+        int remaining;
+    };
+    auto completion = std::make_shared<Completion>();
+    completion->remaining = numChunks;
+
+    for (int chunkBegin = begin; chunkBegin < end; chunkBegin += grain) {
+        int chunkEnd = std::min(chunkBegin + grain, end);
+        push([completion, &body, chunkBegin, chunkEnd] {
+            body(chunkBegin, chunkEnd);
+
+            std::lock_guard<std::mutex> lock(completion->mutex);
+            if (--completion->remaining == 0)
+                completion->condition.notify_all();
+        });
+    }
+
+    // Help with the queued chunks, then wait for the ones still running on the workers
+    unsigned int helperQueue = nextQueue.load();
+    while (tryRunTask(helperQueue)) {}
+
+    std::unique_lock<std::mutex> lock(completion->mutex);
+    completion->condition.wait(lock, [&completion] { return completion->remaining == 0; });
+}
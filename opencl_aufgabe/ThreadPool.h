@@ -0,0 +1,51 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent work-stealing thread pool. Every worker owns a task queue, takes work from
+// the back of its own queue and steals from the front of the others when it runs dry.
+// The pool lives as long as its owner and is reused across calls and images
+class ThreadPool {
+public:
+    explicit ThreadPool(unsigned int numThreads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Number of threads working on a parallelFor, including the calling thread
+    unsigned int size() const;
+
+    // Splits [begin, end) into chunks of at most grain items and runs body(chunkBegin, chunkEnd)
+    // on the pool. Blocks until all chunks are done, the calling thread helps with the work
+    void parallelFor(int begin, int end, int grain, const std::function<void(int, int)>& body);
+
+private:
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+
+    std::mutex wakeMutex;
+    std::condition_variable wakeCondition;
+    std::atomic<int> pendingTasks;
+    std::atomic<unsigned int> nextQueue;
+    bool stopping;
+
+    void workerLoop(unsigned int index);
+    void push(std::function<void()> task);
+    bool tryRunTask(unsigned int preferredQueue);
+};
+
+#endif // THREAD_POOL_H
@@ -0,0 +1,241 @@
+#include "Trace.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+    struct HostEvent {
+        std::string name;
+        const char* category;
+        double begin;
+        double duration;
+    };
+
+    struct DeviceEvent {
+        std::string device;
+        std::string queue;
+        std::string name;
+        double enqueued;
+        uint64_t queuedNs;
+        uint64_t startNs;
+        uint64_t endNs;
+    };
+
+    // Each thread appends to its own buffer. The lock is only contended while the trace is
+    // written, the buffers outlive their threads so workers that ended are still in the trace
+    struct ThreadBuffer {
+        std::mutex mutex;
+        int tid;
+        std::string name;
+        std::vector<HostEvent> events;
+    };
+
+    struct Recorder {
+        std::atomic<bool> enabled{ false };
+        std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+        std::mutex mutex;
+        std::vector<std::shared_ptr<ThreadBuffer>> threads;
+        std::vector<DeviceEvent> deviceEvents;
+    };
+
+    Recorder& recorder() {
+        static Recorder instance;
+        return instance;
+    }
+
+    ThreadBuffer& threadBuffer() {
+        thread_local std::shared_ptr<ThreadBuffer> buffer;
+        if (!buffer) {
+            Recorder& rec = recorder();
+            std::lock_guard<std::mutex> lock(rec.mutex);
+            buffer = std::make_shared<ThreadBuffer>();
+            buffer->tid = static_cast<int>(rec.threads.size()) + 1;
+            buffer->name = "Thread " + std::to_string(buffer->tid);
+            rec.threads.push_back(buffer);
+        }
+        return *buffer;
+    }
+
+    void writeString(std::ostream& out, const std::string& text) {
+        out << '"';
+        for (char c : text) {
+            if (c == '"' || c == '\\')
+                out << '\\' << c;
+            else if (static_cast<unsigned char>(c) < 0x20)
+                out << ' ';
+            else
+                out << c;
+        }
+        out << '"';
+    }
+
+    void writeMetadata(std::ostream& out, bool& first, const char* kind, int pid, int tid, const std::string& name) {
+        out << (first ? "\n" : ",\n") << "{\"ph\":\"M\",\"name\":\"" << kind << "\",\"pid\":" << pid << ",\"tid\":" << tid
+            << ",\"args\":{\"name\":";
+        writeString(out, name);
+        out << "}}";
+        first = false;
+    }
+
+    void writeComplete(std::ostream& out, bool& first, const std::string& name, const char* category, int pid, int tid,
+        double begin, double duration) {
+        out << (first ? "\n" : ",\n") << "{\"ph\":\"X\",\"name\":";
+        writeString(out, name);
+        out << ",\"cat\":\"" << category << "\",\"pid\":" << pid << ",\"tid\":" << tid
+            << ",\"ts\":" << begin << ",\"dur\":" << std::max(0.0, duration) << "}";
+        first = false;
+    }
+}
+
+void Trace::setEnabled(bool enabled) {
+    recorder().enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool Trace::isEnabled() {
+    return recorder().enabled.load(std::memory_order_relaxed);
+}
+
+double Trace::now() {
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - recorder().origin;
+    return elapsed.count();
+}
+
+void Trace::span(const std::string& name, const char* category, double begin, double end) {
+    if (!isEnabled())
+        return;
+
+    ThreadBuffer& buffer = threadBuffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    buffer.events.push_back({ name, category, begin, end - begin });
+}
+
+void Trace::deviceSpan(const std::string& device, const std::string& queue, const std::string& name,
+    double enqueued, uint64_t queuedNs, uint64_t startNs, uint64_t endNs) {
+    if (!isEnabled())
+        return;
+
+    Recorder& rec = recorder();
+    std::lock_guard<std::mutex> lock(rec.mutex);
+    rec.deviceEvents.push_back({ device, queue, name, enqueued, queuedNs, startNs, endNs });
+}
+
+void Trace::setThreadName(const std::string& name) {
+    if (!isEnabled())
+        return;
+
+    ThreadBuffer& buffer = threadBuffer();
+    std::lock_guard<std::mutex> lock(buffer.mutex);
+    buffer.name = name;
+}
+
+bool Trace::write(const std::string& file) {
+    std::ofstream out(file);
+    if (!out) {
+        std::cerr << "Could not write the trace to " << file << std::endl;
+        return false;
+    }
+
+    Recorder& rec = recorder();
+    std::lock_guard<std::mutex> lock(rec.mutex);
+
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    bool first = true;
+
+    // Host threads are process 1
+    writeMetadata(out, first, "process_name", 1, 0, "Host");
+    for (const std::shared_ptr<ThreadBuffer>& thread : rec.threads) {
+        std::lock_guard<std::mutex> threadLock(thread->mutex);
+        writeMetadata(out, first, "thread_name", 1, thread->tid, thread->name);
+        for (const HostEvent& event : thread->events)
+            writeComplete(out, first, event.name, event.category, 1, thread->tid, event.begin, event.duration);
+    }
+
+    // Every device is a process of its own with a track per queue. A command is queued after
+    // the host started enqueueing it, so each command bounds the offset between the clocks
+    // from below and the largest bound is the closest one
+    std::map<std::string, double> offsets;
+    for (const DeviceEvent& event : rec.deviceEvents) {
+        double bound = event.enqueued - event.queuedNs * 1e-3;
+        auto found = offsets.find(event.device);
+        if (found == offsets.end())
+            offsets.emplace(event.device, bound);
+        else
+            found->second = std::max(found->second, bound);
+    }
+
+    std::map<std::string, int> devicePids;
+    std::map<std::pair<int, std::string>, int> queueTids;
+    for (const DeviceEvent& event : rec.deviceEvents) {
+        auto pid = devicePids.find(event.device);
+        if (pid == devicePids.end()) {
+            pid = devicePids.emplace(event.device, static_cast<int>(devicePids.size()) + 2).first;
+            writeMetadata(out, first, "process_name", pid->second, 0, "OpenCL " + event.device);
+        }
+        auto tid = queueTids.find({ pid->second, event.queue });
+        if (tid == queueTids.end()) {
+            tid = queueTids.emplace(std::make_pair(pid->second, event.queue), static_cast<int>(queueTids.size()) + 1).first;
+            writeMetadata(out, first, "thread_name", pid->second, tid->second, event.queue);
+        }
+
+        double offset = offsets[event.device];
+        writeComplete(out, first, event.name, "device", pid->second, tid->second,
+            offset + event.startNs * 1e-3, (event.endNs - event.startNs) * 1e-3);
+    }
+
+    out << "\n]}\n";
+    return static_cast<bool>(out);
+}
+
+void Trace::clear() {
+    Recorder& rec = recorder();
+    std::lock_guard<std::mutex> lock(rec.mutex);
+    rec.deviceEvents.clear();
+    for (const std::shared_ptr<ThreadBuffer>& thread : rec.threads) {
+        std::lock_guard<std::mutex> threadLock(thread->mutex);
+        thread->events.clear();
+    }
+}
+
+TraceSpan::TraceSpan(const char* name, const char* category) : category(category), begin(0.0), active(Trace::isEnabled()) {
+    if (active) {
+        this->name = name;
+        begin = Trace::now();
+    }
+}
+
+TraceSpan::TraceSpan(const std::string& name, const char* category) : category(category), begin(0.0), active(Trace::isEnabled()) {
+    if (active) {
+        this->name = name;
+        begin = Trace::now();
+    }
+}
+
+TraceSpan::~TraceSpan() {
+    if (active)
+        Trace::span(name, category, begin, Trace::now());
+}
+
+TraceSession::TraceSession(const std::string& file) : file(file) {
+    if (file.empty())
+        return;
+
+    Trace::setEnabled(true);
+    Trace::setThreadName("Main thread");
+}
+
+TraceSession::~TraceSession() {
+    if (file.empty())
+        return;
+
+    Trace::setEnabled(false);
+    if (Trace::write(file))
+        std::cout << "Trace written to " << file << ", open it in ui.perfetto.dev or chrome://tracing" << std::endl;
+}
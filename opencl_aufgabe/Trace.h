@@ -0,0 +1,66 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <cstdint>
+#include <string>
+
+// Timeline of decode, transfers, kernels and encode in the Chrome trace event format, which
+// Perfetto (ui.perfetto.dev) and chrome://tracing open. Host phases are recorded per thread
+// with TraceSpan, commands of the OpenCL queues from the timestamps of their events on one
+// track per queue. Recording is off until enabled, a span then only costs a flag check
+class Trace {
+public:
+    static void setEnabled(bool enabled);
+    static bool isEnabled();
+
+    // Microseconds on the trace clock, which starts with the program
+    static double now();
+
+    // Complete event on the calling thread's track
+    static void span(const std::string& name, const char* category, double begin, double end);
+
+    // Command of a device queue with the profiling timestamps of its event. enqueued is the
+    // trace time right before the command was enqueued. The device clock is mapped to the
+    // trace clock when the trace is written, so every command of a device uses the same offset
+    static void deviceSpan(const std::string& device, const std::string& queue, const std::string& name,
+        double enqueued, uint64_t queuedNs, uint64_t startNs, uint64_t endNs);
+
+    // Names the calling thread's track, e.g. for the decode and encode workers
+    static void setThreadName(const std::string& name);
+
+    // Writes everything recorded so far as {"traceEvents": [...]}
+    static bool write(const std::string& file);
+
+    // Drops everything recorded so far
+    static void clear();
+};
+
+// Records the time from construction to destruction on the calling thread
+class TraceSpan {
+public:
+    TraceSpan(const char* name, const char* category);
+    TraceSpan(const std::string& name, const char* category);
+    ~TraceSpan();
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    std::string name;
+    const char* category;
+    double begin;
+    bool active;
+};
+
+// Enables tracing while it lives and writes the trace when it ends. An empty file name
+// leaves tracing off, so main can always create one
+class TraceSession {
+public:
+    explicit TraceSession(const std::string& file);
+    ~TraceSession();
+
+private:
+    std::string file;
+};
+
+#endif // TRACE_H
@@ -1,25 +1,9 @@
-__kernel void rgbToHsv(__global const uchar* inputImage, 
-    __global uchar* outputImage, 
-    int width, int height, int depth)
+// HSV calculation of one pixel, hsv receives hue, saturation and value in the OpenCV byte format
+void rgbToHsvPixel(uchar red, uchar green, uchar blue, uchar* hsv)
 {
-    // store work-item's index
-    int x = get_global_id(0);
-    int y = get_global_id(1);
-
-    // check that the pixel doesn't go beyond image dimensions:
-    if (x >= width || y >= height)
-        return;
-
-    // get the actual pixel location in the image
-    const unsigned int loc = (y * width + x) * depth;
-    outputImage[loc] = inputImage[loc];
-    outputImage[loc + 1] = inputImage[loc + 1];
-    outputImage[loc + 2] = inputImage[loc + 2];
-
-    // HSV calculation
-    float r = inputImage[loc] / 255.0f;
-    float g = inputImage[loc + 1] / 255.0f;
-    float b = inputImage[loc + 2] / 255.0f;
+    float r = red / 255.0f;
+    float g = green / 255.0f;
+    float b = blue / 255.0f;
 
     float maxVal = max(r, max(g, b));
     float minVal = min(r, min(g, b));
@@ -33,7 +17,7 @@ __kernel void rgbToHsv(__global const uchar* inputImage,
         hue = 60 * ((g - b) / diff);
     else if (maxVal == g)
         hue = 60 * ((b - r) / diff) + 120;
-    else if (maxVal == b)
+    else
         hue = 60 * ((r - g) / diff) + 240;
 
     if (hue < 0)
@@ -45,11 +29,177 @@ __kernel void rgbToHsv(__global const uchar* inputImage,
         saturation = (diff / maxVal);
 
     // Modifying the output using hue, saturation, value
-    outputImage[loc] = (uchar)hue / 2; 
-    outputImage[loc + 1] = (uchar)(saturation * 255.0f);
-    outputImage[loc + 2] = (uchar)(value * 255.0f);
+    hsv[0] = (uchar)(hue / 2);
+    hsv[1] = (uchar)(saturation * 255.0f);
+    hsv[2] = (uchar)(value * 255.0f);
+}
+
+__kernel void rgbToHsv(__global const uchar* inputImage, 
+    __global uchar* outputImage, 
+    int width, int height, int depth)
+{
+    // store work-item's index
+    int x = get_global_id(0);
+    int y = get_global_id(1);
+
+    // check that the pixel doesn't go beyond image dimensions:
+    if (x >= width || y >= height)
+        return;
+
+    // get the actual pixel location in the image
+    const unsigned int loc = (y * width + x) * depth;
+
+    uchar hsv[3];
+    rgbToHsvPixel(inputImage[loc], inputImage[loc + 1], inputImage[loc + 2], hsv);
+
+    outputImage[loc] = hsv[0];
+    outputImage[loc + 1] = hsv[1];
+    outputImage[loc + 2] = hsv[2];
+
+    // Further channels (alpha) are passed through
+    for (int channels = 3; channels < depth; ++channels)
+        outputImage[loc + channels] = inputImage[loc + channels];
+}
+
+// HSV calculation of 4 pixels at once with the same operations as rgbToHsvPixel, so both
+// give identical bytes. All three hue candidates are computed and select keeps the one of the
+// maximum channel, lanes without a maximum channel divide by zero but end up with hue 0
+void rgbToHsv4(uchar4 red, uchar4 green, uchar4 blue, uchar4* hue, uchar4* saturation, uchar4* value)
+{
+    float4 r = convert_float4(red) / 255.0f;
+    float4 g = convert_float4(green) / 255.0f;
+    float4 b = convert_float4(blue) / 255.0f;
+
+    float4 maxVal = max(r, max(g, b));
+    float4 minVal = min(r, min(g, b));
+    float4 diff = maxVal - minVal;
+
+    float4 h = 60 * ((r - g) / diff) + 240;
+    h = select(h, 60 * ((b - r) / diff) + 120, maxVal == g);
+    h = select(h, 60 * ((g - b) / diff), maxVal == r);
+    h = select(h, (float4)(0.0f), maxVal == minVal);
+    h = select(h, h + 360, h < 0);
+
+    float4 s = select(diff / maxVal, (float4)(0.0f), maxVal == 0);
+
+    *hue = convert_uchar4(h / 2);
+    *saturation = convert_uchar4(s * 255.0f);
+    *value = convert_uchar4(maxVal * 255.0f);
+}
+
+// Vectorized variant for packed 3- and 4-channel images: every work-item converts
+// pixelsPerItem consecutive pixels (a multiple of 4), loading and storing the bytes of
+// 4 pixels with single vector loads and stores. The last work-item converts the pixels
+// that do not fill a vector one by one
+__kernel void rgbToHsvVector(__global const uchar* inputImage, __global uchar* outputImage,
+    const int pixelCount, const int depth, const int pixelsPerItem)
+{
+    const int begin = get_global_id(0) * pixelsPerItem;
+    const int end = min(begin + pixelsPerItem, pixelCount);
+    uchar4 hue, saturation, value;
+    int pixel = begin;
+
+    if (depth == 3) {
+        for (; pixel + 4 <= end; pixel += 4) {
+            // rgbrgbrg + brgb
+            const uchar8 low = vload8(0, inputImage + pixel * 3);
+            const uchar4 high = vload4(0, inputImage + pixel * 3 + 8);
+
+            rgbToHsv4((uchar4)(low.s0, low.s3, low.s6, high.s1), (uchar4)(low.s1, low.s4, low.s7, high.s2),
+                (uchar4)(low.s2, low.s5, high.s0, high.s3), &hue, &saturation, &value);
+
+            vstore8((uchar8)(hue.s0, saturation.s0, value.s0, hue.s1, saturation.s1, value.s1, hue.s2, saturation.s2),
+                0, outputImage + pixel * 3);
+            vstore4((uchar4)(value.s2, hue.s3, saturation.s3, value.s3), 0, outputImage + pixel * 3 + 8);
+        }
+    }
+    else if (depth == 4) {
+        for (; pixel + 4 <= end; pixel += 4) {
+            // Alpha is passed through
+            const uchar16 rgba = vload16(0, inputImage + pixel * 4);
+
+            rgbToHsv4(rgba.s048c, rgba.s159d, rgba.s26ae, &hue, &saturation, &value);
+
+            vstore16((uchar16)(hue.s0, saturation.s0, value.s0, rgba.s3, hue.s1, saturation.s1, value.s1, rgba.s7,
+                hue.s2, saturation.s2, value.s2, rgba.sb, hue.s3, saturation.s3, value.s3, rgba.sf),
+                0, outputImage + pixel * 4);
+        }
+    }
+
+    for (; pixel < end; ++pixel) {
+        const int loc = pixel * depth;
+
+        uchar hsv[3];
+        rgbToHsvPixel(inputImage[loc], inputImage[loc + 1], inputImage[loc + 2], hsv);
+
+        outputImage[loc] = hsv[0];
+        outputImage[loc + 1] = hsv[1];
+        outputImage[loc + 2] = hsv[2];
+        for (int channels = 3; channels < depth; ++channels)
+            outputImage[loc + channels] = inputImage[loc + channels];
+    }
+}
+
+// Integer HSV conversion without divisions, rounded like OpenCV's 8-bit conversion. The
+// tables hold 255 / v and 30 / delta in fixed point with HSV_SHIFT fraction bits, the host
+// fills them from hsvFixedPointTables. Every work-item converts pixelsPerItem pixels
+#define HSV_SHIFT 12
+
+void rgbToHsvFixedPointPixel(int r, int g, int b, __constant int* saturationTable, __constant int* hueTable,
+    uchar* hsv)
+{
+    const int rounding = 1 << (HSV_SHIFT - 1);
+    const int maxVal = max(r, max(g, b));
+    const int delta = maxVal - min(r, min(g, b));
+
+    // Hue difference of the maximum channel plus 2 or 4 times delta for green and blue
+    int h = select(select(r - g + 4 * delta, b - r + 2 * delta, maxVal == g), g - b, maxVal == r);
+    h = (h * hueTable[delta] + rounding) >> HSV_SHIFT;
+    h += select(0, 180, h < 0);
+
+    hsv[0] = (uchar)h;
+    hsv[1] = (uchar)((delta * saturationTable[maxVal] + rounding) >> HSV_SHIFT);
+    hsv[2] = (uchar)maxVal;
+}
+
+__kernel void rgbToHsvFixedPoint(__global const uchar* inputImage, __global uchar* outputImage,
+    __constant int* saturationTable, __constant int* hueTable, const int pixelCount, const int depth,
+    const int pixelsPerItem)
+{
+    const int begin = get_global_id(0) * pixelsPerItem;
+    const int end = min(begin + pixelsPerItem, pixelCount);
+
+    for (int pixel = begin; pixel < end; ++pixel) {
+        const int loc = pixel * depth;
+        uchar hsv[3];
+        rgbToHsvFixedPointPixel(inputImage[loc], inputImage[loc + 1], inputImage[loc + 2], saturationTable, hueTable, hsv);
+
+        outputImage[loc] = hsv[0];
+        outputImage[loc + 1] = hsv[1];
+        outputImage[loc + 2] = hsv[2];
+
+        // Further channels (alpha) are passed through
+        for (int channels = 3; channels < depth; ++channels)
+            outputImage[loc + channels] = inputImage[loc + channels];
+    }
 }
 
+// Radius and channel count of the blur kernels. Specialized programs are built with
+// -D RADIUS=.. -D CHANNELS=.., which gives the window loops constant trip counts the compiler
+// can unroll. The generic program takes both from the kernel arguments kernelSize and depth,
+// which every blur kernel still receives
+#ifdef RADIUS
+#define BLUR_RADIUS RADIUS
+#else
+#define BLUR_RADIUS kernelSize
+#endif
+
+#ifdef CHANNELS
+#define BLUR_CHANNELS CHANNELS
+#else
+#define BLUR_CHANNELS depth
+#endif
+
 __kernel void blur(__global uchar* inputImage, __global uchar* outputImage, const int width, 
     const int height, const int depth, const int kernelSize)
 {
@@ -57,28 +207,518 @@ __kernel void blur(__global uchar* inputImage, __global uchar* outputImage, cons
     const int posx = get_global_id(0);
     const int posy = get_global_id(1);
 
+    // check that the pixel doesn't go beyond image dimensions, the global size is padded
+    if (posx >= width || posy >= height)
+        return;
+
     // Total number of pixels in the kernel
-    int divider = ((2 * kernelSize + 1) * (2 * kernelSize + 1));
+    int divider = ((2 * BLUR_RADIUS + 1) * (2 * BLUR_RADIUS + 1));
 
     // Blur operation
-    for (int channels = 0; channels < depth; ++channels) { // Iterate over RGB channels
+    for (int channels = 0; channels < BLUR_CHANNELS; ++channels) { // Iterate over RGB channels
         float sum = 0.0f;
 
-        for (int i = -kernelSize; i <= kernelSize; ++i) {
-            for (int j = -kernelSize; j <= kernelSize; ++j) {
+        for (int i = -BLUR_RADIUS; i <= BLUR_RADIUS; ++i) {
+            for (int j = -BLUR_RADIUS; j <= BLUR_RADIUS; ++j) {
                 // Make sure the indices are within bounds.
                 int x = clamp(posx + i, 0, width - 1);
                 int y = clamp(posy + j, 0, height - 1);
 
                 if (x >= 0 && x < width && y >= 0 && y < height) {
-                    int index = (y * width + x) * depth + channels; // Calculate index for current channel
+                    int index = (y * width + x) * BLUR_CHANNELS + channels; // Calculate index for current channel
                     sum += inputImage[index];
                 }
             }
         }
 
         float result = sum / divider;
-        int outIndex = (posy * width + posx) * depth + channels; // Output index for current channel
+        int outIndex = (posy * width + posx) * BLUR_CHANNELS + channels; // Output index for current channel
         outputImage[outIndex] = (uchar)result;
     }
-}
\ No newline at end of file
+}
+
+// Box blur of one pixel from a tile in local memory that holds the work-group's pixels plus
+// a halo of kernelSize pixels on every side
+void blurFromTile(__local const uchar* tile, __global uchar* outputImage, const int posx, const int posy,
+    const int width, const int depth, const int kernelSize)
+{
+    const int localX = get_local_id(0);
+    const int localY = get_local_id(1);
+    const int tileWidth = get_local_size(0) + 2 * BLUR_RADIUS;
+    const uint divider = (2 * BLUR_RADIUS + 1) * (2 * BLUR_RADIUS + 1);
+
+    for (int channels = 0; channels < BLUR_CHANNELS; ++channels) {
+        uint sum = 0;
+
+        for (int j = 0; j <= 2 * BLUR_RADIUS; ++j) {
+            const int rowStart = ((localY + j) * tileWidth + localX) * BLUR_CHANNELS + channels;
+            for (int i = 0; i <= 2 * BLUR_RADIUS; ++i) {
+                sum += tile[rowStart + i * BLUR_CHANNELS];
+            }
+        }
+
+        outputImage[(posy * width + posx) * BLUR_CHANNELS + channels] = (uchar)(sum / divider);
+    }
+}
+
+// Tiled variant: the work-group cooperatively loads its tile plus a halo of kernelSize pixels
+// on every side into local memory, clamped to the image border, and blurs from there.
+// tile must hold (local width + 2 * kernelSize) * (local height + 2 * kernelSize) * depth bytes
+__kernel void blurLocal(__global const uchar* inputImage, __global uchar* outputImage, const int width,
+    const int height, const int depth, const int kernelSize, __local uchar* tile)
+{
+    const int posx = get_global_id(0);
+    const int posy = get_global_id(1);
+    const int localX = get_local_id(0);
+    const int localY = get_local_id(1);
+    const int localWidth = get_local_size(0);
+    const int localHeight = get_local_size(1);
+
+    // Top left corner of the tile including the halo, in image coordinates
+    const int originX = get_group_id(0) * localWidth - BLUR_RADIUS;
+    const int originY = get_group_id(1) * localHeight - BLUR_RADIUS;
+    const int tileWidth = localWidth + 2 * BLUR_RADIUS;
+    const int tileHeight = localHeight + 2 * BLUR_RADIUS;
+
+    // Neighbouring work-items load neighbouring pixels, so the global reads are coalesced
+    for (int ty = localY; ty < tileHeight; ty += localHeight) {
+        const int y = clamp(originY + ty, 0, height - 1);
+        for (int tx = localX; tx < tileWidth; tx += localWidth) {
+            const int x = clamp(originX + tx, 0, width - 1);
+            for (int channels = 0; channels < BLUR_CHANNELS; ++channels) {
+                tile[(ty * tileWidth + tx) * BLUR_CHANNELS + channels] = inputImage[(y * width + x) * BLUR_CHANNELS + channels];
+            }
+        }
+    }
+
+    // Every work-item has to reach the barrier, the bounds check comes afterwards
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if (posx >= width || posy >= height)
+        return;
+
+    blurFromTile(tile, outputImage, posx, posy, width, BLUR_CHANNELS, BLUR_RADIUS);
+}
+
+// Fused HSV conversion and tiled blur: the tile plus halo is converted to HSV while it is
+// loaded into local memory, so the HSV image never goes through global memory
+__kernel void rgbToHsvBlurLocal(__global const uchar* inputImage, __global uchar* outputImage, const int width,
+    const int height, const int depth, const int kernelSize, __local uchar* tile)
+{
+    const int posx = get_global_id(0);
+    const int posy = get_global_id(1);
+    const int localX = get_local_id(0);
+    const int localY = get_local_id(1);
+    const int localWidth = get_local_size(0);
+    const int localHeight = get_local_size(1);
+
+    // Top left corner of the tile including the halo, in image coordinates
+    const int originX = get_group_id(0) * localWidth - BLUR_RADIUS;
+    const int originY = get_group_id(1) * localHeight - BLUR_RADIUS;
+    const int tileWidth = localWidth + 2 * BLUR_RADIUS;
+    const int tileHeight = localHeight + 2 * BLUR_RADIUS;
+
+    for (int ty = localY; ty < tileHeight; ty += localHeight) {
+        const int y = clamp(originY + ty, 0, height - 1);
+        for (int tx = localX; tx < tileWidth; tx += localWidth) {
+            const int x = clamp(originX + tx, 0, width - 1);
+            const int loc = (y * width + x) * BLUR_CHANNELS;
+            const int tileLoc = (ty * tileWidth + tx) * BLUR_CHANNELS;
+
+            uchar hsv[3];
+            rgbToHsvPixel(inputImage[loc], inputImage[loc + 1], inputImage[loc + 2], hsv);
+
+            tile[tileLoc] = hsv[0];
+            tile[tileLoc + 1] = hsv[1];
+            tile[tileLoc + 2] = hsv[2];
+            for (int channels = 3; channels < BLUR_CHANNELS; ++channels)
+                tile[tileLoc + channels] = inputImage[loc + channels];
+        }
+    }
+
+    // Every work-item has to reach the barrier, the bounds check comes afterwards
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if (posx >= width || posy >= height)
+        return;
+
+    blurFromTile(tile, outputImage, posx, posy, width, BLUR_CHANNELS, BLUR_RADIUS);
+}
+
+// Separable variant, first pass: horizontal window sums of every pixel and channel
+__kernel void blurHorizontal(__global const uchar* inputImage, __global uint* rowSums, const int width,
+    const int height, const int depth, const int kernelSize)
+{
+    const int posx = get_global_id(0);
+    const int posy = get_global_id(1);
+
+    if (posx >= width || posy >= height)
+        return;
+
+    __global const uchar* row = inputImage + posy * width * BLUR_CHANNELS;
+    const bool inside = posx - BLUR_RADIUS >= 0 && posx + BLUR_RADIUS < width;
+
+    for (int channels = 0; channels < BLUR_CHANNELS; ++channels) {
+        uint sum = 0;
+
+        // Clamping is only needed for the pixels near the left and right border
+        if (inside) {
+            for (int i = posx - BLUR_RADIUS; i <= posx + BLUR_RADIUS; ++i) {
+                sum += row[i * BLUR_CHANNELS + channels];
+            }
+        }
+        else {
+            for (int i = posx - BLUR_RADIUS; i <= posx + BLUR_RADIUS; ++i) {
+                sum += row[clamp(i, 0, width - 1) * BLUR_CHANNELS + channels];
+            }
+        }
+
+        rowSums[(posy * width + posx) * BLUR_CHANNELS + channels] = sum;
+    }
+}
+
+// Separable variant, second pass: every work-item owns one column (pixel and channel) of a
+// segment of rowsPerItem rows and slides a running vertical sum over it, so the cost per
+// output is constant apart from the initial window of each segment
+__kernel void blurVertical(__global const uint* rowSums, __global uchar* outputImage, const int width,
+    const int height, const int depth, const int kernelSize, const int rowsPerItem)
+{
+    const int column = get_global_id(0);
+    const int rowBegin = get_global_id(1) * rowsPerItem;
+    const int stride = width * BLUR_CHANNELS;
+
+    if (column >= stride || rowBegin >= height)
+        return;
+
+    const int rowEnd = min(rowBegin + rowsPerItem, height);
+    const uint divider = (2 * BLUR_RADIUS + 1) * (2 * BLUR_RADIUS + 1);
+
+    // Initial window around the first row of the segment, clamped to the image border
+    uint sum = 0;
+    for (int j = rowBegin - BLUR_RADIUS; j <= rowBegin + BLUR_RADIUS; ++j) {
+        sum += rowSums[clamp(j, 0, height - 1) * stride + column];
+    }
+
+    for (int posy = rowBegin; posy < rowEnd; ++posy) {
+        outputImage[posy * stride + column] = (uchar)(sum / divider);
+
+        // Slide the window down: add the row entering at the bottom, remove the one leaving at the top
+        const int enter = min(posy + BLUR_RADIUS + 1, height - 1);
+        const int leave = max(posy - BLUR_RADIUS, 0);
+        sum += rowSums[enter * stride + column] - rowSums[leave * stride + column];
+    }
+}
+
+// Variants for CPU devices. A CPU runs the work-items of a group one after another on a few
+// cores, so every work-item takes a long run of pixels and the compiler vectorizes its loop
+__kernel void rgbToHsvChunked(__global const uchar* inputImage, __global uchar* outputImage,
+    const int width, const int height, const int depth, const int pixelsPerItem)
+{
+    const int pixelCount = width * height;
+    const int begin = get_global_id(0) * pixelsPerItem;
+    const int end = min(begin + pixelsPerItem, pixelCount);
+
+    for (int pixel = begin; pixel < end; ++pixel) {
+        const int loc = pixel * depth;
+
+        uchar hsv[3];
+        rgbToHsvPixel(inputImage[loc], inputImage[loc + 1], inputImage[loc + 2], hsv);
+
+        outputImage[loc] = hsv[0];
+        outputImage[loc + 1] = hsv[1];
+        outputImage[loc + 2] = hsv[2];
+
+        // Further channels (alpha) are passed through
+        for (int channels = 3; channels < depth; ++channels)
+            outputImage[loc + channels] = inputImage[loc + channels];
+    }
+}
+
+__kernel void blurHorizontalRows(__global const uchar* inputImage, __global uint* rowSums, const int width,
+    const int height, const int depth, const int kernelSize)
+{
+    // One work-item per row and channel slides the window along the whole row
+    const int channel = get_global_id(0);
+    const int posy = get_global_id(1);
+
+    if (channel >= BLUR_CHANNELS || posy >= height)
+        return;
+
+    __global const uchar* row = inputImage + posy * width * BLUR_CHANNELS;
+    __global uint* sums = rowSums + posy * width * BLUR_CHANNELS;
+
+    // Initial window around the first pixel, clamped to the image border
+    uint sum = 0;
+    for (int i = -BLUR_RADIUS; i <= BLUR_RADIUS; ++i) {
+        sum += row[clamp(i, 0, width - 1) * BLUR_CHANNELS + channel];
+    }
+
+    for (int posx = 0; posx < width; ++posx) {
+        sums[posx * BLUR_CHANNELS + channel] = sum;
+
+        // Slide the window right: add the pixel entering on the right, remove the one leaving on the left
+        const int enter = min(posx + BLUR_RADIUS + 1, width - 1);
+        const int leave = max(posx - BLUR_RADIUS, 0);
+        sum += row[enter * BLUR_CHANNELS + channel] - row[leave * BLUR_CHANNELS + channel];
+    }
+}
+
+// Sampled Gaussian for sigmas too small for the box passes, first pass: weighted sums of the
+// column window of every pixel and channel, the border clamped like in the box blur
+__kernel void gaussianVertical(__global const uchar* inputImage, __global float* columnSums, const int width,
+    const int height, const int depth, const int radius, __constant float* weights)
+{
+    const int posx = get_global_id(0);
+    const int posy = get_global_id(1);
+
+    if (posx >= width || posy >= height)
+        return;
+
+    for (int channels = 0; channels < depth; ++channels) {
+        float sum = 0.0f;
+        for (int j = -radius; j <= radius; ++j)
+            sum += weights[j + radius] * inputImage[(clamp(posy + j, 0, height - 1) * width + posx) * depth + channels];
+        columnSums[(posy * width + posx) * depth + channels] = sum;
+    }
+}
+
+// Second pass: weighted sums of the row window of the column sums, rounded to bytes
+__kernel void gaussianHorizontal(__global const float* columnSums, __global uchar* outputImage, const int width,
+    const int height, const int depth, const int radius, __constant float* weights)
+{
+    const int posx = get_global_id(0);
+    const int posy = get_global_id(1);
+
+    if (posx >= width || posy >= height)
+        return;
+
+    __global const float* row = columnSums + posy * width * depth;
+    for (int channels = 0; channels < depth; ++channels) {
+        float sum = 0.0f;
+        for (int i = -radius; i <= radius; ++i)
+            sum += weights[i + radius] * row[clamp(posx + i, 0, width - 1) * depth + channels];
+        outputImage[(posy * width + posx) * depth + channels] = convert_uchar_sat_rte(sum);
+    }
+}
+
+// Batches of small images in one launch. The staging buffer starts with a table of ints:
+// byte offset, width, height and depth of every image, then the first pixel index of every
+// image and the total pixel count. The image data follows at dataOffset, the byte offsets
+// count from there and are the same in the packed output. Every work-item handles one pixel
+int findBatchImage(__global const int* pixelStarts, const int numImages, const int pixel)
+{
+    // Last image whose first pixel is not behind this pixel
+    int low = 0;
+    int high = numImages - 1;
+    while (low < high) {
+        const int middle = (low + high + 1) / 2;
+        if (pixelStarts[middle] <= pixel)
+            low = middle;
+        else
+            high = middle - 1;
+    }
+    return low;
+}
+
+__kernel void rgbToHsvBatch(__global const uchar* staging, __global uchar* outputImages, const int numImages,
+    const int dataOffset)
+{
+    __global const int* table = (__global const int*)staging;
+    __global const int* pixelStarts = table + 4 * numImages;
+    const int pixel = get_global_id(0);
+
+    if (pixel >= pixelStarts[numImages])
+        return;
+
+    const int image = findBatchImage(pixelStarts, numImages, pixel);
+    const int depth = table[4 * image + 3];
+    const int loc = table[4 * image] + (pixel - pixelStarts[image]) * depth;
+    __global const uchar* inputImages = staging + dataOffset;
+
+    uchar hsv[3];
+    rgbToHsvPixel(inputImages[loc], inputImages[loc + 1], inputImages[loc + 2], hsv);
+
+    outputImages[loc] = hsv[0];
+    outputImages[loc + 1] = hsv[1];
+    outputImages[loc + 2] = hsv[2];
+    for (int channels = 3; channels < depth; ++channels)
+        outputImages[loc + channels] = inputImages[loc + channels];
+}
+
+// rgbToHsvBatch with the fixed-point conversion, so batches match the per-image result in that mode
+__kernel void rgbToHsvFixedPointBatch(__global const uchar* staging, __global uchar* outputImages, const int numImages,
+    const int dataOffset, __constant int* saturationTable, __constant int* hueTable)
+{
+    __global const int* table = (__global const int*)staging;
+    __global const int* pixelStarts = table + 4 * numImages;
+    const int pixel = get_global_id(0);
+
+    if (pixel >= pixelStarts[numImages])
+        return;
+
+    const int image = findBatchImage(pixelStarts, numImages, pixel);
+    const int depth = table[4 * image + 3];
+    const int loc = table[4 * image] + (pixel - pixelStarts[image]) * depth;
+    __global const uchar* inputImages = staging + dataOffset;
+
+    uchar hsv[3];
+    rgbToHsvFixedPointPixel(inputImages[loc], inputImages[loc + 1], inputImages[loc + 2], saturationTable, hueTable, hsv);
+
+    outputImages[loc] = hsv[0];
+    outputImages[loc + 1] = hsv[1];
+    outputImages[loc + 2] = hsv[2];
+    for (int channels = 3; channels < depth; ++channels)
+        outputImages[loc + channels] = inputImages[loc + channels];
+}
+
+// Separable blur of a batch, first pass: horizontal window sums at the same offsets as the bytes
+__kernel void blurHorizontalBatch(__global const uchar* staging, __global uint* rowSums, const int numImages,
+    const int dataOffset, const int kernelSize)
+{
+    __global const int* table = (__global const int*)staging;
+    __global const int* pixelStarts = table + 4 * numImages;
+    const int pixel = get_global_id(0);
+
+    if (pixel >= pixelStarts[numImages])
+        return;
+
+    const int image = findBatchImage(pixelStarts, numImages, pixel);
+    const int offset = table[4 * image];
+    const int width = table[4 * image + 1];
+    const int depth = table[4 * image + 3];
+    const int posx = (pixel - pixelStarts[image]) % width;
+    const int posy = (pixel - pixelStarts[image]) / width;
+    __global const uchar* row = staging + dataOffset + offset + posy * width * depth;
+
+    for (int channels = 0; channels < depth; ++channels) {
+        uint sum = 0;
+        for (int i = posx - kernelSize; i <= posx + kernelSize; ++i) {
+            sum += row[clamp(i, 0, width - 1) * depth + channels];
+        }
+        rowSums[offset + (posy * width + posx) * depth + channels] = sum;
+    }
+}
+
+// Second pass: vertical sums of the horizontal sums, clamped to the image's own rows
+__kernel void blurVerticalBatch(__global const uchar* staging, __global const uint* rowSums,
+    __global uchar* outputImages, const int numImages, const int kernelSize)
+{
+    __global const int* table = (__global const int*)staging;
+    __global const int* pixelStarts = table + 4 * numImages;
+    const int pixel = get_global_id(0);
+
+    if (pixel >= pixelStarts[numImages])
+        return;
+
+    const int image = findBatchImage(pixelStarts, numImages, pixel);
+    const int offset = table[4 * image];
+    const int width = table[4 * image + 1];
+    const int height = table[4 * image + 2];
+    const int depth = table[4 * image + 3];
+    const int posx = (pixel - pixelStarts[image]) % width;
+    const int posy = (pixel - pixelStarts[image]) / width;
+    const uint divider = (2 * kernelSize + 1) * (2 * kernelSize + 1);
+
+    for (int channels = 0; channels < depth; ++channels) {
+        uint sum = 0;
+        for (int j = posy - kernelSize; j <= posy + kernelSize; ++j) {
+            sum += rowSums[offset + (clamp(j, 0, height - 1) * width + posx) * depth + channels];
+        }
+        outputImages[offset + (posy * width + posx) * depth + channels] = (uchar)(sum / divider);
+    }
+}
+
+// Summed-area table with a leading zero row and column: (height + 1) x (width + 1) x depth.
+// First pass: every work-item writes the prefix sums of one row
+__kernel void integralRows(__global const uchar* inputImage, __global uint* integralImage,
+    const int width, const int height, const int depth)
+{
+    const int row = get_global_id(0);
+    if (row > height)
+        return;
+
+    const int stride = (width + 1) * depth;
+    __global uint* current = integralImage + row * stride;
+
+    for (int channels = 0; channels < depth; ++channels) {
+        current[channels] = 0;
+        uint rowPrefix = 0;
+
+        for (int x = 0; x < width; ++x) {
+            // Row 0 of the table stays zero
+            if (row > 0)
+                rowPrefix += inputImage[((row - 1) * width + x) * depth + channels];
+            current[(x + 1) * depth + channels] = rowPrefix;
+        }
+    }
+}
+
+// Second pass: every work-item accumulates one column of the table downwards.
+// The table may wrap around 2^32, the four-lookup differences stay exact as long as the
+// queried rectangle sums to less than 2^32
+__kernel void integralColumns(__global uint* integralImage, const int width, const int height,
+    const int depth)
+{
+    const int column = get_global_id(0);
+    const int stride = (width + 1) * depth;
+    if (column >= stride)
+        return;
+
+    uint sum = 0;
+    for (int row = 1; row <= height; ++row) {
+        sum += integralImage[row * stride + column];
+        integralImage[row * stride + column] = sum;
+    }
+}
+
+// Sum over the inclusive rectangle [x0, x1] x [y0, y1] of one channel
+uint integralSum(__global const uint* integralImage, const int stride, const int depth,
+    int x0, int y0, int x1, int y1, int channel)
+{
+    __global const uint* top = integralImage + y0 * stride;
+    __global const uint* bottom = integralImage + (y1 + 1) * stride;
+    const int left = x0 * depth + channel;
+    const int right = (x1 + 1) * depth + channel;
+
+    return bottom[right] - top[right] - bottom[left] + top[left];
+}
+
+__kernel void blurIntegral(__global const uint* integralImage, __global uchar* outputImage,
+    const int width, const int height, const int depth, const int radiusX, const int radiusY)
+{
+    const int posx = get_global_id(0);
+    const int posy = get_global_id(1);
+
+    if (posx >= width || posy >= height)
+        return;
+
+    const int stride = (width + 1) * depth;
+    const ulong divider = (ulong)(2 * radiusX + 1) * (2 * radiusY + 1);
+
+    // A clamped window splits into up to three segments per axis: the first pixel repeated,
+    // the part inside the image and the last pixel repeated
+    int fromX[3] = { 0, max(posx - radiusX, 0), width - 1 };
+    int toX[3] = { 0, min(posx + radiusX, width - 1), width - 1 };
+    int weightX[3] = { max(radiusX - posx, 0), 1, max(posx + radiusX - (width - 1), 0) };
+
+    int fromY[3] = { 0, max(posy - radiusY, 0), height - 1 };
+    int toY[3] = { 0, min(posy + radiusY, height - 1), height - 1 };
+    int weightY[3] = { max(radiusY - posy, 0), 1, max(posy + radiusY - (height - 1), 0) };
+
+    for (int channels = 0; channels < depth; ++channels) {
+        ulong sum = 0;
+
+        for (int sy = 0; sy < 3; ++sy) {
+            if (weightY[sy] == 0)
+                continue;
+            for (int sx = 0; sx < 3; ++sx) {
+                if (weightX[sx] == 0)
+                    continue;
+                sum += (ulong)weightY[sy] * weightX[sx] * integralSum(integralImage, stride, depth,
+                    fromX[sx], fromY[sy], toX[sx], toY[sy], channels);
+            }
+        }
+
+        outputImage[(posy * width + posx) * depth + channels] = (uchar)(sum / divider);
+    }
+}
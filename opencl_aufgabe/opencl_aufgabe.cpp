@@ -1,10 +1,17 @@
 #include <iostream>
 #include <fstream>
 #include <chrono>
+#include <cstdlib>
+#include <algorithm>
+#include <sstream>
 #include "OpenCLImageProcessing.h"
 #include "ImageProcessorInterface.h"
 #include "CpuImageProcessing.h"
 #include "OpenCVImageProcessing.h"
+#include "Benchmark.h"
+#include "DirectoryBatch.h"
+#include "RegressionGate.h"
+#include "Trace.h"
 
 void evaluateRuntime(std::vector<std::string>& files, std::string& path) {
     
@@ -15,11 +22,35 @@ void evaluateRuntime(std::vector<std::string>& files, std::string& path) {
     // Number of runs
     const int num_runs = 100;
 
+    oclip.runtime(files, path, num_runs);
+
+    // Same measurement without host copies where the memory allows it
+    oclip.setMemoryMode(OpenCLImageProcessing::MemoryMode::ZeroCopy);
     oclip.runtime(files, path, num_runs);
     ocvip.runtime(files, path, num_runs);
     cip.runtime(files, path, num_runs);
 }
 
+void evaluateScaling(std::vector<std::string>& files, std::string& path) {
+
+    CpuImageProcessing cip;
+
+    // Number of runs per thread count
+    const int num_runs = 10;
+
+    cip.scalingEvaluation(files, path, num_runs);
+}
+
+void executeStreaming(std::vector<std::string>& files, std::string& path) {
+
+    OpenCLImageProcessing oclip;
+
+    // Same blur size as the demo
+    const int kernelSize = 10;
+
+    oclip.streamBatch(files, path, kernelSize);
+}
+
 void executeDemo(std::vector<std::string>& files, std::string& path) {
     // show the demos that can be run
     int option = 0;
@@ -68,7 +99,158 @@ void executeDemo(std::vector<std::string>& files, std::string& path) {
     }
 }
 
-int main()
+int runBenchmarkMode(int argc, char** argv, std::vector<std::string>& files, std::string& path) {
+    BenchmarkOptions options;
+    if (!parseBenchmarkOptions(argc, argv, options))
+        return 1;
+
+    // Without images or sizes on the command line the pictures of the menu are measured
+    if (options.images.empty() && options.sizes.empty()) {
+        for (const std::string& file : files)
+            options.images.push_back(path + file);
+    }
+
+    std::vector<BenchmarkResult> results = runBenchmark(options);
+    // An empty file name skips that file, so only the written ones are named
+    std::vector<std::string> written;
+    for (const std::string& file : { options.jsonFile, options.csvFile }) {
+        if (!file.empty())
+            written.push_back(file);
+    }
+    if (written.size() == 2)
+        std::cout << "Wrote " << results.size() << " results to " << written[0] << " and " << written[1] << std::endl;
+    else if (written.size() == 1)
+        std::cout << "Wrote " << results.size() << " results to " << written[0] << std::endl;
+    return 0;
+}
+
+int runDirectoryBatchMode(int argc, char** argv) {
+    DirectoryBatchOptions options;
+    if (!parseDirectoryBatchOptions(argc, argv, options))
+        return 1;
+
+    DirectoryBatchSummary summary = runDirectoryBatch(options);
+    return summary.failed == 0 ? 0 : 1;
+}
+
+int runAutotuneMode(int argc, char** argv, std::vector<std::string>& files, std::string& path) {
+    // Optional blur radius to tune for, the menu uses 10
+    int kernelSize = 10;
+    if (argc > 0) {
+        kernelSize = std::atoi(argv[0]);
+        if (kernelSize < 1) {
+            std::cerr << "Usage: opencl_aufgabe --autotune [radius]" << std::endl;
+            return 1;
+        }
+    }
+
+    OpenCLImageProcessing oclip;
+    for (const std::string& file : files) {
+        cv::Mat image = cv::imread(path + file);
+        if (image.empty()) {
+            std::cerr << "Could not read " << path + file << ", skipping it" << std::endl;
+            continue;
+        }
+        oclip.autotune(image.cols, image.rows, image.channels(), kernelSize);
+    }
+    return 0;
+}
+
+int runGaussianAccuracyMode(int argc, char** argv, std::vector<std::string>& files, std::string& path) {
+    // Optional comma-separated sigmas, by default a small, a medium and a large one
+    std::vector<double> sigmas{ 1.0, 3.0, 8.0 };
+    if (argc > 0) {
+        sigmas.clear();
+        std::stringstream list(argv[0]);
+        std::string sigma;
+        while (std::getline(list, sigma, ','))
+            sigmas.push_back(std::atof(sigma.c_str()));
+        if (sigmas.empty() || *std::min_element(sigmas.begin(), sigmas.end()) <= 0.0) {
+            std::cerr << "Usage: opencl_aufgabe --gaussian-accuracy [sigma,...]" << std::endl;
+            return 1;
+        }
+    }
+
+    OpenCVImageProcessing ocvip;
+    CpuImageProcessing cip;
+    OpenCLImageProcessing oclip;
+    std::vector<std::pair<std::string, ImageProcessorInterface*>> backends{ { "CPU", &cip }, { "OpenCL", &oclip } };
+
+    // Prepare to write the accuracy into .txt file
+    std::ofstream myfile;
+    myfile.open("gaussianEvaluation.txt", std::fstream::app);
+
+    for (int i = 0; i < files.size(); i++) {
+        cv::Mat inputImage = cv::imread(path + files.at(i));
+        if (inputImage.empty()) {
+            std::cerr << "Could not read " << path + files.at(i) << ", skipping it" << std::endl;
+            continue;
+        }
+
+        for (double sigma : sigmas) {
+            cv::Mat reference;
+            ocvip.gaussianBlur(inputImage, reference, sigma);
+
+            for (const auto& backend : backends) {
+                for (int passes = GAUSSIAN_MIN_PASSES; passes <= GAUSSIAN_MAX_PASSES; passes++) {
+                    // Sigmas too small for the boxes use the sampled kernel, whatever the passes
+                    const bool sampledKernel = gaussianBoxRadii(sigma, passes).empty();
+                    cip.setGaussianPasses(passes);
+                    oclip.setGaussianPasses(passes);
+
+                    cv::Mat result;
+                    backend.second->gaussianBlur(inputImage, result, sigma);
+
+                    // Largest and average difference per channel value and the PSNR against cv::GaussianBlur
+                    cv::Mat difference;
+                    cv::absdiff(result, reference, difference);
+                    double maxDifference;
+                    cv::minMaxLoc(difference.reshape(1), nullptr, &maxDifference);
+                    cv::Scalar meanDifference = cv::mean(difference);
+                    double meanAll = 0.0;
+                    for (int c = 0; c < difference.channels(); c++)
+                        meanAll += meanDifference[c] / difference.channels();
+
+                    std::string notifyAccuracy = "Gaussian " + backend.first + " vs OpenCV, Picture " + std::to_string(i + 1)
+                        + ", sigma " + std::to_string(sigma) + ", "
+                        + (sampledKernel ? std::string("sampled kernel") : std::to_string(passes) + " passes") + ": max diff "
+                        + std::to_string(static_cast<int>(maxDifference)) + ", mean diff " + std::to_string(meanAll)
+                        + ", PSNR " + std::to_string(cv::PSNR(result, reference)) + " dB\n";
+
+                    // Output the accuracy
+                    std::cout << notifyAccuracy;
+                    myfile << notifyAccuracy;
+
+                    // More passes need a larger sigma for the boxes, they would repeat this result
+                    if (sampledKernel)
+                        break;
+                }
+            }
+        }
+    }
+
+    myfile.close();
+    return 0;
+}
+
+int runRegressionMode(int argc, char** argv, std::vector<std::string>& files, std::string& path) {
+    RegressionOptions options;
+    if (!parseRegressionOptions(argc, argv, options))
+        return 1;
+
+    std::vector<std::string> images;
+    for (const std::string& file : files)
+        images.push_back(path + file);
+
+    // Any failed check fails the run, so scripts can gate on the exit code
+    RegressionSummary summary = runRegression(options, images);
+    std::cout << "Regression: " << summary.accuracyChecks - summary.accuracyFailures << "/" << summary.accuracyChecks
+        << " accuracy checks and " << summary.performanceChecks - summary.performanceFailures << "/"
+        << summary.performanceChecks << " throughput checks passed" << std::endl;
+    return summary.accuracyFailures == 0 && summary.performanceFailures == 0 ? 0 : 1;
+}
+
+int main(int argc, char** argv)
 {
     // initialize images that are going to be used
     std::string path = "images\\";
@@ -84,6 +266,33 @@ int main()
         "nature\\4.nature_mega.jpeg",
     };
 
+    // --trace file.json records a timeline of everything that follows, in any mode. The trace
+    // is written when the session ends with main
+    std::string traceFile;
+    if (argc > 2 && std::string(argv[1]) == "--trace") {
+        traceFile = argv[2];
+        argc -= 2;
+        argv += 2;
+    }
+    TraceSession traceSession(traceFile);
+
+    if (argc > 1 && std::string(argv[1]) == "--list-devices") {
+        OpenCLImageProcessing::listDevices();
+        return 0;
+    }
+
+    // Benchmarks run without the menu, so they can be scripted
+    if (argc > 1 && std::string(argv[1]) == "--benchmark")
+        return runBenchmarkMode(argc - 2, argv + 2, files, path);
+    if (argc > 1 && std::string(argv[1]) == "--batch")
+        return runDirectoryBatchMode(argc - 2, argv + 2);
+    if (argc > 1 && std::string(argv[1]) == "--autotune")
+        return runAutotuneMode(argc - 2, argv + 2, files, path);
+    if (argc > 1 && std::string(argv[1]) == "--gaussian-accuracy")
+        return runGaussianAccuracyMode(argc - 2, argv + 2, files, path);
+    if (argc > 1 && std::string(argv[1]) == "--regression")
+        return runRegressionMode(argc - 2, argv + 2, files, path);
+
     // show options that can be run
     int option = 0;
 
@@ -92,9 +301,11 @@ int main()
         std::cout << "Select one of the numbers of the following options:" << std::endl;
         std::cout << "1. Execute Demo" << std::endl;
         std::cout << "2. Execute Runtime Evaluation" << std::endl;
-        std::cout << "3. End Program" << std::endl;
+        std::cout << "3. Execute CPU Scaling Evaluation" << std::endl;
+        std::cout << "4. Execute OpenCL Streaming Batch" << std::endl;
+        std::cout << "5. End Program" << std::endl;
 
-        std::cout << "Input (number 1-3): ";
+        std::cout << "Input (number 1-5): ";
         std::cin >> option;   
     
         switch (option){
@@ -107,6 +318,14 @@ int main()
                 break; 
             }
             case 3: {
+                evaluateScaling(files, path);
+                break;
+            }
+            case 4: {
+                executeStreaming(files, path);
+                break;
+            }
+            case 5: {
                 std::cout << "Exiting Program..." << std::endl;
                 return 0; 
             }